@@ -1,97 +1,100 @@
+#include <array>
+
 #include "common.h"
 
-unsigned int honda_checksum(unsigned int address, uint64_t d, int l) {
+// CRC-8 lookup table of poly, generated at compile time
+static constexpr std::array<uint8_t, 256> gen_crc_lookup_table(uint8_t poly) {
+  std::array<uint8_t, 256> crc_lut{};
+  for (int i = 0; i < 256; i++) {
+    uint8_t crc = i;
+    for (int j = 0; j < 8; j++) {
+      if ((crc & 0x80) != 0)
+        crc = (uint8_t)((crc << 1) ^ poly);
+      else
+        crc <<= 1;
+    }
+    crc_lut[i] = crc;
+  }
+  return crc_lut;
+}
+
+// Static lookup tables for fast CRC computation, constant-initialized so they are valid before any code runs
+static constexpr auto crc8_lut_8h2f = gen_crc_lookup_table(0x2F);  // CRC-8 8H2F/AUTOSAR for Volkswagen
+static constexpr auto crc8_lut_1d = gen_crc_lookup_table(0x1D);    // CRC-8 SAE J1850 for Chrysler
+static constexpr auto crc8_lut_d5 = gen_crc_lookup_table(0xD5);    // CRC-8 poly 0xD5 for the comma pedal
+
+// sum of all nibbles of x, added in parallel within each byte first
+static inline unsigned int nibble_sum(uint64_t x) {
+  x = (x & 0x0F0F0F0F0F0F0F0FULL) + ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL); // 8 sums <= 30
+  return (x * 0x0101010101010101ULL) >> 56; // total <= 240 lands in the top byte
+}
+
+// sum of all bytes of x, added in parallel within each 16 bit word first
+static inline unsigned int byte_sum(uint64_t x) {
+  x = (x & 0x00FF00FF00FF00FFULL) + ((x >> 8) & 0x00FF00FF00FF00FFULL); // 4 sums <= 510
+  return (x * 0x0001000100010001ULL) >> 48; // total <= 2040 lands in the top word
+}
+
+static inline unsigned int honda_checksum_kernel(unsigned int address, uint64_t d, int l) {
   d >>= ((8-l)*8); // remove padding
   d >>= 4; // remove checksum
 
-  int s = 0;
-  bool extended = address > 0x7FF; // extended can
-  while (address) { s += (address & 0xF); address >>= 4; }
-  while (d) { s += (d & 0xF); d >>= 4; }
-  s = 8-s;
-  if (extended) s += 3;
-  s &= 0xF;
-
-  return s;
+  unsigned int s = 8 - nibble_sum(address) - nibble_sum(d);
+  if (address > 0x7FF) s += 3; // extended can
+  return s & 0xF;
 }
 
-unsigned int toyota_checksum(unsigned int address, uint64_t d, int l) {
+static inline unsigned int toyota_checksum_kernel(unsigned int address, uint64_t d, int l) {
   d >>= ((8-l)*8); // remove padding
   d >>= 8; // remove checksum
 
-  unsigned int s = l;
-  while (address) { s += address & 0xFF; address >>= 8; }
-  while (d) { s += d & 0xFF; d >>= 8; }
-
-  return s & 0xFF;
+  return (l + byte_sum(address) + byte_sum(d)) & 0xFF;
 }
 
-unsigned int subaru_checksum(unsigned int address, uint64_t d, int l) {
+static inline unsigned int subaru_checksum_kernel(unsigned int address, uint64_t d, int l) {
   d >>= ((8-l)*8); // remove padding
+  d &= (1ULL << ((l-1)*8)) - 1; // checksum is first byte
 
-  unsigned int s = 0;
-  while (address) { s += address & 0xFF; address >>= 8; }
-  l -= 1; // checksum is first byte
-  while (l) { s += d & 0xFF; d >>= 8; l -= 1; }
-
-  return s & 0xFF;
+  return (byte_sum(address) + byte_sum(d)) & 0xFF;
 }
 
-unsigned int chrysler_checksum(unsigned int address, uint64_t d, int l) {
+static inline unsigned int chrysler_checksum_kernel(uint64_t d, int l) {
   /* This function does not want the checksum byte in the input data.
-  jeep chrysler canbus checksum from http://illmatics.com/Remote%20Car%20Hacking.pdf */
+  jeep chrysler canbus checksum from http://illmatics.com/Remote%20Car%20Hacking.pdf
+  is a CRC8 SAE J1850, poly 0x1D, with init 0xFF and final XOR 0xFF */
   uint8_t checksum = 0xFF;
   for (int j = 0; j < (l - 1); j++) {
-    uint8_t shift = 0x80;
-    uint8_t curr = (d >> 8*j) & 0xFF;
-    for (int i=0; i<8; i++) {
-      uint8_t bit_sum = curr & shift;
-      uint8_t temp_chk = checksum & 0x80U;
-      if (bit_sum != 0U) {
-        bit_sum = 0x1C;
-        if (temp_chk != 0U) {
-          bit_sum = 1;
-        }
-        checksum = checksum << 1;
-        temp_chk = checksum | 1U;
-        bit_sum ^= temp_chk;
-      } else {
-        if (temp_chk != 0U) {
-          bit_sum = 0x1D;
-        }
-        checksum = checksum << 1;
-        bit_sum ^= checksum;
-      }
-      checksum = bit_sum;
-      shift = shift >> 1;
-    }
+    checksum = crc8_lut_1d[checksum ^ ((d >> 8*j) & 0xFF)];
   }
   return ~checksum & 0xFF;
 }
 
-// Static lookup table for fast computation of CRC8 poly 0x2F, aka 8H2F/AUTOSAR
-uint8_t crc8_lut_8h2f[256];
+static inline unsigned int pedal_checksum_kernel(uint64_t d, int l) {
+  uint8_t crc = 0xFF; // standard crc8, poly 0xD5
 
-void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]) {
-  uint8_t crc;
-  int i, j;
+  d >>= ((8-l)*8); // remove padding
+  d >>= 8; // remove checksum
 
-   for (i = 0; i < 256; i++) {
-    crc = i;
-    for (j = 0; j < 8; j++) {
-      if ((crc & 0x80) != 0)
-        crc = (uint8_t)((crc << 1) ^ poly);
-      else
-        crc <<= 1;
-    }
-    crc_lut[i] = crc;
+  for (int i = 0; i < l - 1; i++) {
+    crc = crc8_lut_d5[crc ^ ((d >> (i*8)) & 0xFF)];
   }
+  return crc;
+}
+
+unsigned int honda_checksum(unsigned int address, uint64_t d, int l) {
+  return honda_checksum_kernel(address, d, l);
+}
+
+unsigned int toyota_checksum(unsigned int address, uint64_t d, int l) {
+  return toyota_checksum_kernel(address, d, l);
 }
 
-void init_crc_lookup_tables() {
-  // At init time, set up static lookup tables for fast CRC computation.
+unsigned int subaru_checksum(unsigned int address, uint64_t d, int l) {
+  return subaru_checksum_kernel(address, d, l);
+}
 
-  gen_crc_lookup_table(0x2F, crc8_lut_8h2f);    // CRC-8 8H2F/AUTOSAR for Volkswagen
+unsigned int chrysler_checksum(unsigned int address, uint64_t d, int l) {
+  return chrysler_checksum_kernel(d, l);
 }
 
 unsigned int volkswagen_crc(unsigned int address, uint64_t d, int l) {
@@ -176,25 +179,34 @@ unsigned int volkswagen_crc(unsigned int address, uint64_t d, int l) {
 }
 
 unsigned int pedal_checksum(uint64_t d, int l) {
-  uint8_t crc = 0xFF;
-  uint8_t poly = 0xD5; // standard crc8
-
-  d >>= ((8-l)*8); // remove padding
-  d >>= 8; // remove checksum
+  return pedal_checksum_kernel(d, l);
+}
 
-  int i, j;
-  for (i = 0; i < l - 1; i++) {
-    crc ^= (d >> (i*8)) & 0xFF;
-    for (j = 0; j < 8; j++) {
-      if ((crc & 0x80) != 0) {
-        crc = (uint8_t)((crc << 1) ^ poly);
-      }
-      else {
-        crc <<= 1;
-      }
-    }
+void checksum_batch(SignalType type, const uint32_t *address, const uint64_t *d, const int *l, size_t n, unsigned int *out) {
+  // one loop per algorithm, so the loop bodies don't branch on the type
+  switch (type) {
+    case HONDA_CHECKSUM:
+      for (size_t i = 0; i < n; i++) out[i] = honda_checksum_kernel(address[i], d[i], l[i]);
+      break;
+    case TOYOTA_CHECKSUM:
+      for (size_t i = 0; i < n; i++) out[i] = toyota_checksum_kernel(address[i], d[i], l[i]);
+      break;
+    case SUBARU_CHECKSUM:
+      for (size_t i = 0; i < n; i++) out[i] = subaru_checksum_kernel(address[i], d[i], l[i]);
+      break;
+    case CHRYSLER_CHECKSUM:
+      for (size_t i = 0; i < n; i++) out[i] = chrysler_checksum_kernel(d[i], l[i]);
+      break;
+    case VOLKSWAGEN_CHECKSUM:
+      for (size_t i = 0; i < n; i++) out[i] = volkswagen_crc(address[i], d[i], l[i]);
+      break;
+    case PEDAL_CHECKSUM:
+      for (size_t i = 0; i < n; i++) out[i] = pedal_checksum_kernel(d[i], l[i]);
+      break;
+    default:
+      for (size_t i = 0; i < n; i++) out[i] = 0;
+      break;
   }
-  return crc;
 }
 
 
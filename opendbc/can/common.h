@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <vector>
 #include <map>
 #include <unordered_map>
@@ -13,15 +15,15 @@
 #endif
 
 #define MAX_BAD_COUNTER 5
+#define CANFD_MAX_SIZE 64
+// frames per message kept for all_values between two queries. the ring is allocated once per message, so
+// it doesn't grow: a message arriving more often than 32 times per query (3.2 kHz at the 100 Hz of
+// controlsd) drops its oldest frames, which are counted in MessageState::all_vals_dropped.
+#define MAX_ALL_VALS 32
+// standard 11 bit addresses are looked up in a table, extended ones by binary search
+#define ADDRESS_TABLE_SIZE 0x800
 
 // Helper functions
-unsigned int honda_checksum(unsigned int address, uint64_t d, int l);
-unsigned int toyota_checksum(unsigned int address, uint64_t d, int l);
-unsigned int subaru_checksum(unsigned int address, uint64_t d, int l);
-unsigned int chrysler_checksum(unsigned int address, uint64_t d, int l);
-void init_crc_lookup_tables();
-unsigned int volkswagen_crc(unsigned int address, uint64_t d, int l);
-unsigned int pedal_checksum(uint64_t d, int l);
 uint64_t read_u64_be(const uint8_t* v);
 uint64_t read_u64_le(const uint8_t* v);
 
@@ -30,9 +32,20 @@ public:
   uint32_t address;
   unsigned int size;
 
+  const Msg *msg = NULL;
   std::vector<Signal> parse_sigs;
+  std::vector<int> sig_index;  // of each parse_sig in msg->sigs
   std::vector<double> vals;
-  std::vector<std::vector<double>> all_vals;
+  // ring buffer of the values of the frames since the last query, one row of parse_sigs.size() values per frame.
+  // allocated once by init_buffers(), so parsing doesn't allocate
+  std::vector<double> all_vals;
+  uint32_t all_vals_begin = 0;
+  uint32_t all_vals_count = 0;
+  // frames dropped from all_vals because more than MAX_ALL_VALS arrived between two queries
+  uint64_t all_vals_dropped = 0;
+  // all signals of a frame, filled by msg->decode
+  std::vector<int64_t> decoded_raw;
+  std::vector<double> decoded_vals;
 
   uint64_t seen;
   uint64_t check_threshold;
@@ -42,18 +55,47 @@ public:
 
   bool ignore_checksum = false;
   bool ignore_counter = false;
+  // parsed since the last CANParser::query_updated()
+  bool updated = false;
 
-  bool parse(uint64_t sec, uint8_t * dat);
+  bool parse(uint64_t sec, const uint8_t * dat, size_t dat_size);
   bool update_counter_generic(int64_t v, int cnt_size);
+  void add_signal(int index);
+  void init_buffers();
+  // values of a signal since the last clear_all_vals(), oldest first
+  std::vector<double> get_all_vals(int sig) const;
+  // the value of a signal in the i-th frame since the last clear_all_vals(), i < all_vals_count
+  inline double get_all_val(int i, int sig) const {
+    return all_vals[((all_vals_begin + i) % MAX_ALL_VALS) * parse_sigs.size() + sig];
+  }
+  void clear_all_vals();
 };
 
 class CANParser {
 private:
+  friend class CANParserGroup;
   const int bus;
   kj::Array<capnp::word> aligned_buf;
 
   const DBC *dbc = NULL;
-  std::unordered_map<uint32_t, MessageState> message_states;
+  std::vector<MessageState> message_states;
+  // index into message_states, -1 if the address isn't parsed
+  std::array<int16_t, ADDRESS_TABLE_SIZE> address_table;
+  std::vector<std::pair<uint32_t, int16_t>> extended_addresses;  // sorted
+  // messages parsed since the last query_updated(), in the order of their first frame
+  std::vector<MessageState *> updated_states;
+
+  MessageState &add_message(uint32_t address);
+  inline MessageState *lookup(uint32_t address) {
+    int i = -1;
+    if (address < ADDRESS_TABLE_SIZE) {
+      i = address_table[address];
+    } else {
+      auto it = std::lower_bound(extended_addresses.begin(), extended_addresses.end(), std::make_pair(address, (int16_t)-1));
+      if (it != extended_addresses.end() && it->first == address) i = it->second;
+    }
+    return i >= 0 ? &message_states[i] : nullptr;
+  }
 
 public:
   bool can_valid = false;
@@ -68,18 +110,87 @@ public:
   void UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Reader& cans);
   #endif
   void UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cans);
+  // parses one frame of this parser's bus
+  inline void UpdateCan(uint64_t sec, uint32_t address, const uint8_t *dat, size_t dat_size) {
+    MessageState *state = lookup(address);
+    if (state && dat_size <= CANFD_MAX_SIZE) {
+      // the values of the last query were handed out until now
+      if (!state->updated) state->clear_all_vals();
+      if (state->parse(sec, dat, dat_size) && !state->updated) {
+        state->updated = true;
+        updated_states.push_back(state);
+      }
+    }
+  }
   void UpdateValid(uint64_t sec);
   std::vector<SignalValue> query_latest();
+  // replaces states with the messages parsed since the last call, without copying their values. vals and
+  // the values of each frame (get_all_val) of the states stay valid until the next update.
+  void query_updated(std::vector<const MessageState *> &states);
+};
+
+#ifndef DYNAMIC_CAPNP
+// Parsers of several buses fed by the same `can` events, e.g. the pt, cam and radar parsers of a car.
+// An event is read once and each frame goes to the parsers of its bus, instead of every parser reading
+// the whole event. can_valid and query_latest of each parser work as if it was updated on its own.
+class CANParserGroup {
+private:
+  kj::Array<capnp::word> aligned_buf;
+  std::vector<CANParser *> parsers;
+  // indexes into parsers by src, a bus can have several parsers
+  std::array<std::vector<int>, 256> bus_parsers;
+
+public:
+  CANParserGroup();
+  // the parsers are not owned by the group
+  void add(CANParser *parser);
+  void update_string(const std::string &data, bool sendcan);
+  void UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Reader& cans);
+};
+#endif
+
+// the message and signals of a pack, resolved once by CANPacker::handle() for messages sent every cycle
+struct PackHandle {
+  const Msg *msg = NULL;  // NULL if the address isn't in the DBC
+  const Signal *counter = NULL;
+  const Signal *checksum = NULL;
+  // the signals of the values passed to pack(), NULL for undefined signals, whose values are ignored
+  std::vector<const Signal *> sigs;
+};
+
+struct PackRequest {
+  const PackHandle *handle;
+  const double *values;  // one per handle->sigs
+  int counter;
+  uint8_t bus;
 };
 
 class CANPacker {
 private:
   const DBC *dbc = NULL;
-  std::map<std::pair<uint32_t, std::string>, Signal> signal_lookup;
+  // pointing into the DBC, the index of a signal in its message is sig - msg.sigs
+  std::map<std::pair<uint32_t, std::string>, const Signal *> signal_lookup;
   std::map<uint32_t, Msg> message_lookup;
+  // the counter and checksum of each message, without signals
+  std::map<uint32_t, PackHandle> message_handles;
+  std::vector<int64_t> raw_vals;  // passed to msg.encode
+  // reused by pack() by signal names
+  PackHandle names_handle;
+  std::vector<double> names_values;
 
 public:
   CANPacker(const std::string& dbc_name);
-  uint64_t pack(uint32_t address, const std::vector<SignalPackValue> &values, int counter);
+  // writes the payload to out, which holds CANFD_MAX_SIZE bytes, and returns its size.
+  // returns 0 and leaves out untouched if the address isn't in the DBC
+  size_t pack(uint32_t address, const std::vector<SignalPackValue> &values, int counter, uint8_t *out);
+  PackHandle handle(uint32_t address, const std::vector<std::string> &signal_names);
+  // same for a handle, whose msg must be set. values holds one value per handle.sigs
+  size_t pack(const PackHandle &handle, const double *values, int counter, uint8_t *out);
+  #ifndef DYNAMIC_CAPNP
+  // packs the messages of a cycle straight into a list of cans, sized to the requests
+  void pack(const std::vector<PackRequest> &requests, capnp::List<cereal::CanData>::Builder cans);
+  // returns a serialized sendcan event of the messages
+  std::string pack_sendcan(const std::vector<PackRequest> &requests, bool valid);
+  #endif
   Msg* lookup_message(uint32_t address);
 };
@@ -1,7 +1,7 @@
 # distutils: language = c++
 #cython: language_level=3
 
-from libc.stdint cimport uint32_t, uint64_t, uint16_t
+from libc.stdint cimport uint8_t, uint32_t, uint64_t, uint16_t
 from libcpp.vector cimport vector
 from libcpp.map cimport map
 from libcpp.string cimport string
@@ -25,6 +25,7 @@ cdef extern from "common_dbc.h":
   cdef struct Signal:
     const char* name
     int b1, b2, bo
+    int lsb, msb
     bool is_signed
     double factor, offset
     SignalType type
@@ -70,14 +71,42 @@ cdef extern from "common_dbc.h":
 
 
 cdef extern from "common.h":
+  enum: CANFD_MAX_SIZE
+
   cdef const DBC* dbc_lookup(const string);
 
+  cdef cppclass MessageState:
+    uint32_t address
+    vector[Signal] parse_sigs
+    vector[double] vals
+    uint32_t all_vals_count
+    double get_all_val(int, int) const
+
   cdef cppclass CANParser:
     bool can_valid
     CANParser(int, string, vector[MessageParseOptions], vector[SignalParseOptions])
     void update_string(string, bool)
     vector[SignalValue] query_latest()
+    void query_updated(vector[const MessageState *] &)
+
+  cdef cppclass CANParserGroup:
+    CANParserGroup()
+    void add(CANParser *)
+    void update_string(string, bool)
+
+  cdef cppclass PackHandle:
+    const Msg *msg
+    vector[const Signal *] sigs
+
+  cdef struct PackRequest:
+    const PackHandle *handle
+    const double *values
+    int counter
+    uint8_t bus
 
   cdef cppclass CANPacker:
    CANPacker(string)
-   uint64_t pack(uint32_t, vector[SignalPackValue], int counter)
+   size_t pack(uint32_t, vector[SignalPackValue], int counter, uint8_t *out)
+   PackHandle handle(uint32_t, vector[string])
+   size_t pack(PackHandle, const double *, int counter, uint8_t *out)
+   string pack_sendcan(vector[PackRequest], bool)
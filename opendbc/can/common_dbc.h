@@ -45,18 +45,31 @@ enum SignalType {
 struct Signal {
   const char* name;
   int b1, b2, bo;
+  // positions of the least and most significant bits in the payload (bit i is bit i % 8 of byte i / 8),
+  // used for messages longer than 8 bytes
+  int lsb, msb;
   bool is_signed;
   double factor, offset;
   bool is_little_endian;
   SignalType type;
 };
 
+// generated straight-line decoder of a classic CAN message: the raw and scaled values of all signals,
+// in sigs order. returns false on a checksum mismatch, always true if check_checksum is false.
+typedef bool (*MsgDecodeFn)(uint64_t dat_le, uint64_t dat_be, bool check_checksum, int64_t *raw, double *vals);
+// generated encoder: packs the raw values of all signals and sets the checksum, if the message has one.
+// the payload is big endian, its first byte is the most significant byte.
+typedef uint64_t (*MsgEncodeFn)(const int64_t *raw);
+
 struct Msg {
   const char* name;
   uint32_t address;
   unsigned int size;
   size_t num_sigs;
   const Signal *sigs;
+  // NULL if the signals aren't all within one uint64_t (e.g. CAN-FD messages), sigs are interpreted then
+  MsgDecodeFn decode;
+  MsgEncodeFn encode;
 };
 
 struct Val {
@@ -74,6 +87,17 @@ struct DBC {
   size_t num_vals;
 };
 
+// checksums, the payload d is read as an uint64_t in the byte order each algorithm expects
+unsigned int honda_checksum(unsigned int address, uint64_t d, int l);
+unsigned int toyota_checksum(unsigned int address, uint64_t d, int l);
+unsigned int subaru_checksum(unsigned int address, uint64_t d, int l);
+unsigned int chrysler_checksum(unsigned int address, uint64_t d, int l);
+unsigned int volkswagen_crc(unsigned int address, uint64_t d, int l);
+unsigned int pedal_checksum(uint64_t d, int l);
+// the checksums of n frames at once, frame i is address[i], d[i] and l[i] as above.
+// types that are not checksums give 0
+void checksum_batch(SignalType type, const uint32_t *address, const uint64_t *d, const int *l, size_t n, unsigned int *out);
+
 std::vector<const DBC*>& get_dbcs();
 const DBC* dbc_lookup(const std::string& dbc_name);
 
@@ -8,13 +8,19 @@ const Signal sigs_{{address}}[] = {
     {
       {% if sig.is_little_endian %}
         {% set b1 = sig.start_bit %}
+        {% set lsb = sig.start_bit %}
+        {% set msb = sig.start_bit + sig.size - 1 %}
       {% else %}
         {% set b1 = (sig.start_bit//8)*8  + (-sig.start_bit-1) % 8 %}
+        {% set lsb = be_bits[be_bits.index(sig.start_bit) + sig.size - 1] %}
+        {% set msb = sig.start_bit %}
       {% endif %}
       .name = "{{sig.name}}",
       .b1 = {{b1}},
       .b2 = {{sig.size}},
       .bo = {{64 - (b1 + sig.size)}},
+      .lsb = {{lsb}},
+      .msb = {{msb}},
       .is_signed = {{"true" if sig.is_signed else "false"}},
       .factor = {{sig.factor}},
       .offset = {{sig.offset}},
@@ -45,6 +51,51 @@ const Signal sigs_{{address}}[] = {
 };
 {% endfor %}
 
+{% for address, msg_name, msg_size, sigs in msgs %}
+{% set gen = codegen[address] %}
+{% if gen %}
+bool decode_{{address}}(uint64_t dat_le, uint64_t dat_be, bool check_checksum, int64_t *raw, double *vals) {
+  {% for s in gen.sigs %}
+  {% set sig = sigs[s.index] %}
+  {% if sig.is_signed %}
+  raw[{{s.index}}] = (int64_t)((({{s.src}} >> {{s.shift}}) & {{s.mask}}) << {{s.sign_shift}}) >> {{s.sign_shift}};
+  {% else %}
+  raw[{{s.index}}] = ({{s.src}} >> {{s.shift}}) & {{s.mask}};
+  {% endif %}
+  {% if sig.factor == 1 and sig.offset == 0 %}
+  vals[{{s.index}}] = raw[{{s.index}}];
+  {% else %}
+  vals[{{s.index}}] = raw[{{s.index}}] * {{sig.factor}} + {{sig.offset}};
+  {% endif %}
+  {% endfor %}
+  {% if gen.checksum %}
+  if (check_checksum && {{gen.checksum.parse}} != raw[{{gen.checksum.index}}]) {
+    return false;
+  }
+  {% endif %}
+  return true;
+}
+
+uint64_t encode_{{address}}(const int64_t *raw) {
+  uint64_t dat_le = 0, dat_be = 0;
+  {% for s in gen.sigs %}
+  {{s.src}} |= ((uint64_t)raw[{{s.index}}] & {{s.mask}}) << {{s.shift}};
+  {% endfor %}
+  uint64_t ret = dat_be | __builtin_bswap64(dat_le);
+  {% if gen.checksum and gen.checksum.pack %}
+  {% set s = gen.sigs[gen.checksum.index] %}
+  const uint64_t chksm = {{gen.checksum.pack}};
+  {% if s.src == "dat_le" %}
+  ret = (ret & ~{{s.field}}) | __builtin_bswap64((chksm & {{s.mask}}) << {{s.shift}});
+  {% else %}
+  ret = (ret & ~{{s.field}}) | ((chksm & {{s.mask}}) << {{s.shift}});
+  {% endif %}
+  {% endif %}
+  return ret;
+}
+
+{% endif %}
+{% endfor %}
 const Msg msgs[] = {
 {% for address, msg_name, msg_size, sigs in msgs %}
   {% set address_hex = "0x%X" % address %}
@@ -54,6 +105,13 @@ const Msg msgs[] = {
     .size = {{msg_size}},
     .num_sigs = ARRAYSIZE(sigs_{{address}}),
     .sigs = sigs_{{address}},
+    {% if codegen[address] %}
+    .decode = decode_{{address}},
+    .encode = encode_{{address}},
+    {% else %}
+    .decode = nullptr,
+    .encode = nullptr,
+    {% endif %}
   },
 {% endfor %}
 };
@@ -3,8 +3,12 @@
 #include <algorithm>
 #include <map>
 #include <cmath>
+#include <cstring>
 
 #include "common.h"
+#ifndef DYNAMIC_CAPNP
+#include "cereal/messaging/messaging.h"
+#endif
 
 #define WARN printf
 
@@ -33,6 +37,31 @@ static uint64_t set_value(uint64_t ret, const Signal& sig, int64_t ival) {
   return ret;
 }
 
+// sets a signal byte by byte, for CAN-FD messages longer than 8 bytes
+static void set_value(uint8_t *msg, size_t msg_size, const Signal& sig, int64_t ival) {
+  int i = sig.lsb / 8;
+  int bits = sig.b2;
+  if (sig.b2 < 64) {
+    ival &= ((1ULL << sig.b2) - 1);
+  }
+  while (i >= 0 && i < msg_size && bits > 0) {
+    int shift = (sig.lsb / 8) == i ? sig.lsb : i*8;
+    int n = std::min(bits, 8 - (shift - i*8));
+    msg[i] &= ~(((1ULL << n) - 1) << (shift - i*8));
+    msg[i] |= (ival & ((1ULL << n) - 1)) << (shift - i*8);
+    bits -= n;
+    ival >>= n;
+    i = sig.is_little_endian ? i+1 : i-1;
+  }
+}
+
+// the first byte of the payload is the most significant byte of a classic CAN message
+static void to_bytes(uint64_t dat, unsigned int size, uint8_t *out) {
+  for (int i = 0; i < size; i++) {
+    out[i] = dat >> (56 - 8*i);
+  }
+}
+
 CANPacker::CANPacker(const std::string& dbc_name) {
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
@@ -40,77 +69,174 @@ CANPacker::CANPacker(const std::string& dbc_name) {
   for (int i=0; i<dbc->num_msgs; i++) {
     const Msg* msg = &dbc->msgs[i];
     message_lookup[msg->address] = *msg;
+    PackHandle &h = message_handles[msg->address];
+    h.msg = msg;
     for (int j=0; j<msg->num_sigs; j++) {
       const Signal* sig = &msg->sigs[j];
-      signal_lookup[std::make_pair(msg->address, std::string(sig->name))] = *sig;
+      signal_lookup[std::make_pair(msg->address, std::string(sig->name))] = sig;
+      if (strcmp(sig->name, "COUNTER") == 0) {
+        h.counter = sig;
+      } else if (strcmp(sig->name, "CHECKSUM") == 0) {
+        h.checksum = sig;
+      }
     }
+    raw_vals.resize(std::max(raw_vals.size(), msg->num_sigs));
   }
-  init_crc_lookup_tables();
 }
 
-uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signals, int counter) {
-  uint64_t ret = 0;
-  for (const auto& sigval : signals) {
-    double value = sigval.value;
+PackHandle CANPacker::handle(uint32_t address, const std::vector<std::string> &signal_names) {
+  auto msg_it = message_handles.find(address);
+  if (msg_it == message_handles.end()) {
+    WARN("undefined address %d\n", address);
+    return {};
+  }
+  PackHandle ret = msg_it->second;
+  for (const auto &name : signal_names) {
+    auto sig_it = signal_lookup.find(std::make_pair(address, name));
+    if (sig_it == signal_lookup.end()) {
+      WARN("undefined signal %s - %d\n", name.c_str(), address);
+    }
+    ret.sigs.push_back(sig_it == signal_lookup.end() ? NULL : sig_it->second);
+  }
+  return ret;
+}
 
+size_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signals, int counter, uint8_t *out) {
+  auto msg_it = message_handles.find(address);
+  if (msg_it == message_handles.end()) {
+    WARN("undefined address %d\n", address);
+    return 0;
+  }
+
+  names_handle.msg = msg_it->second.msg;
+  names_handle.counter = msg_it->second.counter;
+  names_handle.checksum = msg_it->second.checksum;
+  names_handle.sigs.clear();
+  names_values.clear();
+  for (const auto& sigval : signals) {
     auto sig_it = signal_lookup.find(std::make_pair(address, sigval.name));
     if (sig_it == signal_lookup.end()) {
       WARN("undefined signal %s - %d\n", sigval.name.c_str(), address);
       continue;
     }
-    const auto& sig = sig_it->second;
+    names_handle.sigs.push_back(sig_it->second);
+    names_values.push_back(sigval.value);
+  }
 
-    int64_t ival = (int64_t)(round((value - sig.offset) / sig.factor));
+  return pack(names_handle, names_values.data(), counter, out);
+}
+
+size_t CANPacker::pack(const PackHandle &handle, const double *values, int counter, uint8_t *out) {
+  assert(handle.msg);
+  const Msg &msg = *handle.msg;
+  const uint32_t address = msg.address;
+  const unsigned int size = msg.size;
+
+  // classic CAN messages are packed by their generated encoder, or into a uint64_t. CAN-FD messages byte by byte.
+  // a counter without COUNTER signal skips the checksum, that's left to the interpreted path
+  const bool encoded = msg.encode && (counter < 0 || handle.counter);
+  const bool fd = !encoded && size > 8;
+  uint64_t ret = 0;
+  if (encoded) {
+    std::fill_n(raw_vals.begin(), msg.num_sigs, 0);
+  } else if (fd) {
+    memset(out, 0, size);
+  }
+  auto set = [&](const Signal &sig, int64_t ival) {
+    if (encoded) {
+      raw_vals[&sig - msg.sigs] = ival;
+    } else if (fd) {
+      set_value(out, size, sig, ival);
+    } else {
+      ret = set_value(ret, sig, ival);
+    }
+  };
+
+  for (int i = 0; i < handle.sigs.size(); i++) {
+    if (!handle.sigs[i]) continue;
+    const Signal &sig = *handle.sigs[i];
+
+    int64_t ival = (int64_t)(round((values[i] - sig.offset) / sig.factor));
     if (ival < 0) {
       ival = (1ULL << sig.b2) + ival;
     }
 
-    ret = set_value(ret, sig, ival);
+    set(sig, ival);
   }
 
   if (counter >= 0){
-    auto sig_it = signal_lookup.find(std::make_pair(address, "COUNTER"));
-    if (sig_it == signal_lookup.end()) {
+    if (!handle.counter) {
       WARN("COUNTER not defined\n");
-      return ret;
+      if (!fd) to_bytes(ret, size, out);
+      return size;
     }
-    const auto& sig = sig_it->second;
+    const Signal &sig = *handle.counter;
 
     if ((sig.type != SignalType::HONDA_COUNTER) && (sig.type != SignalType::VOLKSWAGEN_COUNTER)) {
       WARN("COUNTER signal type not valid\n");
     }
 
-    ret = set_value(ret, sig, counter);
+    set(sig, counter);
+  }
+
+  if (encoded) {
+    to_bytes(msg.encode(raw_vals.data()), size, out);
+    return size;
+  } else if (fd) {
+    // checksums of CAN-FD messages are rejected by process_dbc.py
+    return size;
   }
 
-  auto sig_it_checksum = signal_lookup.find(std::make_pair(address, "CHECKSUM"));
-  if (sig_it_checksum != signal_lookup.end()) {
-    const auto& sig = sig_it_checksum->second;
+  if (handle.checksum) {
+    const Signal &sig = *handle.checksum;
     if (sig.type == SignalType::HONDA_CHECKSUM) {
-      unsigned int chksm = honda_checksum(address, ret, message_lookup[address].size);
+      unsigned int chksm = honda_checksum(address, ret, size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::TOYOTA_CHECKSUM) {
-      unsigned int chksm = toyota_checksum(address, ret, message_lookup[address].size);
+      unsigned int chksm = toyota_checksum(address, ret, size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::VOLKSWAGEN_CHECKSUM) {
       // FIXME: Hackish fix for an endianness issue. The message is in reverse byte order
       // until later in the pack process. Checksums can be run backwards, CRCs not so much.
       // The correct fix is unclear but this works for the moment.
-      unsigned int chksm = volkswagen_crc(address, ReverseBytes(ret), message_lookup[address].size);
+      unsigned int chksm = volkswagen_crc(address, ReverseBytes(ret), size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::SUBARU_CHECKSUM) {
-      unsigned int chksm = subaru_checksum(address, ret, message_lookup[address].size);
+      unsigned int chksm = subaru_checksum(address, ret, size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::CHRYSLER_CHECKSUM) {
-      unsigned int chksm = chrysler_checksum(address, ReverseBytes(ret), message_lookup[address].size);
+      unsigned int chksm = chrysler_checksum(address, ReverseBytes(ret), size);
       ret = set_value(ret, sig, chksm);
     } else {
       //WARN("CHECKSUM signal type not valid\n");
     }
   }
 
-  return ret;
+  to_bytes(ret, size, out);
+  return size;
+}
+
+#ifndef DYNAMIC_CAPNP
+void CANPacker::pack(const std::vector<PackRequest> &requests, capnp::List<cereal::CanData>::Builder cans) {
+  assert(cans.size() == requests.size());
+  for (int i = 0; i < requests.size(); i++) {
+    const PackRequest &r = requests[i];
+    assert(r.handle->msg);
+    auto c = cans[i];
+    c.setAddress(r.handle->msg->address);
+    c.setBusTime(0);
+    c.setSrc(r.bus);
+    pack(*r.handle, r.values, r.counter, c.initDat(r.handle->msg->size).begin());
+  }
+}
+
+std::string CANPacker::pack_sendcan(const std::vector<PackRequest> &requests, bool valid) {
+  MessageBuilder msg;
+  pack(requests, msg.initEvent(valid).initSendcan(requests.size()));
+  auto bytes = msg.toBytes();
+  return std::string((const char *)bytes.begin(), bytes.size());
 }
+#endif
 
 Msg* CANPacker::lookup_message(uint32_t address) {
   return &message_lookup[address];
@@ -1,7 +1,7 @@
 # distutils: language = c++
 # cython: c_string_encoding=ascii, language_level=3
 
-from libc.stdint cimport uint32_t, uint64_t
+from libc.stdint cimport uint8_t, uint32_t
 from libcpp.vector cimport vector
 from libcpp.map cimport map
 from libcpp.string cimport string
@@ -9,7 +9,7 @@ from libcpp cimport bool
 from posix.dlfcn cimport dlopen, dlsym, RTLD_LAZY
 
 from .common cimport CANPacker as cpp_CANPacker
-from .common cimport dbc_lookup, SignalPackValue, DBC
+from .common cimport dbc_lookup, SignalPackValue, PackHandle, PackRequest, DBC, CANFD_MAX_SIZE
 
 
 cdef class CANPacker:
@@ -17,7 +17,7 @@ cdef class CANPacker:
     cpp_CANPacker *packer
     const DBC *dbc
     map[string, (int, int)] name_to_address_and_size
-    map[int, int] address_to_size
+    vector[PackHandle] handles
 
   def __init__(self, dbc_name):
     self.dbc = dbc_lookup(dbc_name)
@@ -29,9 +29,8 @@ cdef class CANPacker:
     for i in range(num_msgs):
       msg = self.dbc[0].msgs[i]
       self.name_to_address_and_size[string(msg.name)] = (msg.address, msg.size)
-      self.address_to_size[msg.address] = msg.size
 
-  cdef uint64_t pack(self, addr, values, counter):
+  cdef size_t pack(self, addr, values, counter, uint8_t *out):
     cdef vector[SignalPackValue] values_thing
     values_thing.reserve(len(values))
     cdef SignalPackValue spv
@@ -41,25 +40,67 @@ cdef class CANPacker:
       spv.value = value
       values_thing.push_back(spv)
 
-    return self.packer.pack(addr, values_thing, counter)
-
-  cdef inline uint64_t ReverseBytes(self, uint64_t x):
-    return (((x & 0xff00000000000000ull) >> 56) |
-           ((x & 0x00ff000000000000ull) >> 40) |
-           ((x & 0x0000ff0000000000ull) >> 24) |
-           ((x & 0x000000ff00000000ull) >> 8) |
-           ((x & 0x00000000ff000000ull) << 8) |
-           ((x & 0x0000000000ff0000ull) << 24) |
-           ((x & 0x000000000000ff00ull) << 40) |
-           ((x & 0x00000000000000ffull) << 56))
+    return self.packer.pack(<uint32_t>addr, values_thing, <int>counter, out)
 
   cpdef make_can_msg(self, name_or_addr, bus, values, counter=-1):
-    cdef int addr, size
+    cdef int addr
+    if type(name_or_addr) == int:
+      addr = name_or_addr
+    else:
+      addr, _ = self.name_to_address_and_size[name_or_addr.encode('utf8')]
+    # an address that isn't in the DBC packs to an empty payload
+    cdef uint8_t dat[CANFD_MAX_SIZE]
+    cdef size_t size = self.pack(addr, values, counter, dat)
+    return [addr, 0, (<char *>dat)[:size], bus]
+
+  def make_handle(self, name_or_addr, signal_names):
+    """Resolves a message and its signals once, for the messages sent every cycle. The values packed
+    with the handle are a sequence in the order of signal_names."""
     if type(name_or_addr) == int:
       addr = name_or_addr
-      size = self.address_to_size[name_or_addr]
     else:
-      addr, size = self.name_to_address_and_size[name_or_addr.encode('utf8')]
-    cdef uint64_t val = self.pack(addr, values, counter)
-    val = self.ReverseBytes(val)
-    return [addr, 0, (<char *>&val)[:size], bus]
+      addr, _ = self.name_to_address_and_size[name_or_addr.encode('utf8')]
+    cdef PackHandle handle = self.packer.handle(addr, [name.encode('utf8') for name in signal_names])
+    if handle.msg == NULL:
+      raise KeyError(name_or_addr)
+    self.handles.push_back(handle)
+    return self.handles.size() - 1
+
+  cdef const PackHandle *get_handle(self, int handle) except NULL:
+    if handle < 0 or handle >= <int>self.handles.size():
+      raise IndexError(f"invalid pack handle {handle}")
+    return &self.handles[handle]
+
+  cpdef make_can_msg_handle(self, int handle, bus, values, counter=-1):
+    cdef const PackHandle *h = self.get_handle(handle)
+    if len(values) != h.sigs.size():
+      raise ValueError(f"expected {h.sigs.size()} values, got {len(values)}")
+    cdef vector[double] vals = values
+    cdef uint8_t dat[CANFD_MAX_SIZE]
+    cdef size_t size = self.packer.pack(h[0], vals.data(), <int>counter, dat)
+    return [h.msg.address, 0, (<char *>dat)[:size], bus]
+
+  def make_sendcan(self, msgs, valid=True):
+    """Packs the (handle, bus, values, counter) of all messages of a cycle into a serialized sendcan event."""
+    cdef vector[double] values
+    cdef vector[PackRequest] requests
+    cdef PackRequest r
+    cdef int handle
+    requests.resize(len(msgs))
+    for i, (handle, bus, vals, counter) in enumerate(msgs):
+      r.handle = self.get_handle(handle)
+      if len(vals) != r.handle.sigs.size():
+        raise ValueError(f"expected {r.handle.sigs.size()} values, got {len(vals)}")
+      r.values = NULL
+      r.counter = counter
+      r.bus = bus
+      requests[i] = r
+      for v in vals:
+        values.push_back(v)
+
+    # the values are in place once all are added
+    cdef size_t offset = 0
+    for i in range(requests.size()):
+      requests[i].values = values.data() + offset
+      offset += requests[i].handle.sigs.size()
+    return self.packer.pack_sendcan(requests, valid)
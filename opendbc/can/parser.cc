@@ -13,15 +13,70 @@
 // #define DEBUG printf
 #define INFO printf
 
-bool MessageState::parse(uint64_t sec, uint8_t * dat) {
-  uint64_t dat_le = read_u64_le(dat);
-  uint64_t dat_be = read_u64_be(dat);
+// reads a signal byte by byte, for CAN-FD messages longer than 8 bytes
+static int64_t get_raw_value(const uint8_t *dat, size_t dat_size, const Signal &sig) {
+  int64_t ret = 0;
+  int i = sig.msb / 8;
+  int bits = sig.b2;
+  while (i >= 0 && i < dat_size && bits > 0) {
+    int lsb = (sig.lsb / 8) == i ? sig.lsb : i*8;
+    int msb = (sig.msb / 8) == i ? sig.msb : (i+1)*8 - 1;
+    int n = msb - lsb + 1;
+    uint64_t d = (dat[i] >> (lsb - (i*8))) & ((1ULL << n) - 1);
+    ret |= d << (bits - n);
+    bits -= n;
+    i = sig.is_little_endian ? i-1 : i+1;
+  }
+  return ret;
+}
+
+bool MessageState::parse(uint64_t sec, const uint8_t * dat, size_t dat_size) {
+  // classic CAN: every signal is a shift of the 64 bit payload
+  uint64_t dat_le = 0, dat_be = 0;
+  uint8_t fd_dat[CANFD_MAX_SIZE];
+  const bool fd = size > 8;
+  if (!fd) {
+    uint8_t d[8] = {0};
+    memcpy(d, dat, std::min<size_t>(dat_size, 8));
+    dat_le = read_u64_le(d);
+    dat_be = read_u64_be(d);
+  } else {
+    // zero padded to the message size
+    dat_size = std::min<size_t>(dat_size, size);
+    memcpy(fd_dat, dat, dat_size);
+    memset(fd_dat + dat_size, 0, size - dat_size);
+  }
+
+  // the next row of the ring buffer, the oldest one when it's full
+  double *row = all_vals.data() + ((all_vals_begin + all_vals_count) % MAX_ALL_VALS) * parse_sigs.size();
+
+  // classic CAN messages are decoded by their generated decoder, checksum included. the checksum and
+  // counters are still checked in the order of the signals, like the interpreted signals below.
+  const bool decoded = !fd && msg->decode;
+  const bool checksum_ok = decoded && msg->decode(dat_le, dat_be, !ignore_checksum, decoded_raw.data(), decoded_vals.data());
 
   for (int i=0; i < parse_sigs.size(); i++) {
     auto& sig = parse_sigs[i];
+    if (decoded) {
+      const bool is_counter = sig.type == SignalType::HONDA_COUNTER || sig.type == SignalType::VOLKSWAGEN_COUNTER ||
+                              sig.type == SignalType::PEDAL_COUNTER;
+      if (!checksum_ok && sig.type != SignalType::DEFAULT && !is_counter) {
+        INFO("0x%X CHECKSUM FAIL\n", address);
+        return false;
+      }
+      if (!ignore_counter && is_counter && !update_counter_generic(decoded_raw[sig_index[i]], sig.b2)) {
+        return false;
+      }
+      vals[i] = decoded_vals[sig_index[i]];
+      row[i] = vals[i];
+      continue;
+    }
+
     int64_t tmp;
 
-    if (sig.is_little_endian){
+    if (fd) {
+      tmp = get_raw_value(fd_dat, size, sig);
+    } else if (sig.is_little_endian){
       tmp = (dat_le >> sig.b1) & ((1ULL << sig.b2)-1);
     } else {
       tmp = (dat_be >> sig.bo) & ((1ULL << sig.b2)-1);
@@ -83,13 +138,47 @@ bool MessageState::parse(uint64_t sec, uint8_t * dat) {
     }
 
     vals[i] = tmp * sig.factor + sig.offset;
-    all_vals[i].push_back(vals[i]);
+    row[i] = vals[i];
   }
   seen = sec;
 
+  if (all_vals_count < MAX_ALL_VALS) {
+    all_vals_count++;
+  } else {
+    all_vals_begin = (all_vals_begin + 1) % MAX_ALL_VALS;
+    if (all_vals_dropped++ == 0) {
+      INFO("0x%X: more than %d frames between queries, all_values only keeps the latest\n", address, MAX_ALL_VALS);
+    }
+  }
   return true;
 }
 
+void MessageState::add_signal(int index) {
+  parse_sigs.push_back(msg->sigs[index]);
+  sig_index.push_back(index);
+  vals.push_back(0);
+}
+
+void MessageState::init_buffers() {
+  all_vals.assign(parse_sigs.size() * MAX_ALL_VALS, 0);
+  clear_all_vals();
+  decoded_raw.assign(msg->num_sigs, 0);
+  decoded_vals.assign(msg->num_sigs, 0);
+}
+
+std::vector<double> MessageState::get_all_vals(int sig) const {
+  std::vector<double> ret(all_vals_count);
+  for (int i = 0; i < all_vals_count; i++) {
+    ret[i] = get_all_val(i, sig);
+  }
+  return ret;
+}
+
+void MessageState::clear_all_vals() {
+  all_vals_begin = 0;
+  all_vals_count = 0;
+}
+
 
 bool MessageState::update_counter_generic(int64_t v, int cnt_size) {
   uint8_t old_counter = counter;
@@ -116,10 +205,10 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
 
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
-  init_crc_lookup_tables();
+  address_table.fill(-1);
 
   for (const auto& op : options) {
-    MessageState &state = message_states[op.address];
+    MessageState &state = add_message(op.address);
     state.address = op.address;
     // state.check_frequency = op.check_frequency,
 
@@ -140,15 +229,14 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
       assert(false);
     }
 
+    state.msg = msg;
     state.size = msg->size;
 
     // track checksums and counters for this message
     for (int i = 0; i < msg->num_sigs; i++) {
       const Signal *sig = &msg->sigs[i];
       if (sig->type != SignalType::DEFAULT) {
-        state.parse_sigs.push_back(*sig);
-        state.vals.push_back(0);
-        state.all_vals.push_back({});
+        state.add_signal(i);
       }
     }
 
@@ -160,14 +248,16 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
         const Signal *sig = &msg->sigs[i];
         if (strcmp(sig->name, sigop.name) == 0
             && sig->type == SignalType::DEFAULT) {
-          state.parse_sigs.push_back(*sig);
-          state.vals.push_back(0);
-          state.all_vals.push_back({});
+          state.add_signal(i);
           break;
         }
       }
     }
   }
+
+  for (auto &state : message_states) {
+    state.init_buffers();
+  }
 }
 
 CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum, bool ignore_counter)
@@ -176,7 +266,7 @@ CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum
 
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
-  init_crc_lookup_tables();
+  address_table.fill(-1);
 
   for (int i = 0; i < dbc->num_msgs; i++) {
     const Msg* msg = &dbc->msgs[i];
@@ -186,18 +276,32 @@ CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum
       .ignore_checksum = ignore_checksum,
       .ignore_counter = ignore_counter,
     };
+    state.msg = msg;
 
     for (int j = 0; j < msg->num_sigs; j++) {
-      const Signal *sig = &msg->sigs[j];
-      state.parse_sigs.push_back(*sig);
-      state.vals.push_back(0);
-      state.all_vals.push_back({});
+      state.add_signal(j);
     }
+    state.init_buffers();
 
-    message_states[state.address] = state;
+    add_message(state.address) = state;
   }
 }
 
+MessageState &CANParser::add_message(uint32_t address) {
+  if (MessageState *state = lookup(address)) {
+    return *state;
+  }
+
+  const int16_t i = message_states.size();
+  if (address < ADDRESS_TABLE_SIZE) {
+    address_table[address] = i;
+  } else {
+    const std::pair<uint32_t, int16_t> entry = {address, i};
+    extended_addresses.insert(std::upper_bound(extended_addresses.begin(), extended_addresses.end(), entry), entry);
+  }
+  return message_states.emplace_back();
+}
+
 #ifndef DYNAMIC_CAPNP
 void CANParser::update_string(const std::string &data, bool sendcan) {
   // format for board, make copy due to alignment issues.
@@ -231,17 +335,49 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Rea
       // DEBUG("skip %d: wrong bus\n", cmsg.getAddress());
       continue;
     }
-    auto state_it = message_states.find(cmsg.getAddress());
-    if (state_it == message_states.end()) {
-      // DEBUG("skip %d: not specified\n", cmsg.getAddress());
-      continue;
-    }
+    auto dat = cmsg.getDat();
+    UpdateCan(sec, cmsg.getAddress(), dat.begin(), dat.size());
+  }
+}
+
+CANParserGroup::CANParserGroup() : aligned_buf(kj::heapArray<capnp::word>(1024)) {}
 
-    if (cmsg.getDat().size() > 8) continue; //shouldn't ever happen
-    uint8_t dat[8] = {0};
-    memcpy(dat, cmsg.getDat().begin(), cmsg.getDat().size());
+void CANParserGroup::add(CANParser *parser) {
+  assert(parser->bus >= 0 && parser->bus < bus_parsers.size());
+  bus_parsers[parser->bus].push_back(parsers.size());
+  parsers.push_back(parser);
+}
 
-    state_it->second.parse(sec, dat);
+void CANParserGroup::update_string(const std::string &data, bool sendcan) {
+  // format for board, make copy due to alignment issues.
+  const size_t buf_size = (data.length() / sizeof(capnp::word)) + 1;
+  if (aligned_buf.size() < buf_size) {
+    aligned_buf = kj::heapArray<capnp::word>(buf_size);
+  }
+  memcpy(aligned_buf.begin(), data.data(), data.length());
+
+  capnp::FlatArrayMessageReader cmsg(aligned_buf.slice(0, buf_size));
+  cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+
+  const uint64_t sec = event.getLogMonoTime();
+  UpdateCans(sec, sendcan ? event.getSendcan() : event.getCan());
+
+  for (CANParser *parser : parsers) {
+    parser->last_sec = sec;
+    parser->UpdateValid(sec);
+  }
+}
+
+void CANParserGroup::UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Reader& cans) {
+  for (auto cmsg : cans) {
+    const auto &bus = bus_parsers[cmsg.getSrc()];
+    if (bus.empty()) continue;
+
+    const uint32_t address = cmsg.getAddress();
+    auto dat = cmsg.getDat();
+    for (int i : bus) {
+      parsers[i]->UpdateCan(sec, address, dat.begin(), dat.size());
+    }
   }
 }
 #endif
@@ -255,23 +391,13 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cms
     return;
   }
 
-  auto state_it = message_states.find(cmsg.get("address").as<uint32_t>());
-  if (state_it == message_states.end()) {
-    DEBUG("skip %d: not specified\n", cmsg.get("address").as<uint32_t>());
-    return;
-  }
-
   auto dat = cmsg.get("dat").as<capnp::Data>();
-  if (dat.size() > 8) return; //shouldn't ever happen
-  uint8_t data[8] = {0};
-  memcpy(data, dat.begin(), dat.size());
-  state_it->second.parse(sec, data);
+  UpdateCan(sec, cmsg.get("address").as<uint32_t>(), dat.begin(), dat.size());
 }
 
 void CANParser::UpdateValid(uint64_t sec) {
   can_valid = true;
-  for (const auto& kv : message_states) {
-    const auto& state = kv.second;
+  for (const auto& state : message_states) {
     if (state.check_threshold > 0 && (sec - state.seen) > state.check_threshold) {
       if (state.seen > 0) {
         DEBUG("0x%X TIMEOUT\n", state.address);
@@ -286,8 +412,7 @@ void CANParser::UpdateValid(uint64_t sec) {
 std::vector<SignalValue> CANParser::query_latest() {
   std::vector<SignalValue> ret;
 
-  for (auto& kv : message_states) {
-    auto& state = kv.second;
+  for (auto& state : message_states) {
     if (last_sec != 0 && state.seen != last_sec) continue;
 
     for (int i = 0; i < state.parse_sigs.size(); i++) {
@@ -296,11 +421,20 @@ std::vector<SignalValue> CANParser::query_latest() {
         .address = state.address,
         .name = sig.name,
         .value = state.vals[i],
-        .all_values = state.all_vals[i],
+        .all_values = state.get_all_vals(i),
       });
-      state.all_vals[i].clear();
     }
+    state.clear_all_vals();
   }
 
   return ret;
 }
+
+void CANParser::query_updated(std::vector<const MessageState *> &states) {
+  states.reserve(message_states.size());
+  states.assign(updated_states.begin(), updated_states.end());
+  for (MessageState *state : updated_states) {
+    state->updated = false;
+  }
+  updated_states.clear();
+}
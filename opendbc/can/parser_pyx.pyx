@@ -9,7 +9,8 @@ from libcpp cimport bool
 from libcpp.map cimport map
 
 from .common cimport CANParser as cpp_CANParser
-from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, SignalValue, DBC
+from .common cimport CANParserGroup as cpp_CANParserGroup
+from .common cimport SignalParseOptions, MessageParseOptions, MessageState, dbc_lookup, SignalValue, DBC
 
 import os
 import numbers
@@ -25,6 +26,8 @@ cdef class CANParser:
     map[string, uint32_t] msg_name_to_address
     map[uint32_t, string] address_to_msg_name
     vector[SignalValue] can_values
+    vector[const MessageState *] updated_states
+    dict sig_names
 
   cdef readonly:
     dict vl
@@ -101,7 +104,15 @@ cdef class CANParser:
       message_options_v.push_back(mpo)
 
     self.can = new cpp_CANParser(bus, dbc_name, message_options_v, signal_options_v)
-    self.update_vl()
+    self.sig_names = {}
+
+    # the initial values of all signals
+    new_vals = self.can.query_latest()
+    for cv in new_vals:
+      # Cast char * directly to unicode
+      cv_name = <unicode>cv.name
+      self.vl[cv.address][cv_name] = cv.value
+      self.vl_all[cv.address][cv_name].extend(cv.all_values)
 
   cdef unordered_set[uint32_t] update_vl(self):
     cdef unordered_set[uint32_t] updated_addrs
@@ -112,13 +123,26 @@ cdef class CANParser:
       self.can_invalid_cnt = 0
     self.can_valid = self.can_invalid_cnt < CAN_INVALID_CNT
 
-    new_vals = self.can.query_latest()
-    for cv in new_vals:
-      # Cast char * directly to unicode
-      cv_name = <unicode>cv.name
-      self.vl[cv.address][cv_name] = cv.value
-      self.vl_all[cv.address][cv_name].extend(cv.all_values)
-      updated_addrs.insert(cv.address)
+    # only the messages parsed since the last update, read in place
+    self.can.query_updated(self.updated_states)
+    cdef const MessageState *state
+    cdef int i, j
+    for state in self.updated_states:
+      names = self.sig_names.get(state.address)
+      if names is None:
+        # Cast char * directly to unicode
+        names = [<unicode>state.parse_sigs[i].name for i in range(state.parse_sigs.size())]
+        self.sig_names[state.address] = names
+
+      vl = self.vl[state.address]
+      vl_all = self.vl_all[state.address]
+      for i in range(state.parse_sigs.size()):
+        name = names[i]
+        vl[name] = state.vals[i]
+        all_vals = vl_all[name]
+        for j in range(state.all_vals_count):
+          all_vals.append(state.get_all_val(j, i))
+      updated_addrs.insert(state.address)
 
     return updated_addrs
 
@@ -140,6 +164,39 @@ cdef class CANParser:
     return updated_addrs
 
 
+cdef class CANParserGroup:
+  """Updates the parsers of several buses from the same events, reading each event once."""
+  cdef:
+    cpp_CANParserGroup *group
+
+  cdef readonly:
+    list parsers
+
+  def __init__(self, parsers):
+    self.parsers = list(parsers)
+    self.group = new cpp_CANParserGroup()
+    cdef CANParser p
+    for p in self.parsers:
+      self.group.add(p.can)
+
+  def __dealloc__(self):
+    del self.group
+
+  def update_strings(self, strings, sendcan=False):
+    """Like CANParser.update_strings of every parser, returns the updated addresses of each parser."""
+    cdef CANParser p
+    for p in self.parsers:
+      for v in p.vl_all.values():
+        v.clear()
+
+    updated_addrs = [set() for _ in self.parsers]
+    for s in strings:
+      self.group.update_string(s, sendcan)
+      for i, p in enumerate(self.parsers):
+        updated_addrs[i].update(p.update_vl())
+    return updated_addrs
+
+
 cdef class CANDefine():
   cdef:
     const DBC *dbc
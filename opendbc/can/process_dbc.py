@@ -8,6 +8,55 @@ import jinja2
 from collections import Counter
 from opendbc.can.dbc import dbc
 
+# checksum expressions of the generated decoders and encoders, by checksum type. the decoder has the payload
+# in dat_le and dat_be, the encoder in the big endian ret.
+CHECKSUM_CODE = {
+  "honda": ("honda_checksum({address}, dat_be, {size})", "honda_checksum({address}, ret, {size})"),
+  "toyota": ("toyota_checksum({address}, dat_be, {size})", "toyota_checksum({address}, ret, {size})"),
+  "volkswagen": ("volkswagen_crc({address}, dat_le, {size})", "volkswagen_crc({address}, __builtin_bswap64(ret), {size})"),
+  "subaru": ("subaru_checksum({address}, dat_be, {size})", "subaru_checksum({address}, ret, {size})"),
+  "chrysler": ("chrysler_checksum({address}, dat_le, {size})", "chrysler_checksum({address}, __builtin_bswap64(ret), {size})"),
+  "pedal": ("pedal_checksum(dat_be, {size})", None),
+}
+
+
+def reverse_bytes(x):
+  return int.from_bytes(x.to_bytes(8, "little"), "big")
+
+
+def codegen_msg(address, size, sigs, checksum_type):
+  """Constants of the generated decoder and encoder of a message, None if a signal isn't within the first 8 bytes."""
+  if size > 8:
+    return None
+
+  ret = {"sigs": [], "checksum": None}
+  for i, sig in enumerate(sigs):
+    if sig.is_little_endian:
+      shift = sig.start_bit
+    else:
+      b1 = (sig.start_bit // 8) * 8 + (-sig.start_bit - 1) % 8
+      shift = 64 - (b1 + sig.size)
+    if shift < 0 or shift + sig.size > 64:
+      return None
+
+    mask = (1 << sig.size) - 1
+    # the bits of the signal in the big endian payload
+    field = mask << shift if not sig.is_little_endian else reverse_bytes(mask << shift)
+    ret["sigs"].append({"index": i, "src": "dat_le" if sig.is_little_endian else "dat_be", "shift": shift,
+                        "mask": "0x%XULL" % mask, "field": "0x%XULL" % field, "sign_shift": 64 - sig.size})
+
+    if address in (0x200, 0x201) and sig.name == "CHECKSUM_PEDAL":
+      typ = "pedal"
+    elif checksum_type is not None and sig.name == "CHECKSUM":
+      typ = checksum_type
+    else:
+      continue
+    parse_code, pack_code = CHECKSUM_CODE[typ]
+    ret["checksum"] = {"index": i, "parse": parse_code.format(address="0x%X" % address, size=size),
+                       "pack": pack_code and pack_code.format(address="0x%X" % address, size=size)}
+  return ret
+
+
 def process(in_fn, out_fn):
   dbc_name = os.path.split(out_fn)[-1].replace('.cc', '')
   # print("processing %s: %s -> %s" % (dbc_name, in_fn, out_fn))
@@ -98,13 +147,28 @@ def process(in_fn, out_fn):
         if sig.name == "CHECKSUM_PEDAL" and sig.size != 8:
           sys.exit("%s: PEDAL CHECKSUM is not 8 bits long" % dbc_msg_name)
 
+  # CAN-FD messages are up to 64 bytes, the checksums are only defined over classic 8 byte messages
+  for address, msg_name, msg_size, sigs in msgs:
+    dbc_msg_name = dbc_name + " " + msg_name
+    if msg_size > 64:
+      sys.exit("%s: message is longer than 64 bytes" % dbc_msg_name)
+    if msg_size > 8 and checksum_type is not None and any(sig.name == "CHECKSUM" for sig in sigs):
+      sys.exit("%s: CHECKSUM is not supported in messages longer than 8 bytes" % dbc_msg_name)
+
   # Fail on duplicate message names
   c = Counter([msg_name for address, msg_name, msg_size, sigs in msgs])
   for name, count in c.items():
     if count > 1:
       sys.exit("%s: Duplicate message name in DBC file %s" % (dbc_name, name))
 
-  parser_code = template.render(dbc=can_dbc, checksum_type=checksum_type, msgs=msgs, def_vals=def_vals, len=len)
+  # big endian bit order: the msb of a signal is its start bit, the following bits go down within a byte,
+  # then on to the next byte
+  be_bits = [j + i * 8 for i in range(64) for j in range(7, -1, -1)]
+
+  codegen = {address: codegen_msg(address, msg_size, sigs, checksum_type) for address, _, msg_size, sigs in msgs}
+
+  parser_code = template.render(dbc=can_dbc, checksum_type=checksum_type, msgs=msgs, def_vals=def_vals, be_bits=be_bits,
+                                codegen=codegen, len=len)
 
   with open(out_fn, "a+") as out_f:
     out_f.seek(0)
@@ -0,0 +1,384 @@
+#include <bzlib.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "opendbc/can/common.h"
+
+// Benchmarks CANParser and CANPacker with the CAN traffic of a route, e.g.
+//   ./can_bench rlog.bz2 gm_global_a_powertrain_generated:0 --baseline can_bench_baseline.txt
+// The can events are parsed with all signals of the DBC, checksums and counters included, like carstate.
+// The messages are then packed again from the parsed values, from the sendcan events if the bus has any.
+// With --baseline, the results are compared to the file and written to it with --save.
+
+// a result whose baseline is exceeded by more than this is a regression
+const double REGRESSION_THRESHOLD = 0.1;
+
+// counts the heap allocations, to check that parsing doesn't allocate once warmed up
+static uint64_t allocations = 0;
+// keeps the benchmarked checksums from being optimized out
+static volatile unsigned int checksum_sink = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = malloc(size)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t size) noexcept { free(p); }
+
+static uint64_t nanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string read_file(const std::string &fn) {
+  std::ifstream f(fn, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+static std::string decompress_bz2(const std::string &in) {
+  bz_stream strm = {};
+  if (in.empty() || BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) return {};
+
+  std::string out(in.size() * 5, '\0');
+  strm.next_in = (char *)in.data();
+  strm.avail_in = in.size();
+  int ret = BZ_OK;
+  while (ret == BZ_OK) {
+    if (strm.total_out_lo32 + ((uint64_t)strm.total_out_hi32 << 32) == out.size()) {
+      out.resize(out.size() * 2);
+    }
+    const uint64_t total_out = strm.total_out_lo32 + ((uint64_t)strm.total_out_hi32 << 32);
+    strm.next_out = out.data() + total_out;
+    strm.avail_out = out.size() - total_out;
+    ret = BZ2_bzDecompress(&strm);
+  }
+  out.resize(strm.total_out_lo32 + ((uint64_t)strm.total_out_hi32 << 32));
+  BZ2_bzDecompressEnd(&strm);
+  return ret == BZ_STREAM_END ? out : std::string();
+}
+
+struct Log {
+  kj::Array<capnp::word> words;
+  std::vector<std::unique_ptr<capnp::FlatArrayMessageReader>> readers;
+  std::vector<cereal::Event::Reader> can, sendcan;
+};
+
+static bool load_log(const std::string &fn, Log &log) {
+  std::string dat = read_file(fn);
+  if (fn.size() > 4 && fn.substr(fn.size() - 4) == ".bz2") {
+    dat = decompress_bz2(dat);
+  }
+  if (dat.empty()) return false;
+
+  log.words = kj::heapArray<capnp::word>(dat.size() / sizeof(capnp::word));
+  memcpy(log.words.begin(), dat.data(), log.words.size() * sizeof(capnp::word));
+  kj::ArrayPtr<const capnp::word> words = log.words;
+  try {
+    while (words.size() > 0) {
+      auto reader = std::make_unique<capnp::FlatArrayMessageReader>(words);
+      words = kj::arrayPtr(reader->getEnd(), words.end());
+      cereal::Event::Reader event = reader->getRoot<cereal::Event>();
+      if (event.which() == cereal::Event::CAN) {
+        log.can.push_back(event);
+      } else if (event.which() == cereal::Event::SENDCAN) {
+        log.sendcan.push_back(event);
+      } else {
+        continue;
+      }
+      log.readers.push_back(std::move(reader));
+    }
+  } catch (const kj::Exception &) {
+    // the log of a segment can be cut off
+  }
+  return !log.can.empty();
+}
+
+typedef std::map<std::string, double> Results;
+
+static void report(Results &results, const std::string &name, const std::string &key, double value, const char *unit) {
+  results[name + " " + key] = value;
+  printf("  %-28s %12.2f %s\n", key.c_str(), value, unit);
+}
+
+// a message to pack and the values it was parsed with
+struct PackInput {
+  const PackHandle *handle;
+  std::vector<double> values;
+  int counter;
+};
+
+static std::vector<PackInput> pack_inputs(const std::string &dbc_name, int bus, const std::vector<cereal::Event::Reader> &events,
+                                          bool sendcan, std::map<uint32_t, PackHandle> &handles, CANPacker &packer) {
+  std::vector<PackInput> ret;
+  CANParser parser(bus, dbc_name, true, true);
+  std::vector<const MessageState *> updated;
+  for (const auto &event : events) {
+    parser.UpdateCans(event.getLogMonoTime(), sendcan ? event.getSendcan() : event.getCan());
+    parser.query_updated(updated);
+    for (const MessageState *state : updated) {
+      auto it = handles.find(state->address);
+      if (it == handles.end()) {
+        std::vector<std::string> names;
+        for (const Signal &sig : state->parse_sigs) {
+          if (strcmp(sig.name, "COUNTER") != 0 && strcmp(sig.name, "CHECKSUM") != 0) names.push_back(sig.name);
+        }
+        it = handles.emplace(state->address, packer.handle(state->address, names)).first;
+      }
+
+      PackInput &input = ret.emplace_back(PackInput{.handle = &it->second, .counter = -1});
+      for (int i = 0; i < state->parse_sigs.size(); i++) {
+        if (strcmp(state->parse_sigs[i].name, "COUNTER") == 0) {
+          input.counter = state->vals[i];
+        } else if (strcmp(state->parse_sigs[i].name, "CHECKSUM") != 0) {
+          input.values.push_back(state->vals[i]);
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+static void bench_dbc(const Log &log, const std::string &dbc_name, int bus, int passes, Results &results) {
+  const std::string name = dbc_name + ":" + std::to_string(bus);
+  printf("%s\n", name.c_str());
+
+  // parse: frames of the bus, the parsed frames and their signals
+  uint64_t bus_frames = 0, parsed_frames = 0, parsed_signals = 0;
+  for (const auto &event : log.can) {
+    for (const auto &c : event.getCan()) {
+      bus_frames += c.getSrc() == bus;
+    }
+  }
+
+  // the first pass warms up the parser, its allocations and time aren't counted
+  uint64_t best_ns = UINT64_MAX, pass_allocations = 0;
+  std::vector<const MessageState *> updated;
+  CANParser parser(bus, dbc_name, false, false);
+  for (int pass = 0; pass <= passes; ++pass) {
+    const uint64_t start_allocations = allocations;
+    uint64_t ns = 0, frames = 0, signals = 0;
+    for (const auto &event : log.can) {
+      const uint64_t start = nanos();
+      parser.UpdateCans(event.getLogMonoTime(), event.getCan());
+      parser.UpdateValid(event.getLogMonoTime());
+      parser.query_updated(updated);
+      ns += nanos() - start;
+
+      for (const MessageState *state : updated) {
+        frames += state->all_vals_count;
+        signals += state->all_vals_count * state->parse_sigs.size();
+      }
+    }
+    if (pass > 0) {
+      best_ns = std::min(best_ns, ns);
+      pass_allocations = allocations - start_allocations;
+    }
+    parsed_frames = frames;
+    parsed_signals = signals;
+  }
+  if (parsed_frames == 0) {
+    printf("  no frames of the DBC on bus %d\n", bus);
+    return;
+  }
+  printf("  %lu frames on the bus, %lu parsed with %lu signals\n", bus_frames, parsed_frames, parsed_signals);
+  report(results, name, "parse ns/frame", (double)best_ns / bus_frames, "ns");
+  report(results, name, "parse ns/signal", (double)best_ns / parsed_signals, "ns");
+  report(results, name, "parse allocations/cycle", (double)pass_allocations / log.can.size(), "");
+
+  // pack: what controlsd sent on the bus if there is any, otherwise what the car sent
+  CANPacker packer(dbc_name);
+  std::map<uint32_t, PackHandle> handles;
+  std::vector<PackInput> inputs = pack_inputs(dbc_name, bus, log.sendcan, true, handles, packer);
+  const bool sendcan = !inputs.empty();
+  if (!sendcan) {
+    inputs = pack_inputs(dbc_name, bus, log.can, false, handles, packer);
+  }
+
+  best_ns = UINT64_MAX;
+  for (int pass = 0; pass <= passes; ++pass) {
+    const uint64_t start_allocations = allocations;
+    const uint64_t start = nanos();
+    uint8_t dat[CANFD_MAX_SIZE];
+    for (const PackInput &input : inputs) {
+      packer.pack(*input.handle, input.values.data(), input.counter, dat);
+    }
+    const uint64_t ns = nanos() - start;
+    if (pass > 0) {
+      best_ns = std::min(best_ns, ns);
+      pass_allocations = allocations - start_allocations;
+    }
+  }
+  printf("  %zu %s messages packed\n", inputs.size(), sendcan ? "sendcan" : "can");
+  report(results, name, "pack ns/message", (double)best_ns / inputs.size(), "ns");
+  report(results, name, "pack allocations/message", (double)pass_allocations / inputs.size(), "");
+}
+
+static void bench_checksums(const Log &log, int passes, Results &results) {
+  // the classic CAN payloads of the route, in both byte orders
+  struct Payload { uint32_t address; uint64_t le, be; int size; };
+  std::vector<Payload> payloads;
+  for (const auto &event : log.can) {
+    for (const auto &c : event.getCan()) {
+      auto dat = c.getDat();
+      if (dat.size() == 0 || dat.size() > 8) continue;
+      uint8_t d[8] = {0};
+      memcpy(d, dat.begin(), dat.size());
+      payloads.push_back({c.getAddress(), read_u64_le(d), read_u64_be(d), (int)dat.size()});
+    }
+  }
+  if (payloads.empty()) return;
+
+  // the same payloads as arrays, for checksum_batch
+  std::vector<uint32_t> addresses;
+  std::vector<uint64_t> le, be;
+  std::vector<int> sizes;
+  for (const Payload &p : payloads) {
+    addresses.push_back(p.address);
+    le.push_back(p.le);
+    be.push_back(p.be);
+    sizes.push_back(p.size);
+  }
+  std::vector<unsigned int> out(payloads.size());
+
+  struct Algorithm {
+    const char *name;
+    SignalType type;
+    bool little_endian;
+    std::function<unsigned int(const Payload &)> checksum;
+  };
+  const Algorithm algorithms[] = {
+    {"honda", HONDA_CHECKSUM, false, [](const Payload &p) { return honda_checksum(p.address, p.be, p.size); }},
+    {"toyota", TOYOTA_CHECKSUM, false, [](const Payload &p) { return toyota_checksum(p.address, p.be, p.size); }},
+    {"subaru", SUBARU_CHECKSUM, false, [](const Payload &p) { return subaru_checksum(p.address, p.be, p.size); }},
+    {"chrysler", CHRYSLER_CHECKSUM, true, [](const Payload &p) { return chrysler_checksum(p.address, p.le, p.size); }},
+    {"volkswagen", VOLKSWAGEN_CHECKSUM, true, [](const Payload &p) { return volkswagen_crc(p.address, p.le, p.size); }},
+    {"pedal", PEDAL_CHECKSUM, false, [](const Payload &p) { return pedal_checksum(p.be, p.size); }},
+  };
+  printf("checksums of %zu payloads\n", payloads.size());
+  for (const auto &[name, type, little_endian, checksum] : algorithms) {
+    uint64_t best_ns = UINT64_MAX;
+    unsigned int sum = 0;
+    for (int pass = 0; pass <= passes; ++pass) {
+      const uint64_t start = nanos();
+      for (const Payload &p : payloads) {
+        sum += checksum(p);
+      }
+      if (pass > 0) best_ns = std::min(best_ns, nanos() - start);
+    }
+    report(results, "checksum", std::string(name) + " ns/frame", (double)best_ns / payloads.size(), "ns");
+
+    best_ns = UINT64_MAX;
+    for (int pass = 0; pass <= passes; ++pass) {
+      const uint64_t start = nanos();
+      checksum_batch(type, addresses.data(), little_endian ? le.data() : be.data(), sizes.data(), out.size(), out.data());
+      if (pass > 0) best_ns = std::min(best_ns, nanos() - start);
+      sum += out[pass % out.size()];
+    }
+    checksum_sink = sum;
+    report(results, "checksum", std::string(name) + " batch ns/frame", (double)best_ns / payloads.size(), "ns");
+  }
+}
+
+static Results load_results(const std::string &fn) {
+  Results ret;
+  std::ifstream f(fn);
+  std::string line;
+  while (std::getline(f, line)) {
+    // "<name> <key>: <value>", keys contain spaces
+    const size_t sep = line.rfind(": ");
+    if (sep != std::string::npos) {
+      ret[line.substr(0, sep)] = atof(line.c_str() + sep + 2);
+    }
+  }
+  return ret;
+}
+
+static int compare_results(const Results &results, const Results &baseline) {
+  int regressions = 0;
+  printf("compared to the baseline:\n");
+  for (const auto &[key, value] : results) {
+    auto it = baseline.find(key);
+    if (it == baseline.end()) continue;
+    const double change = it->second > 0 ? value / it->second - 1 : (value > 0 ? INFINITY : 0);
+    const bool regression = change > REGRESSION_THRESHOLD && value - it->second > 0.5;
+    printf("  %-60s %12.2f -> %12.2f (%+.1f%%)%s\n", key.c_str(), it->second, value, change * 100, regression ? " REGRESSION" : "");
+    regressions += regression;
+  }
+  return regressions;
+}
+
+int main(int argc, char *argv[]) {
+  std::string log_fn, baseline_fn;
+  std::vector<std::pair<std::string, int>> dbcs;
+  bool save = false;
+  int passes = 5;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--baseline" && i + 1 < argc) {
+      baseline_fn = argv[++i];
+    } else if (arg == "--save") {
+      save = true;
+    } else if (arg == "--passes" && i + 1 < argc) {
+      passes = std::max(1, atoi(argv[++i]));
+    } else if (log_fn.empty()) {
+      log_fn = arg;
+    } else {
+      // <dbc>[:<bus>]
+      const size_t sep = arg.find(':');
+      dbcs.push_back({arg.substr(0, sep), sep == std::string::npos ? 0 : atoi(arg.c_str() + sep + 1)});
+    }
+  }
+  if (log_fn.empty()) {
+    printf("usage: %s <rlog> [<dbc>[:<bus>] ...] [--passes n] [--baseline file [--save]]\n", argv[0]);
+    printf("without DBCs, all DBCs are benchmarked on bus 0\n");
+    return 1;
+  }
+
+  Log log;
+  if (!load_log(log_fn, log)) {
+    printf("no can events in %s\n", log_fn.c_str());
+    return 1;
+  }
+  printf("%zu can and %zu sendcan events\n", log.can.size(), log.sendcan.size());
+
+  if (dbcs.empty()) {
+    for (const DBC *dbc : get_dbcs()) {
+      dbcs.push_back({dbc->name, 0});
+    }
+  }
+
+  Results results;
+  for (const auto &[dbc_name, bus] : dbcs) {
+    if (!dbc_lookup(dbc_name)) {
+      printf("unknown DBC %s\n", dbc_name.c_str());
+      return 1;
+    }
+    bench_dbc(log, dbc_name, bus, passes, results);
+  }
+  bench_checksums(log, passes, results);
+
+  int regressions = 0;
+  if (!baseline_fn.empty()) {
+    if (save) {
+      std::ofstream f(baseline_fn);
+      for (const auto &[key, value] : results) {
+        f << key << ": " << value << "\n";
+      }
+      printf("saved the baseline to %s\n", baseline_fn.c_str());
+    } else {
+      regressions = compare_results(results, load_results(baseline_fn));
+    }
+  }
+  return regressions > 0 ? 1 : 0;
+}
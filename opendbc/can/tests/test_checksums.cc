@@ -0,0 +1,179 @@
+// Cross-checks the checksum kernels against straightforward reference implementations:
+// every two byte payload, every single byte at every position of every length and
+// random payloads, for a range of standard and extended addresses.
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "common.h"
+
+static unsigned int ref_honda_checksum(unsigned int address, uint64_t d, int l) {
+  d >>= ((8-l)*8); // remove padding
+  d >>= 4; // remove checksum
+
+  int s = 0;
+  bool extended = address > 0x7FF; // extended can
+  while (address) { s += (address & 0xF); address >>= 4; }
+  while (d) { s += (d & 0xF); d >>= 4; }
+  s = 8-s;
+  if (extended) s += 3;
+  s &= 0xF;
+
+  return s;
+}
+
+static unsigned int ref_toyota_checksum(unsigned int address, uint64_t d, int l) {
+  d >>= ((8-l)*8); // remove padding
+  d >>= 8; // remove checksum
+
+  unsigned int s = l;
+  while (address) { s += address & 0xFF; address >>= 8; }
+  while (d) { s += d & 0xFF; d >>= 8; }
+
+  return s & 0xFF;
+}
+
+static unsigned int ref_subaru_checksum(unsigned int address, uint64_t d, int l) {
+  d >>= ((8-l)*8); // remove padding
+
+  unsigned int s = 0;
+  while (address) { s += address & 0xFF; address >>= 8; }
+  l -= 1; // checksum is first byte
+  while (l) { s += d & 0xFF; d >>= 8; l -= 1; }
+
+  return s & 0xFF;
+}
+
+// bit by bit, from http://illmatics.com/Remote%20Car%20Hacking.pdf
+static unsigned int ref_chrysler_checksum(unsigned int address, uint64_t d, int l) {
+  uint8_t checksum = 0xFF;
+  for (int j = 0; j < (l - 1); j++) {
+    uint8_t shift = 0x80;
+    uint8_t curr = (d >> 8*j) & 0xFF;
+    for (int i=0; i<8; i++) {
+      uint8_t bit_sum = curr & shift;
+      uint8_t temp_chk = checksum & 0x80U;
+      if (bit_sum != 0U) {
+        bit_sum = 0x1C;
+        if (temp_chk != 0U) {
+          bit_sum = 1;
+        }
+        checksum = checksum << 1;
+        temp_chk = checksum | 1U;
+        bit_sum ^= temp_chk;
+      } else {
+        if (temp_chk != 0U) {
+          bit_sum = 0x1D;
+        }
+        checksum = checksum << 1;
+        bit_sum ^= checksum;
+      }
+      checksum = bit_sum;
+      shift = shift >> 1;
+    }
+  }
+  return ~checksum & 0xFF;
+}
+
+static unsigned int ref_pedal_checksum(uint64_t d, int l) {
+  uint8_t crc = 0xFF;
+  uint8_t poly = 0xD5; // standard crc8
+
+  d >>= ((8-l)*8); // remove padding
+  d >>= 8; // remove checksum
+
+  int i, j;
+  for (i = 0; i < l - 1; i++) {
+    crc ^= (d >> (i*8)) & 0xFF;
+    for (j = 0; j < 8; j++) {
+      if ((crc & 0x80) != 0) {
+        crc = (uint8_t)((crc << 1) ^ poly);
+      }
+      else {
+        crc <<= 1;
+      }
+    }
+  }
+  return crc;
+}
+
+struct Algorithm {
+  const char *name;
+  SignalType type;
+  unsigned int (*checksum)(unsigned int address, uint64_t d, int l);
+  unsigned int (*reference)(unsigned int address, uint64_t d, int l);
+};
+
+static const Algorithm algorithms[] = {
+  {"honda", HONDA_CHECKSUM, honda_checksum, ref_honda_checksum},
+  {"toyota", TOYOTA_CHECKSUM, toyota_checksum, ref_toyota_checksum},
+  {"subaru", SUBARU_CHECKSUM, subaru_checksum, ref_subaru_checksum},
+  {"chrysler", CHRYSLER_CHECKSUM, chrysler_checksum, ref_chrysler_checksum},
+  {"pedal", PEDAL_CHECKSUM, [](unsigned int, uint64_t d, int l) { return pedal_checksum(d, l); },
+                            [](unsigned int, uint64_t d, int l) { return ref_pedal_checksum(d, l); }},
+};
+
+struct Frames {
+  std::vector<uint32_t> address;
+  std::vector<uint64_t> d;
+  std::vector<int> l;
+
+  void add(uint32_t a, uint64_t dat, int size) {
+    address.push_back(a);
+    d.push_back(dat);
+    l.push_back(size);
+  }
+};
+
+int main() {
+  std::vector<uint32_t> addresses = {0x0, 0x1, 0x7FF, 0x800, 0x1FFFFFFF, 0x18DAF110};
+  for (uint32_t a = 0; a < 0x800; a += 0x3F) addresses.push_back(a);
+
+  Frames frames;
+  // every two byte payload, which reaches every crc state with every input byte
+  for (uint32_t a : {0x0u, 0x2E4u, 0x18DAF110u}) {
+    for (uint64_t d = 0; d < 0x10000; d++) {
+      frames.add(a, d << 8, 3);
+      frames.add(a, d, 8);
+    }
+  }
+  // every single byte at every position, for every length
+  for (uint32_t a : addresses) {
+    for (int l = 1; l <= 8; l++) {
+      for (int pos = 0; pos < 8; pos++) {
+        for (uint64_t b = 0; b < 0x100; b++) {
+          frames.add(a, b << (pos * 8), l);
+        }
+      }
+    }
+  }
+  // random payloads
+  std::mt19937_64 rng(0);
+  for (int i = 0; i < 1000000; i++) {
+    const uint32_t a = (i & 1) ? (rng() & 0x1FFFFFFF) : (rng() & 0x7FF);
+    frames.add(a, rng(), 1 + rng() % 8);
+  }
+
+  const size_t n = frames.d.size();
+  std::vector<unsigned int> batch(n);
+  int failures = 0;
+  for (const Algorithm &alg : algorithms) {
+    checksum_batch(alg.type, frames.address.data(), frames.d.data(), frames.l.data(), n, batch.data());
+
+    int mismatches = 0;
+    for (size_t i = 0; i < n; i++) {
+      const unsigned int expected = alg.reference(frames.address[i], frames.d[i], frames.l[i]);
+      const unsigned int single = alg.checksum(frames.address[i], frames.d[i], frames.l[i]);
+      if (single != expected || batch[i] != expected) {
+        if (mismatches < 5) {
+          printf("%s: address 0x%X, d 0x%016lX, l %d: expected 0x%X, got 0x%X, batch 0x%X\n", alg.name,
+                 frames.address[i], frames.d[i], frames.l[i], expected, single, batch[i]);
+        }
+        mismatches++;
+      }
+    }
+    printf("%-10s %zu frames, %d mismatches\n", alg.name, n, mismatches);
+    failures += mismatches;
+  }
+  return failures == 0 ? 0 : 1;
+}
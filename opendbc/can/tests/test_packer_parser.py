@@ -2,7 +2,8 @@
 import unittest
 
 import cereal.messaging as messaging
-from opendbc.can.parser import CANParser
+from cereal import log
+from opendbc.can.parser import CANParser, CANParserGroup
 from opendbc.can.packer import CANPacker
 
 # Python implementation so we don't have to depend on boardd
@@ -96,6 +97,111 @@ class TestCanParserPacker(unittest.TestCase):
 
         idx += 1
 
+  def test_updated(self):
+    dbc_file = "honda_civic_touring_2016_can_generated"
+
+    signals = [
+      ("STEER_TORQUE", "STEERING_CONTROL", 0),
+      ("STEER_TORQUE_REQUEST", "STEERING_CONTROL", 0),
+    ]
+    checks = [("STEERING_CONTROL", 50)]
+
+    parser = CANParser(dbc_file, signals, checks, 0)
+    packer = CANPacker(dbc_file)
+    self.assertAlmostEqual(parser.vl["STEERING_CONTROL"]["STEER_TORQUE"], 0)
+
+    idx = 0
+    for n in range(1, 40):
+      msgs = [packer.make_can_msg("STEERING_CONTROL", 0, {"STEER_TORQUE": idx + i}, idx + i) for i in range(n)]
+      idx += n
+      updated = parser.update_strings([can_list_to_can_capnp(msgs), can_list_to_can_capnp([])])
+      self.assertEqual(updated, {0xe4})
+      self.assertAlmostEqual(parser.vl["STEERING_CONTROL"]["STEER_TORQUE"], idx - 1)
+      self.assertEqual(parser.vl_all["STEERING_CONTROL"]["STEER_TORQUE"], list(range(idx - min(n, 32), idx)))
+
+      # values stay, all values are cleared
+      self.assertEqual(parser.update_strings([can_list_to_can_capnp([])]), set())
+      self.assertAlmostEqual(parser.vl["STEERING_CONTROL"]["STEER_TORQUE"], idx - 1)
+      self.assertEqual(parser.vl_all["STEERING_CONTROL"]["STEER_TORQUE"], [])
+
+  def test_parser_group(self):
+    dbc_file = "honda_civic_touring_2016_can_generated"
+
+    signals = [
+      ("STEER_TORQUE", "STEERING_CONTROL", 0),
+      ("STEER_TORQUE_REQUEST", "STEERING_CONTROL", 0),
+    ]
+    checks = [("STEERING_CONTROL", 50)]
+
+    # the same parsers updated on their own and as a group
+    buses = [0, 2, 2]
+    parsers = [CANParser(dbc_file, signals, checks, bus) for bus in buses]
+    group_parsers = [CANParser(dbc_file, signals, checks, bus) for bus in buses]
+    group = CANParserGroup(group_parsers)
+    packer = CANPacker(dbc_file)
+
+    for idx, steer in enumerate(range(-256, 255)):
+      can_strings = []
+      for i in range(3):
+        # two frames per event on bus 0, none on bus 1
+        msgs = [packer.make_can_msg("STEERING_CONTROL", 0, {"STEER_TORQUE": steer, "STEER_TORQUE_REQUEST": 1}, 2 * (3 * idx + i)),
+                packer.make_can_msg("STEERING_CONTROL", 0, {"STEER_TORQUE": steer + 1}, 2 * (3 * idx + i) + 1),
+                packer.make_can_msg("STEERING_CONTROL", 1, {"STEER_TORQUE": 0}, idx),
+                packer.make_can_msg("STEERING_CONTROL", 2, {"STEER_TORQUE": -steer}, 3 * idx + i)]
+        can_strings.append(can_list_to_can_capnp(msgs))
+
+      updated = [p.update_strings(can_strings) for p in parsers]
+      self.assertEqual(group.update_strings(can_strings), updated)
+      for p, gp in zip(parsers, group_parsers):
+        self.assertEqual(p.vl["STEERING_CONTROL"], gp.vl["STEERING_CONTROL"])
+        self.assertEqual(p.vl_all["STEERING_CONTROL"], gp.vl_all["STEERING_CONTROL"])
+        self.assertEqual(p.can_valid, gp.can_valid)
+      self.assertAlmostEqual(group_parsers[0].vl["STEERING_CONTROL"]["STEER_TORQUE"], steer + 1)
+      self.assertAlmostEqual(group_parsers[1].vl["STEERING_CONTROL"]["STEER_TORQUE"], -steer)
+
+  def test_packer_handles(self):
+    dbc_file = "honda_civic_touring_2016_can_generated"
+
+    signals = [
+      ("STEER_TORQUE", "STEERING_CONTROL", 0),
+      ("STEER_TORQUE_REQUEST", "STEERING_CONTROL", 0),
+    ]
+    checks = [("STEERING_CONTROL", 50)]
+
+    parser = CANParser(dbc_file, signals, checks, 0)
+    packer = CANPacker(dbc_file)
+    handle = packer.make_handle("STEERING_CONTROL", ["STEER_TORQUE", "STEER_TORQUE_REQUEST"])
+
+    idx = 0
+    for steer in range(-256, 255):
+      for active in [1, 0]:
+        values = {
+          "STEER_TORQUE": steer,
+          "STEER_TORQUE_REQUEST": active,
+        }
+        msg = packer.make_can_msg("STEERING_CONTROL", 0, values, idx)
+        self.assertEqual(packer.make_can_msg_handle(handle, 0, [steer, active], idx), msg)
+
+        # sendcan of the same message on two buses
+        sendcan = packer.make_sendcan([(handle, 0, [steer, active], idx), (handle, 1, [0, 0], idx)])
+        msgs = [msg, packer.make_can_msg("STEERING_CONTROL", 1, {"STEER_TORQUE": 0, "STEER_TORQUE_REQUEST": 0}, idx)]
+        evt = log.Event.from_bytes(sendcan)
+        self.assertEqual([[c.address, c.busTime, c.dat, c.src] for c in evt.sendcan], msgs)
+        parser.update_string(sendcan, sendcan=True)
+
+        self.assertAlmostEqual(parser.vl["STEERING_CONTROL"]["STEER_TORQUE"], steer)
+        self.assertAlmostEqual(parser.vl["STEERING_CONTROL"]["STEER_TORQUE_REQUEST"], active)
+        self.assertAlmostEqual(parser.vl["STEERING_CONTROL"]["COUNTER"], idx % 4)
+
+        idx += 1
+
+    # a bad handle is an error, not a read past the handles
+    for bad in [handle + 1, -1]:
+      with self.assertRaises(IndexError):
+        packer.make_can_msg_handle(bad, 0, [0, 0])
+      with self.assertRaises(IndexError):
+        packer.make_sendcan([(bad, 0, [0, 0], 0)])
+
 
 if __name__ == "__main__":
   unittest.main()
@@ -77,6 +77,55 @@ void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]) {
   }
 }
 
+// buses are 3 bits and addresses 29 bits, so the key sorts by bus, then address
+uint32_t safety_lookup_key(int bus, int addr) {
+  return ((uint32_t)bus << 29U) | ((uint32_t)addr & 0x1FFFFFFFU);
+}
+
+// sorted by key then index, so the entries of a key are in list order
+void safety_lookup_add(safety_lookup *lookup, uint32_t key, int index) {
+  if (lookup->len < SAFETY_LOOKUP_SIZE) {
+    int i = lookup->len;
+    while ((i > 0) && ((lookup->table[i - 1].key > key) ||
+                       ((lookup->table[i - 1].key == key) && (lookup->table[i - 1].index > index)))) {
+      lookup->table[i] = lookup->table[i - 1];
+      i--;
+    }
+    lookup->table[i].key = key;
+    lookup->table[i].index = index;
+    lookup->len++;
+  } else {
+    lookup->valid = false;
+  }
+}
+
+// position of the first entry with key, or lookup->len if there's none
+int safety_lookup_find(const safety_lookup *lookup, uint32_t key) {
+  int lo = 0;
+  int hi = lookup->len;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (lookup->table[mid].key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+void build_rx_lookup(const addr_checks *rx_checks) {
+  rx_lookup.list = rx_checks->check;
+  rx_lookup.list_len = rx_checks->len;
+  rx_lookup.valid = true;
+  rx_lookup.len = 0;
+  for (int i = 0; i < rx_checks->len; i++) {
+    for (uint8_t j = 0U; rx_checks->check[i].msg[j].addr != 0; j++) {
+      safety_lookup_add(&rx_lookup, safety_lookup_key(rx_checks->check[i].msg[j].bus, rx_checks->check[i].msg[j].addr), i);
+    }
+  }
+}
+
 bool msg_allowed(CANPacket_t *to_send, const CanMsg msg_list[], int len) {
   int addr = GET_ADDR(to_send);
   int bus = GET_BUS(to_send);
@@ -98,30 +147,50 @@ uint32_t get_ts_elapsed(uint32_t ts, uint32_t ts_last) {
   return ts - ts_last;
 }
 
+bool addr_check_matches(AddrCheckStruct addr_list[], int i, int bus, int addr, int length) {
+  // if multiple msgs are allowed, determine which one is present on the bus
+  if (!addr_list[i].msg_seen) {
+    for (uint8_t j = 0U; addr_list[i].msg[j].addr != 0; j++) {
+      if ((addr == addr_list[i].msg[j].addr) && (bus == addr_list[i].msg[j].bus) &&
+            (length == addr_list[i].msg[j].len)) {
+        addr_list[i].index = j;
+        addr_list[i].msg_seen = true;
+        break;
+      }
+    }
+  }
+
+  int idx = addr_list[i].index;
+  return (addr == addr_list[i].msg[idx].addr) && (bus == addr_list[i].msg[idx].bus) &&
+         (length == addr_list[i].msg[idx].len);
+}
+
 int get_addr_check_index(CANPacket_t *to_push, AddrCheckStruct addr_list[], const int len) {
   int bus = GET_BUS(to_push);
   int addr = GET_ADDR(to_push);
   int length = GET_LEN(to_push);
 
   int index = -1;
-  for (int i = 0; i < len; i++) {
-    // if multiple msgs are allowed, determine which one is present on the bus
-    if (!addr_list[i].msg_seen) {
-      for (uint8_t j = 0U; addr_list[i].msg[j].addr != 0; j++) {
-        if ((addr == addr_list[i].msg[j].addr) && (bus == addr_list[i].msg[j].bus) &&
-              (length == addr_list[i].msg[j].len)) {
-          addr_list[i].index = j;
-          addr_list[i].msg_seen = true;
+  if (rx_lookup.valid && (addr_list == rx_lookup.list) && (len == rx_lookup.list_len)) {
+    // only the checks with a msg of this bus and address can match
+    uint32_t key = safety_lookup_key(bus, addr);
+    int prev = -1;
+    for (int k = safety_lookup_find(&rx_lookup, key); (k < rx_lookup.len) && (rx_lookup.table[k].key == key); k++) {
+      int i = rx_lookup.table[k].index;
+      if (i != prev) {
+        if (addr_check_matches(addr_list, i, bus, addr, length)) {
+          index = i;
           break;
         }
+        prev = i;
       }
     }
-
-    int idx = addr_list[i].index;
-    if ((addr == addr_list[i].msg[idx].addr) && (bus == addr_list[i].msg[idx].bus) &&
-        (length == addr_list[i].msg[idx].len)) {
-      index = i;
-      break;
+  } else {
+    for (int i = 0; i < len; i++) {
+      if (addr_check_matches(addr_list, i, bus, addr, length)) {
+        index = i;
+        break;
+      }
     }
   }
   return index;
@@ -290,6 +359,9 @@ int set_safety_hooks(uint16_t mode, int16_t param) {
   angle_meas.min = 0;
   angle_meas.max = 0;
 
+  current_tx_msgs = NULL;
+  current_tx_msgs_len = 0;
+
   int set_status = -1;  // not set
   int hook_config_count = sizeof(safety_hook_registry) / sizeof(safety_hook_config);
   for (int i = 0; i < hook_config_count; i++) {
@@ -307,6 +379,7 @@ int set_safety_hooks(uint16_t mode, int16_t param) {
       current_rx_checks->check[j].index = 0;
       current_rx_checks->check[j].msg_seen = false;
     }
+    build_rx_lookup(current_rx_checks);
   }
   return set_status;
 }
@@ -204,6 +204,8 @@ static const addr_checks* chrysler_init(int16_t param) {
   UNUSED(param);
   controls_allowed = false;
   relay_malfunction_reset();
+  current_tx_msgs = CHRYSLER_TX_MSGS;
+  current_tx_msgs_len = sizeof(CHRYSLER_TX_MSGS) / sizeof(CHRYSLER_TX_MSGS[0]);
   return &chrysler_rx_checks;
 }
 
@@ -389,6 +389,8 @@ static const addr_checks* gm_init(int16_t param) {
 
   controls_allowed = false;
   relay_malfunction_reset();
+  current_tx_msgs = GM_TX_MSGS;
+  current_tx_msgs_len = sizeof(GM_TX_MSGS) / sizeof(GM_TX_MSGS[0]);
   return &gm_rx_checks;
 }
 
@@ -334,6 +334,8 @@ static const addr_checks* honda_nidec_init(int16_t param) {
   } else {
     honda_rx_checks = (addr_checks){honda_nidec_addr_checks, HONDA_NIDEC_ADDR_CHECKS_LEN};
   }
+  current_tx_msgs = HONDA_N_TX_MSGS;
+  current_tx_msgs_len = sizeof(HONDA_N_TX_MSGS) / sizeof(HONDA_N_TX_MSGS[0]);
   return &honda_rx_checks;
 }
 
@@ -350,6 +352,13 @@ static const addr_checks* honda_bosch_init(int16_t param) {
 #endif
 
   honda_rx_checks = (addr_checks){honda_bosch_addr_checks, HONDA_BOSCH_ADDR_CHECKS_LEN};
+  if (honda_bosch_long) {
+    current_tx_msgs = HONDA_BOSCH_LONG_TX_MSGS;
+    current_tx_msgs_len = sizeof(HONDA_BOSCH_LONG_TX_MSGS) / sizeof(HONDA_BOSCH_LONG_TX_MSGS[0]);
+  } else {
+    current_tx_msgs = HONDA_BOSCH_TX_MSGS;
+    current_tx_msgs_len = sizeof(HONDA_BOSCH_TX_MSGS) / sizeof(HONDA_BOSCH_TX_MSGS[0]);
+  }
   return &honda_rx_checks;
 }
 
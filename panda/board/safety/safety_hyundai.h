@@ -367,8 +367,12 @@ static const addr_checks* hyundai_init(int16_t param) {
 
   if (hyundai_longitudinal) {
     hyundai_rx_checks = (addr_checks){hyundai_long_addr_checks, HYUNDAI_LONG_ADDR_CHECK_LEN};
+    current_tx_msgs = HYUNDAI_LONG_TX_MSGS;
+    current_tx_msgs_len = sizeof(HYUNDAI_LONG_TX_MSGS) / sizeof(HYUNDAI_LONG_TX_MSGS[0]);
   } else {
     hyundai_rx_checks = (addr_checks){hyundai_addr_checks, HYUNDAI_ADDR_CHECK_LEN};
+    current_tx_msgs = HYUNDAI_TX_MSGS;
+    current_tx_msgs_len = sizeof(HYUNDAI_TX_MSGS) / sizeof(HYUNDAI_TX_MSGS[0]);
   }
   return &hyundai_rx_checks;
 }
@@ -382,6 +386,8 @@ static const addr_checks* hyundai_legacy_init(int16_t param) {
   hyundai_ev_gas_signal = GET_FLAG(param, HYUNDAI_PARAM_EV_GAS);
   hyundai_hybrid_gas_signal = !hyundai_ev_gas_signal && GET_FLAG(param, HYUNDAI_PARAM_HYBRID_GAS);
   hyundai_rx_checks = (addr_checks){hyundai_legacy_addr_checks, HYUNDAI_LEGACY_ADDR_CHECK_LEN};
+  current_tx_msgs = HYUNDAI_TX_MSGS;
+  current_tx_msgs_len = sizeof(HYUNDAI_TX_MSGS) / sizeof(HYUNDAI_TX_MSGS[0]);
   return &hyundai_rx_checks;
 }
 
@@ -175,6 +175,8 @@ static const addr_checks* mazda_init(int16_t param) {
   UNUSED(param);
   controls_allowed = false;
   relay_malfunction_reset();
+  current_tx_msgs = MAZDA_TX_MSGS;
+  current_tx_msgs_len = sizeof(MAZDA_TX_MSGS) / sizeof(MAZDA_TX_MSGS[0]);
   return &mazda_rx_checks;
 }
 
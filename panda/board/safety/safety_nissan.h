@@ -192,6 +192,8 @@ static const addr_checks* nissan_init(int16_t param) {
   controls_allowed = 0;
   nissan_alt_eps = param ? 1 : 0;
   relay_malfunction_reset();
+  current_tx_msgs = NISSAN_TX_MSGS;
+  current_tx_msgs_len = sizeof(NISSAN_TX_MSGS) / sizeof(NISSAN_TX_MSGS[0]);
   return &nissan_rx_checks;
 }
 
@@ -313,6 +313,8 @@ static const addr_checks* subaru_init(int16_t param) {
   UNUSED(param);
   controls_allowed = false;
   relay_malfunction_reset();
+  current_tx_msgs = SUBARU_TX_MSGS;
+  current_tx_msgs_len = SUBARU_TX_MSGS_LEN;
   return &subaru_rx_checks;
 }
 
@@ -328,6 +330,8 @@ static const addr_checks* subaru_legacy_init(int16_t param) {
   UNUSED(param);
   controls_allowed = false;
   relay_malfunction_reset();
+  current_tx_msgs = SUBARU_L_TX_MSGS;
+  current_tx_msgs_len = SUBARU_L_TX_MSGS_LEN;
   return &subaru_l_rx_checks;
 }
 
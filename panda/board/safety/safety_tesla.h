@@ -241,6 +241,8 @@ static const addr_checks* tesla_init(int16_t param) {
   controls_allowed = 0;
   relay_malfunction_reset();
 
+  current_tx_msgs = tesla_powertrain ? TESLA_PT_TX_MSGS : TESLA_TX_MSGS;
+  current_tx_msgs_len = tesla_powertrain ? TESLA_PT_TX_LEN : TESLA_TX_LEN;
   return tesla_powertrain ? (&tesla_pt_rx_checks) : (&tesla_rx_checks);
 }
 
@@ -244,6 +244,8 @@ static const addr_checks* toyota_init(int16_t param) {
   relay_malfunction_reset();
   gas_interceptor_detected = 0;
   toyota_dbc_eps_torque_factor = param;
+  current_tx_msgs = TOYOTA_TX_MSGS;
+  current_tx_msgs_len = sizeof(TOYOTA_TX_MSGS) / sizeof(TOYOTA_TX_MSGS[0]);
   return &toyota_rx_checks;
 }
 
@@ -82,6 +82,8 @@ static const addr_checks* volkswagen_mqb_init(int16_t param) {
   controls_allowed = false;
   relay_malfunction_reset();
   gen_crc_lookup_table(0x2F, volkswagen_crc8_lut_8h2f);
+  current_tx_msgs = VOLKSWAGEN_MQB_TX_MSGS;
+  current_tx_msgs_len = VOLKSWAGEN_MQB_TX_MSGS_LEN;
   return &volkswagen_mqb_rx_checks;
 }
 
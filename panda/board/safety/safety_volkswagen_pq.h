@@ -54,6 +54,8 @@ static const addr_checks* volkswagen_pq_init(int16_t param) {
 
   controls_allowed = false;
   relay_malfunction_reset();
+  current_tx_msgs = VOLKSWAGEN_PQ_TX_MSGS;
+  current_tx_msgs_len = VOLKSWAGEN_PQ_TX_MSGS_LEN;
   return &volkswagen_pq_rx_checks;
 }
 
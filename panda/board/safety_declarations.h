@@ -54,6 +54,22 @@ typedef struct {
   int len;
 } addr_checks;
 
+// rx checks, sorted by bus and address for a binary search
+#define SAFETY_LOOKUP_SIZE 32
+
+typedef struct {
+  uint32_t key;                      // bus and address, see safety_lookup_key
+  int index;                         // of the AddrCheckStruct or CanMsg in the list
+} safety_lookup_entry;
+
+typedef struct {
+  const void *list;                  // the list the table was built for
+  int list_len;
+  bool valid;                        // false if the list doesn't fit, it's scanned instead
+  int len;
+  safety_lookup_entry table[SAFETY_LOOKUP_SIZE];
+} safety_lookup;
+
 int safety_rx_hook(CANPacket_t *to_push);
 int safety_tx_hook(CANPacket_t *to_send);
 int safety_tx_lin_hook(int lin_num, uint8_t *data, int len);
@@ -69,7 +85,12 @@ bool driver_limit_check(int val, int val_last, struct sample_t *val_driver,
 bool rt_rate_limit_check(int val, int val_last, const int MAX_RT_DELTA);
 float interpolate(struct lookup_t xy, float x);
 void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]);
+uint32_t safety_lookup_key(int bus, int addr);
+int safety_lookup_find(const safety_lookup *lookup, uint32_t key);
+void safety_lookup_add(safety_lookup *lookup, uint32_t key, int index);
+void build_rx_lookup(const addr_checks *rx_checks);
 bool msg_allowed(CANPacket_t *to_send, const CanMsg msg_list[], int len);
+bool addr_check_matches(AddrCheckStruct addr_list[], int i, int bus, int addr, int length);
 int get_addr_check_index(CANPacket_t *to_push, AddrCheckStruct addr_list[], const int len);
 void update_counter(AddrCheckStruct addr_list[], int index, uint8_t counter);
 void update_addr_timestamp(AddrCheckStruct addr_list[], int index);
@@ -148,3 +169,10 @@ int unsafe_mode = 0;
 uint32_t safety_mode_cnt = 0U;
 // allow 1s of transition timeout after relay changes state before assessing malfunctioning
 const uint32_t RELAY_TRNS_TIMEOUT = 1U;
+
+// tx whitelist of the current safety mode, set by its init. the tx hooks check their own list, safety_bench replays this one
+const CanMsg *current_tx_msgs = NULL;
+int current_tx_msgs_len = 0;
+
+// rx checks of the current safety mode
+safety_lookup rx_lookup = {.list = NULL, .list_len = 0, .valid = false, .len = 0};
@@ -0,0 +1,329 @@
+// Times the safety hooks on the host. CAN traffic is replayed through the same
+// safety code as libpandasafety, each frame's hooks timed like the panda runs
+// them from its CAN interrupts.
+//
+//   ./safety_bench [-b budget_ns] [-i iterations] [mode [param [frames]]]
+//
+// frames is a dump of a drive from tests/safety_replay/dump_can.py. Without one,
+// the mode's rx checked messages and tx whitelist are sent at their rates, along
+// with unchecked traffic. Without a mode, every safety mode is timed.
+// Exits with 1 if a mode's worst frame takes longer than the budget.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "test.c"
+
+#define BENCH_DEFAULT_BUDGET_NS 2000U
+#define BENCH_DEFAULT_ITERATIONS 20
+#define BENCH_SYNTHETIC_US 10000000U
+#define BENCH_SYNTHETIC_BACKGROUND_US 500U
+#define BENCH_SYNTHETIC_TX_US 10000U
+#define BENCH_WORST_PATHS 5
+
+typedef enum {
+  HOOK_RX,
+  HOOK_FWD,
+  HOOK_TX,
+  HOOK_COUNT,
+} bench_hook;
+
+const char *hook_names[HOOK_COUNT] = {"rx", "fwd", "tx"};
+
+typedef struct {
+  uint32_t t_us;
+  bool tx;
+  CANPacket_t pkt;
+} bench_frame;
+
+typedef struct {
+  bench_frame *frames;
+  int len;
+  int cap;
+} bench_trace;
+
+// cost of the fastest of the iterations, the path taken doesn't change between them
+typedef struct {
+  uint64_t ns[HOOK_COUNT];
+} bench_cost;
+
+uint64_t now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000000ULL) + (uint64_t)t.tv_nsec;
+}
+
+void trace_add(bench_trace *trace, uint32_t t_us, bool tx, int bus, int addr, const uint8_t *dat, int len) {
+  if (trace->len == trace->cap) {
+    trace->cap = (trace->cap > 0) ? (trace->cap * 2) : 1024;
+    trace->frames = realloc(trace->frames, trace->cap * sizeof(bench_frame));
+  }
+  bench_frame *f = &trace->frames[trace->len++];
+  memset(f, 0, sizeof(bench_frame));
+  f->t_us = t_us;
+  f->tx = tx;
+  f->pkt.bus = bus;
+  f->pkt.addr = addr;
+  f->pkt.extended = (addr >= 0x800) ? 1 : 0;
+  len = MIN(len, CANPACKET_DATA_SIZE_MAX);
+  for (int dlc = 0; dlc < 16; dlc++) {
+    if (dlc_to_len[dlc] >= len) {
+      f->pkt.data_len_code = dlc;
+      break;
+    }
+  }
+  if (dat != NULL) {
+    memcpy(f->pkt.data, dat, len);
+  }
+}
+
+int frame_cmp(const void *a, const void *b) {
+  const bench_frame *fa = a;
+  const bench_frame *fb = b;
+  return (fa->t_us > fb->t_us) - (fa->t_us < fb->t_us);
+}
+
+// lines of "<t_us> <rx|tx> <bus> <addr> <hex data, - if empty>"
+bool load_trace(const char *path, bench_trace *trace) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return false;
+  }
+  unsigned long long t_us;
+  char dir[3];
+  int bus, addr;
+  char hex[2 * 64 + 1];
+  while (fscanf(f, "%llu %2s %d %d %128s", &t_us, dir, &bus, &addr, hex) == 5) {
+    uint8_t dat[64] = {0};
+    int len = (hex[0] == '-') ? 0 : (int)(strlen(hex) / 2);
+    for (int i = 0; i < len; i++) {
+      unsigned int b;
+      sscanf(&hex[2 * i], "%2x", &b);
+      dat[i] = b;
+    }
+    trace_add(trace, (uint32_t)t_us, strcmp(dir, "tx") == 0, bus, addr, dat, len);
+  }
+  fclose(f);
+  return true;
+}
+
+void synthetic_trace(uint16_t mode, int16_t param, bench_trace *trace) {
+  set_safety_hooks(mode, param);
+
+  // the messages the mode checks, at their rates
+  for (int i = 0; i < current_rx_checks->len; i++) {
+    const CanMsgCheck *m = &current_rx_checks->check[i].msg[0];
+    uint32_t step = (m->expected_timestep > 0U) ? m->expected_timestep : 10000U;
+    for (uint32_t t = 0U; t < BENCH_SYNTHETIC_US; t += step) {
+      trace_add(trace, t, false, m->bus, m->addr, NULL, m->len);
+    }
+  }
+
+  // and the rest of the bus, which most modes only look up
+  srand(mode);
+  for (uint32_t t = 0U; t < BENCH_SYNTHETIC_US; t += BENCH_SYNTHETIC_BACKGROUND_US) {
+    uint8_t dat[8];
+    for (int i = 0; i < 8; i++) {
+      dat[i] = rand();
+    }
+    trace_add(trace, t, false, rand() % 3, 0x100 + (rand() % 0x700), dat, 8);
+  }
+
+  // and the tx whitelist the mode's init set
+  for (int i = 0; (current_tx_msgs != NULL) && (i < current_tx_msgs_len); i++) {
+    for (uint32_t t = 0U; t < BENCH_SYNTHETIC_US; t += BENCH_SYNTHETIC_TX_US) {
+      trace_add(trace, t, true, current_tx_msgs[i].bus, current_tx_msgs[i].addr, NULL, current_tx_msgs[i].len);
+    }
+  }
+
+  qsort(trace->frames, trace->len, sizeof(bench_frame), frame_cmp);
+}
+
+uint64_t timer_overhead_ns(void) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < 10000; i++) {
+    uint64_t t0 = now_ns();
+    best = MIN(best, now_ns() - t0);
+  }
+  return best;
+}
+
+int cost_cmp(const void *a, const void *b) {
+  uint64_t ca = *(const uint64_t *)a;
+  uint64_t cb = *(const uint64_t *)b;
+  return (ca > cb) - (ca < cb);
+}
+
+// returns the worst frame's cost
+uint64_t report(const bench_trace *trace, const bench_cost *costs) {
+  uint64_t worst = 0U;
+  uint64_t *sorted = malloc(trace->len * sizeof(uint64_t));
+  for (int h = 0; h < HOOK_COUNT; h++) {
+    int n = 0;
+    uint64_t total = 0U;
+    for (int i = 0; i < trace->len; i++) {
+      if (trace->frames[i].tx == (h == HOOK_TX)) {
+        sorted[n++] = costs[i].ns[h];
+        total += costs[i].ns[h];
+      }
+    }
+    if (n == 0) {
+      continue;
+    }
+    qsort(sorted, n, sizeof(uint64_t), cost_cmp);
+    printf("  %-3s %8d frames  mean %5llu ns  p50 %5llu ns  p99 %5llu ns  max %5llu ns\n", hook_names[h], n,
+           (unsigned long long)(total / n), (unsigned long long)sorted[n / 2],
+           (unsigned long long)sorted[(n * 99) / 100], (unsigned long long)sorted[n - 1]);
+    worst = MAX(worst, sorted[n - 1]);
+  }
+  free(sorted);
+
+  // the slowest frames, by hook, bus and address
+  int worst_idx[BENCH_WORST_PATHS];
+  int worst_hook[BENCH_WORST_PATHS];
+  int worst_len = 0;
+  for (int i = 0; i < trace->len; i++) {
+    for (int h = 0; h < HOOK_COUNT; h++) {
+      if (trace->frames[i].tx != (h == HOOK_TX)) {
+        continue;
+      }
+      // one entry per path, keep its slowest frame
+      int pos = -1;
+      for (int w = 0; w < worst_len; w++) {
+        const CANPacket_t *p = &trace->frames[worst_idx[w]].pkt;
+        if ((worst_hook[w] == h) && (p->bus == trace->frames[i].pkt.bus) && (p->addr == trace->frames[i].pkt.addr)) {
+          pos = w;
+        }
+      }
+      if (pos < 0) {
+        if (worst_len < BENCH_WORST_PATHS) {
+          pos = worst_len++;
+        } else if (costs[i].ns[h] > costs[worst_idx[worst_len - 1]].ns[worst_hook[worst_len - 1]]) {
+          pos = worst_len - 1;
+        } else {
+          continue;
+        }
+      } else if (costs[i].ns[h] <= costs[worst_idx[pos]].ns[h]) {
+        continue;
+      }
+      worst_idx[pos] = i;
+      worst_hook[pos] = h;
+      // keep them sorted, slowest first
+      while ((pos > 0) && (costs[worst_idx[pos]].ns[worst_hook[pos]] > costs[worst_idx[pos - 1]].ns[worst_hook[pos - 1]])) {
+        int ti = worst_idx[pos - 1], th = worst_hook[pos - 1];
+        worst_idx[pos - 1] = worst_idx[pos];
+        worst_hook[pos - 1] = worst_hook[pos];
+        worst_idx[pos] = ti;
+        worst_hook[pos] = th;
+        pos--;
+      }
+    }
+  }
+  printf("  slowest:");
+  for (int w = 0; w < worst_len; w++) {
+    const CANPacket_t *p = &trace->frames[worst_idx[w]].pkt;
+    printf(" %s %d:0x%x %llu ns%s", hook_names[worst_hook[w]], p->bus, p->addr,
+           (unsigned long long)costs[worst_idx[w]].ns[worst_hook[w]], (w < (worst_len - 1)) ? "," : "\n");
+  }
+  return worst;
+}
+
+// false if the mode's worst frame is over the budget. synthetic traffic doesn't
+// engage, so engaged starts with controls allowed to time the tx checks
+bool bench_mode(uint16_t mode, int16_t param, const bench_trace *trace, bool engaged, int iterations, uint64_t budget_ns) {
+  bench_cost *costs = malloc(trace->len * sizeof(bench_cost));
+  for (int i = 0; i < trace->len; i++) {
+    for (int h = 0; h < HOOK_COUNT; h++) {
+      costs[i].ns[h] = UINT64_MAX;
+    }
+  }
+  const uint64_t overhead = timer_overhead_ns();
+
+  for (int it = 0; it < iterations; it++) {
+    // every iteration takes the same paths from the same state
+    init_tests();
+    set_safety_hooks(mode, param);
+    set_controls_allowed(engaged);
+    for (int i = 0; i < trace->len; i++) {
+      bench_frame f = trace->frames[i];
+      set_timer(f.t_us);
+      uint64_t t0, t1, t2;
+      if (f.tx) {
+        t0 = now_ns();
+        safety_tx_hook(&f.pkt);
+        t1 = now_ns();
+        costs[i].ns[HOOK_TX] = MIN(costs[i].ns[HOOK_TX], t1 - t0);
+      } else {
+        t0 = now_ns();
+        safety_rx_hook(&f.pkt);
+        t1 = now_ns();
+        safety_fwd_hook(f.pkt.bus, &f.pkt);
+        t2 = now_ns();
+        costs[i].ns[HOOK_RX] = MIN(costs[i].ns[HOOK_RX], t1 - t0);
+        costs[i].ns[HOOK_FWD] = MIN(costs[i].ns[HOOK_FWD], t2 - t1);
+      }
+    }
+  }
+  for (int i = 0; i < trace->len; i++) {
+    for (int h = 0; h < HOOK_COUNT; h++) {
+      costs[i].ns[h] = (costs[i].ns[h] > overhead) ? (costs[i].ns[h] - overhead) : 0U;
+    }
+  }
+
+  printf("mode %d param %d: %d frames, %d iterations\n", mode, param, trace->len, iterations);
+  uint64_t worst = report(trace, costs);
+  bool ok = worst <= budget_ns;
+  if (!ok) {
+    printf("  OVER BUDGET: %llu ns > %llu ns\n", (unsigned long long)worst, (unsigned long long)budget_ns);
+  }
+  free(costs);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t budget_ns = BENCH_DEFAULT_BUDGET_NS;
+  int iterations = BENCH_DEFAULT_ITERATIONS;
+  int arg = 1;
+  while ((arg < (argc - 1)) && (argv[arg][0] == '-')) {
+    if (strcmp(argv[arg], "-b") == 0) {
+      budget_ns = strtoull(argv[arg + 1], NULL, 10);
+    } else if (strcmp(argv[arg], "-i") == 0) {
+      iterations = MAX(atoi(argv[arg + 1]), 1);
+    } else {
+      break;
+    }
+    arg += 2;
+  }
+
+  bool ok = true;
+  if (arg < argc) {
+    uint16_t mode = atoi(argv[arg]);
+    int16_t param = (arg + 1 < argc) ? atoi(argv[arg + 1]) : 0;
+    bench_trace trace = {0};
+    bool synthetic = arg + 2 >= argc;
+    if (!synthetic) {
+      if (!load_trace(argv[arg + 2], &trace)) {
+        fprintf(stderr, "can't read %s\n", argv[arg + 2]);
+        return 2;
+      }
+    } else {
+      synthetic_trace(mode, param, &trace);
+    }
+    if (set_safety_hooks(mode, param) != 0) {
+      fprintf(stderr, "invalid safety mode: %d\n", mode);
+      return 2;
+    }
+    ok = bench_mode(mode, param, &trace, synthetic, iterations, budget_ns);
+    free(trace.frames);
+  } else {
+    int hook_config_count = sizeof(safety_hook_registry) / sizeof(safety_hook_config);
+    for (int i = 0; i < hook_config_count; i++) {
+      bench_trace trace = {0};
+      synthetic_trace(safety_hook_registry[i].id, 0, &trace);
+      ok = bench_mode(safety_hook_registry[i].id, 0, &trace, true, iterations, budget_ns) && ok;
+      free(trace.frames);
+    }
+  }
+  return ok ? 0 : 1;
+}
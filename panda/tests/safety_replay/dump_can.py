@@ -0,0 +1,31 @@
+#!/usr/bin/env python3
+import sys
+from tools.lib.logreader import LogReader  # pylint: disable=import-error
+
+# dump the CAN traffic of a drive for tests/safety/safety_bench, one frame per line:
+# <t_us> <rx|tx> <bus> <addr> <hex data, - if empty>
+def dump_can(lr, f):
+  frames = 0
+  for msg in lr:
+    t_us = msg.logMonoTime // 1000
+    if msg.which() == 'sendcan':
+      for canmsg in msg.sendcan:
+        f.write("%d tx %d %d %s\n" % (t_us, canmsg.src, canmsg.address, canmsg.dat.hex() or "-"))
+        frames += 1
+    elif msg.which() == 'can':
+      for canmsg in msg.can:
+        # ignore msgs we sent
+        if canmsg.src >= 128:
+          continue
+        f.write("%d rx %d %d %s\n" % (t_us, canmsg.src, canmsg.address, canmsg.dat.hex() or "-"))
+        frames += 1
+  return frames
+
+if __name__ == "__main__":
+  if len(sys.argv) != 3:
+    print("usage: %s <log> <frames>" % sys.argv[0])
+    sys.exit(1)
+
+  with open(sys.argv[2], "w") as f:
+    frames = dump_can(LogReader(sys.argv[1]), f)
+  print("dumped %d frames to %s" % (frames, sys.argv[2]))
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <eigen3/Eigen/Dense>
+
+#include "common_ekf.h"
+#include "ekf_sym.h"
+#include "logger/logger.h"
+
+namespace EKFS {
+
+// Same filter as EKFSym, for a state size known at compile time (the DIM/EDIM of the
+// generated code). Storage is sized up front, so predict and updates don't allocate,
+// and an Estimate is only built for callers that pass one in. No MSCKF augmentation.
+// An update takes up to MAX_BATCH observations of up to MAX_ZDIM values and MAX_EXTRA_ARGS extra args each.
+template <int DIM, int EDIM, int MAX_BATCH = 1, int MAX_ZDIM = 8, int MAX_EXTRA_ARGS = 8>
+class EKFSymFixed {
+  static_assert(MAX_BATCH > 0 && MAX_ZDIM > 0 && MAX_EXTRA_ARGS >= 0);
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  static constexpr int max_batch = MAX_BATCH;
+  static constexpr int max_zdim = MAX_ZDIM;
+  static constexpr int max_extra_args = MAX_EXTRA_ARGS;
+
+  typedef Eigen::Matrix<double, DIM, 1> State;
+  typedef Eigen::Matrix<double, EDIM, EDIM, Eigen::RowMajor> Covs;
+
+  EKFSymFixed(std::string name, const Covs &Q, const State &x_initial, const Covs &P_initial,
+      std::vector<int> quaternion_idxs = std::vector<int>(), double max_rewind_age = 1.0)
+    : ekf(ekf_lookup(name)), quaternion_idxs(quaternion_idxs), Q(Q), max_rewind_age(max_rewind_age),
+      rewind_states(REWIND_TO_KEEP), rewind_obscache(REWIND_TO_KEEP), rewound(REWIND_TO_KEEP) {
+    assert(this->ekf);
+    this->init_state(x_initial, P_initial, NAN);
+  }
+
+  void init_state(const State &state, const Covs &covs, double init_filter_time) {
+    this->x = state;
+    this->P = covs;
+    this->filter_time = init_filter_time;
+    this->reset_rewind();
+  }
+
+  const State &state() const { return this->x; }
+  const Covs &covs() const { return this->P; }
+  void set_filter_time(double t) { this->filter_time = t; }
+  double get_filter_time() const { return this->filter_time; }
+  void set_global(const std::string &global_var, double val) { this->ekf->sets.at(global_var)(val); }
+  extra_routine_t get_extra_routine(const std::string &routine) const { return this->ekf->extra_routines.at(routine); }
+
+  void reset_rewind() {
+    this->rewind_start = 0;
+    this->rewind_len = 0;
+  }
+
+  void predict(double t) {
+    // initialize time
+    if (std::isnan(this->filter_time)) {
+      this->filter_time = t;
+    }
+
+    double dt = t - this->filter_time;
+    assert(dt >= 0.0);
+
+    this->ekf->predict(this->x.data(), this->P.data(), this->Q.data(), dt);
+    this->normalize_quaternions();
+    this->filter_time = t;
+  }
+
+  // a single observation. returns false if it's too old to rewind to
+  bool predict_and_update(double t, int kind, const Eigen::Ref<const Eigen::VectorXd> &z,
+      const Eigen::Ref<const MatrixXdr> &R, Estimate *estimate = nullptr) {
+    Observation obs;
+    obs.t = t;
+    obs.kind = kind;
+    obs.n = 0;
+    obs.add(z, R, nullptr, 0);
+    return this->predict_and_update_batch(obs, estimate);
+  }
+
+  bool predict_and_update_batch(double t, int kind, const std::vector<Eigen::VectorXd> &z, const std::vector<MatrixXdr> &R,
+      const std::vector<std::vector<double>> &extra_args = {}, Estimate *estimate = nullptr) {
+    assert(z.size() == R.size());
+    assert(extra_args.empty() || z.size() == extra_args.size());
+    Observation obs;
+    obs.t = t;
+    obs.kind = kind;
+    obs.n = 0;
+    for (size_t i = 0; i < z.size(); i++) {
+      const double *ea = extra_args.empty() ? nullptr : extra_args[i].data();
+      obs.add(z[i], R[i], ea, extra_args.empty() ? 0 : extra_args[i].size());
+    }
+    return this->predict_and_update_batch(obs, estimate);
+  }
+
+private:
+  // an observation batch, with room for MAX_BATCH observations
+  struct Observation {
+    double t;
+    int kind;
+    int n;
+    int zdim[MAX_BATCH];
+    int n_extra[MAX_BATCH];
+    double z[MAX_BATCH][MAX_ZDIM];
+    double R[MAX_BATCH][MAX_ZDIM * MAX_ZDIM];  // row major
+    double extra_args[MAX_BATCH][MAX_EXTRA_ARGS > 0 ? MAX_EXTRA_ARGS : 1];
+
+    void add(const Eigen::Ref<const Eigen::VectorXd> &zi, const Eigen::Ref<const MatrixXdr> &Ri, const double *ea, int n_ea) {
+      assert(this->n < MAX_BATCH);
+      assert(zi.rows() <= MAX_ZDIM && zi.rows() == Ri.rows() && zi.rows() == Ri.cols());
+      assert(n_ea <= MAX_EXTRA_ARGS);
+      const int i = this->n++;
+      this->zdim[i] = zi.rows();
+      this->n_extra[i] = n_ea;
+      Eigen::Map<Eigen::VectorXd>(this->z[i], zi.rows()) = zi;
+      Eigen::Map<MatrixXdr>(this->R[i], Ri.rows(), Ri.cols()) = Ri;
+      if (n_ea > 0) {
+        memcpy(this->extra_args[i], ea, n_ea * sizeof(double));
+      }
+    }
+  };
+
+  struct Checkpoint {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    double t;
+    State x;
+    Covs P;
+  };
+
+  void normalize_quaternions() {
+    for (int idx : this->quaternion_idxs) {
+      this->x.template segment<4>(idx).normalize();
+    }
+  }
+
+  bool predict_and_update_batch(const Observation &obs, Estimate *estimate) {
+    int n_rewound = 0;
+    if (!std::isnan(this->filter_time) && obs.t < this->filter_time) {
+      if (this->rewind_len == 0 || obs.t < this->rewind_states[this->rewind_index(0)].t ||
+          obs.t < this->rewind_states[this->rewind_index(this->rewind_len - 1)].t - this->max_rewind_age) {
+        LOGD("observation too old at %f with filter at %f, ignoring!", obs.t, this->filter_time);
+        return false;
+      }
+      n_rewound = this->rewind(obs.t);
+    }
+
+    this->update_batch(obs, estimate);
+
+    // fast forward
+    for (int i = 0; i < n_rewound; i++) {
+      this->update_batch(this->rewound[i], nullptr);
+    }
+    return true;
+  }
+
+  void update_batch(const Observation &obs, Estimate *estimate) {
+    this->predict(obs.t);
+
+    if (estimate != nullptr) {
+      estimate->t = obs.t;
+      estimate->kind = obs.kind;
+      estimate->xk1 = this->x;
+      estimate->Pk1 = this->P;
+      estimate->z.clear();
+      estimate->y.clear();
+      estimate->extra_args.clear();
+    }
+
+    for (int i = 0; i < obs.n; i++) {
+      // the generated updates take the observation's size from its kind
+      this->ekf->updates.at(obs.kind)(this->x.data(), this->P.data(), const_cast<double *>(obs.z[i]),
+                                      const_cast<double *>(obs.R[i]), const_cast<double *>(obs.extra_args[i]));
+      this->normalize_quaternions();
+
+      if (estimate != nullptr) {
+        estimate->z.push_back(Eigen::Map<const Eigen::VectorXd>(obs.z[i], obs.zdim[i]));
+        estimate->y.push_back(estimate->z.back());
+        estimate->extra_args.emplace_back(obs.extra_args[i], obs.extra_args[i] + obs.n_extra[i]);
+      }
+    }
+
+    if (estimate != nullptr) {
+      estimate->xk = this->x;
+      estimate->Pk = this->P;
+    }
+
+    this->checkpoint(obs);
+  }
+
+  int rewind_index(int i) const {
+    return (this->rewind_start + i) % REWIND_TO_KEEP;
+  }
+
+  void checkpoint(const Observation &obs) {
+    // only keep a certain number around
+    if (this->rewind_len == REWIND_TO_KEEP) {
+      this->rewind_start = this->rewind_index(1);
+      this->rewind_len--;
+    }
+    const int idx = this->rewind_index(this->rewind_len++);
+    this->rewind_states[idx].t = this->filter_time;
+    this->rewind_states[idx].x = this->x;
+    this->rewind_states[idx].P = this->P;
+    this->rewind_obscache[idx] = obs;
+  }
+
+  // moves the observations after t to rewound, in order, and returns how many
+  int rewind(double t) {
+    int n = 0;
+    while (this->rewind_states[this->rewind_index(this->rewind_len - 1)].t > t) {
+      n++;
+      this->rewind_len--;
+    }
+    for (int i = 0; i < n; i++) {
+      this->rewound[i] = this->rewind_obscache[this->rewind_index(this->rewind_len + i)];
+    }
+
+    // set the state to the time right before that
+    const Checkpoint &last = this->rewind_states[this->rewind_index(this->rewind_len - 1)];
+    this->filter_time = last.t;
+    this->x = last.x;
+    this->P = last.P;
+    return n;
+  }
+
+  // stuct with linked sympy generated functions
+  const EKF *ekf = NULL;
+
+  State x;  // state
+  Covs P;  // covs
+
+  double filter_time;
+  std::vector<int> quaternion_idxs;
+
+  // process noise
+  Covs Q;
+
+  // rewind stuff, a ring of the last REWIND_TO_KEEP updates
+  double max_rewind_age;
+  int rewind_start = 0;
+  int rewind_len = 0;
+  std::vector<Checkpoint, Eigen::aligned_allocator<Checkpoint>> rewind_states;
+  std::vector<Observation> rewind_obscache;
+  std::vector<Observation> rewound;
+};
+
+}
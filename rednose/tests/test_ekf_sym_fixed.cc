@@ -0,0 +1,94 @@
+// Cross-checks EKFSymFixed against EKFSym: both run the same stub filter through 20000 observations,
+// a fifth of them in the past so they are rewound onto the history or dropped when too old, and must
+// agree on every accepted observation, estimate, state and covariance.
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "rednose/helpers/ekf_sym.h"
+#include "rednose/helpers/ekf_sym_fixed.h"
+
+using namespace EKFS;
+
+const int DIM = 4;
+const int EDIM = 4;
+const int ZDIM = 3;
+const int OBSERVATION_KIND = 1;
+
+// a stub of the generated functions: constant drift, and a scalar Kalman gain per measured state
+static void stub_predict(double *x, double *P, double *Q, double dt) {
+  for (int i = 0; i < DIM; i++) {
+    x[i] += dt * 0.1 * (i + 1);
+  }
+  for (int i = 0; i < EDIM * EDIM; i++) {
+    P[i] += Q[i] * dt;
+  }
+}
+
+static void stub_update(double *x, double *P, double *z, double *R, double *extra_args) {
+  for (int i = 0; i < ZDIM; i++) {
+    double k = P[i * EDIM + i] / (P[i * EDIM + i] + R[i * ZDIM + i]);
+    x[i] += k * (z[i] - x[i]);
+    P[i * EDIM + i] *= (1 - k);
+  }
+}
+
+static EKF stub = [] {
+  EKF ekf;
+  ekf.name = "stub";
+  ekf.predict = stub_predict;
+  ekf.updates[OBSERVATION_KIND] = stub_update;
+  return ekf;
+}();
+ekf_init(stub);
+
+int main() {
+  const double max_rewind_age = 1.0;
+  Eigen::Matrix<double, EDIM, EDIM, Eigen::RowMajor> Q = Eigen::Matrix<double, EDIM, EDIM, Eigen::RowMajor>::Identity() * 0.01;
+  Eigen::Matrix<double, EDIM, EDIM, Eigen::RowMajor> P0 = Q * 100;
+  Eigen::Matrix<double, DIM, 1> x0 = Eigen::Matrix<double, DIM, 1>::Zero();
+
+  EKFSymFixed<DIM, EDIM> fixed("stub", Q, x0, P0, {}, max_rewind_age);
+  MatrixXdr Q_dyn = Q, P0_dyn = P0;
+  Eigen::VectorXd x0_dyn = x0;
+  EKFSym dynamic("stub", Eigen::Map<MatrixXdr>(Q_dyn.data(), EDIM, EDIM), Eigen::Map<Eigen::VectorXd>(x0_dyn.data(), DIM),
+                 Eigen::Map<MatrixXdr>(P0_dyn.data(), EDIM, EDIM), DIM, EDIM, 0, 0, 0, {}, {}, {}, max_rewind_age);
+
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  int mismatches = 0, dropped = 0, rewound = 0;
+  double t_last = 0;
+  for (int i = 0; i < 20000; i++) {
+    double t = 0.01 * (i + 1);
+    if (uniform(rng) < 0.2) {
+      t -= uniform(rng) * 1.5 * max_rewind_age;
+    }
+    Eigen::VectorXd z = Eigen::Vector3d(uniform(rng), uniform(rng), uniform(rng));
+    MatrixXdr R = MatrixXdr::Identity(ZDIM, ZDIM) * 0.1;
+
+    Estimate estimate;
+    bool accepted = fixed.predict_and_update(t, OBSERVATION_KIND, z, R, &estimate);
+    std::vector<Eigen::Map<Eigen::VectorXd>> z_dyn = {Eigen::Map<Eigen::VectorXd>(z.data(), ZDIM)};
+    std::vector<Eigen::Map<MatrixXdr>> R_dyn = {Eigen::Map<MatrixXdr>(R.data(), ZDIM, ZDIM)};
+    std::optional<Estimate> expected = dynamic.predict_and_update_batch(t, OBSERVATION_KIND, z_dyn, R_dyn, {{}}, false);
+
+    if (accepted != expected.has_value()) {
+      if (mismatches < 5) printf("observation %d at %.3f: accepted %d, expected %d\n", i, t, accepted, expected.has_value());
+      mismatches++;
+    } else if (accepted && ((estimate.xk - expected->xk).norm() > 0 || (estimate.Pk1 - expected->Pk1).norm() > 0)) {
+      if (mismatches < 5) printf("observation %d at %.3f: estimates differ\n", i, t);
+      mismatches++;
+    }
+    if ((fixed.state() - dynamic.state()).norm() > 1e-12 || (fixed.covs() - dynamic.covs()).norm() > 1e-12) {
+      if (mismatches < 5) printf("observation %d at %.3f: filters differ\n", i, t);
+      mismatches++;
+    }
+
+    dropped += !accepted;
+    rewound += accepted && t < t_last;
+    t_last = accepted ? std::max(t_last, t) : t_last;
+  }
+
+  printf("20000 observations, %d rewound, %d dropped, %d mismatches\n", rewound, dropped, mismatches);
+  return (mismatches == 0 && rewound > 0 && dropped > 0) ? 0 : 1;
+}
@@ -13,11 +13,13 @@
 #include <cerrno>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <future>
 #include <thread>
+#include <unordered_map>
 
 #include <libusb-1.0/libusb.h>
 
@@ -204,17 +206,168 @@ Panda *usb_connect(std::string serial="", uint32_t index=0) {
   return panda.release();
 }
 
+// sendcan frames go out by priority, then deadline. a frame is dropped once it's older than
+// the max age of its priority, actuator commands are useless when they're late
+#define SENDCAN_HIGH 0
+#define SENDCAN_NORMAL 1
+#define SENDCAN_LOW 2
+#define SENDCAN_PRIORITY_CNT 3
+#define SENDCAN_MAX_BURST 32
+#define SENDCAN_STATS_INTERVAL_NS 60000000000ULL
+#define SENDCAN_PARAMS_INTERVAL_NS 5000000000ULL
+const uint64_t SENDCAN_MAX_AGE_NS[SENDCAN_PRIORITY_CNT] = {100000000ULL, 1000000000ULL, 1000000000ULL};
+const char *const SENDCAN_PRIORITY_NAMES[SENDCAN_PRIORITY_CNT] = {"high", "normal", "low"};
+
+class SendcanScheduler {
+public:
+  // the car port's priorities, every other address is normal
+  void set_priorities(capnp::List<cereal::CarParams::CanSendPriority>::Reader priorities) {
+    address_priority.clear();
+    for (auto p : priorities) {
+      switch (p.getPriority()) {
+        case cereal::CarParams::CanSendPriority::Priority::HIGH: address_priority[p.getAddress()] = SENDCAN_HIGH; break;
+        case cereal::CarParams::CanSendPriority::Priority::LOW: address_priority[p.getAddress()] = SENDCAN_LOW; break;
+        default: break;
+      }
+    }
+  }
+
+  // queues the frames of a sendcan event, which has to stay alive until they're sent
+  void add(cereal::Event::Reader event) {
+    const uint64_t event_time = event.getLogMonoTime();
+    for (auto cmsg : event.getSendcan()) {
+      auto it = address_priority.find(cmsg.getAddress());
+      const int priority = (it != address_priority.end()) ? it->second : SENDCAN_NORMAL;
+      pending.push_back({event_time, event_time + SENDCAN_MAX_AGE_NS[priority], priority, -1, cmsg});
+    }
+  }
+
+  void clear() {
+    pending.clear();
+  }
+
+  // sends the queued frames, all those of a panda together so they take as few transfers as possible
+  void send(const std::vector<Panda *> &pandas) {
+    // stable, so the frames of an address keep their order
+    std::stable_sort(pending.begin(), pending.end(), [](const PendingFrame &a, const PendingFrame &b) {
+      return a.priority != b.priority ? a.priority < b.priority : a.deadline < b.deadline;
+    });
+
+    panda_can_data.resize(pandas.size());
+    for (auto &can_data : panda_can_data) {
+      can_data.clear();
+    }
+    const uint64_t cur_time = nanos_since_boot();
+    for (auto &frame : pending) {
+      if (cur_time > frame.deadline) {
+        stats[frame.priority].dropped++;
+        continue;
+      }
+      const uint8_t bus = frame.can_data.getSrc();
+      for (int i = 0; i < pandas.size(); i++) {
+        if (bus >= pandas[i]->bus_offset && bus < pandas[i]->bus_offset + PANDA_BUS_CNT) {
+          panda_can_data[i].push_back(frame.can_data);
+          frame.panda = i;
+          break;
+        }
+      }
+    }
+
+    panda_sent_time.resize(pandas.size());
+    for (int i = 0; i < pandas.size(); i++) {
+      if (!panda_can_data[i].empty()) {
+        pandas[i]->can_send(panda_can_data[i]);
+        panda_sent_time[i] = nanos_since_boot();
+      }
+    }
+
+    for (const auto &frame : pending) {
+      if (frame.panda >= 0) {
+        auto &st = stats[frame.priority];
+        const double latency_ms = (panda_sent_time[frame.panda] - frame.event_time) / 1e6;
+        st.frames++;
+        st.latency_sum_ms += latency_ms;
+        st.latency_max_ms = std::max(st.latency_max_ms, latency_ms);
+      }
+    }
+    pending.clear();
+  }
+
+  // queueing latency from sendcan to the panda, per priority since the last call
+  void log_stats() {
+    for (int i = 0; i < SENDCAN_PRIORITY_CNT; i++) {
+      auto &st = stats[i];
+      if (st.frames > 0 || st.dropped > 0) {
+        LOG("sendcan %s priority: %lu frames, %lu dropped, latency mean %.2f ms max %.2f ms", SENDCAN_PRIORITY_NAMES[i],
+            st.frames, st.dropped, st.frames > 0 ? st.latency_sum_ms / st.frames : 0., st.latency_max_ms);
+      }
+      st = {};
+    }
+  }
+
+private:
+  struct PendingFrame {
+    uint64_t event_time;
+    uint64_t deadline;
+    int priority;
+    int panda;
+    cereal::CanData::Reader can_data;
+  };
+  struct SendcanStats {
+    uint64_t frames;
+    uint64_t dropped;
+    double latency_sum_ms;
+    double latency_max_ms;
+  };
+
+  std::unordered_map<uint32_t, int> address_priority;
+  std::vector<PendingFrame> pending;
+  std::vector<std::vector<cereal::CanData::Reader>> panda_can_data;
+  std::vector<uint64_t> panda_sent_time;
+  SendcanStats stats[SENDCAN_PRIORITY_CNT] = {};
+};
+
 void can_send_thread(std::vector<Panda *> pandas, bool fake_send) {
   util::set_thread_name("boardd_can_send");
 
-  AlignedBuffer aligned_buf;
   std::unique_ptr<Context> context(Context::create());
   std::unique_ptr<SubSocket> subscriber(SubSocket::create(context.get(), "sendcan"));
   assert(subscriber != NULL);
   subscriber->setTimeout(100);
 
+  Params params;
+  std::string car_params;
+  uint64_t next_params_check = 0;
+  uint64_t next_stats_log = nanos_since_boot() + SENDCAN_STATS_INTERVAL_NS;
+
+  SendcanScheduler scheduler;
+  // the events received together are sent together, aligned until then
+  std::vector<AlignedBuffer> aligned_bufs(SENDCAN_MAX_BURST);
+  std::vector<std::unique_ptr<capnp::FlatArrayMessageReader>> readers;
+
   // run as fast as messages come in
   while (!do_exit && check_all_connected(pandas)) {
+    const uint64_t cur_time = nanos_since_boot();
+    if (cur_time >= next_params_check) {
+      // the car port's send priorities, once controlsd has written CarParams
+      std::string value = params.get("CarParams");
+      if (value != car_params) {
+        car_params = value;
+        if (car_params.empty()) {
+          scheduler.set_priorities({});
+        } else {
+          AlignedBuffer aligned_buf;
+          capnp::FlatArrayMessageReader cmsg(aligned_buf.align(car_params.data(), car_params.size()));
+          scheduler.set_priorities(cmsg.getRoot<cereal::CarParams>().getCanSendPriorities());
+        }
+      }
+      next_params_check = cur_time + SENDCAN_PARAMS_INTERVAL_NS;
+    }
+    if (cur_time >= next_stats_log) {
+      scheduler.log_stats();
+      next_stats_log = cur_time + SENDCAN_STATS_INTERVAL_NS;
+    }
+
     std::unique_ptr<Message> msg(subscriber->receive());
     if (!msg) {
       if (errno == EINTR) {
@@ -223,47 +376,162 @@ void can_send_thread(std::vector<Panda *> pandas, bool fake_send) {
       continue;
     }
 
-    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg.get()));
-    cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+    readers.clear();
+    for (int n = 0; msg; msg.reset(++n < SENDCAN_MAX_BURST ? subscriber->receive(true) : nullptr)) {
+      readers.push_back(std::make_unique<capnp::FlatArrayMessageReader>(aligned_bufs[n].align(msg.get())));
+      scheduler.add(readers.back()->getRoot<cereal::Event>());
+    }
+
+    if (fake_send) {
+      scheduler.clear();
+    } else {
+      scheduler.send(pandas);
+    }
+  }
+}
+
+static void publish_can(PubMaster &pm, const std::vector<Panda *> &pandas, bool comms_healthy) {
+  // the frames go from the receive buffers straight into the message
+  size_t num_frames = 0;
+  for (const auto& panda : pandas) {
+    num_frames += panda->count_can_frames();
+  }
+
+  MessageBuilder msg;
+  auto evt = msg.initEvent();
+  evt.setValid(comms_healthy);
+  auto canData = evt.initCan(num_frames);
 
-    //Dont send if older than 1 second
-    if ((nanos_since_boot() - event.getLogMonoTime() < 1e9) && !fake_send) {
-      for (const auto& panda : pandas) {
-        panda->can_send(event.getSendcan());
+  // merge the reads of all pandas in the order they were received
+  size_t i = 0;
+  while (true) {
+    Panda *next_panda = nullptr;
+    uint64_t next_time = UINT64_MAX;
+    for (const auto& panda : pandas) {
+      const uint64_t t = panda->next_can_frames_time();
+      if (t < next_time) {
+        next_panda = panda;
+        next_time = t;
       }
     }
+    if (next_panda == nullptr) break;
+    i = next_panda->fill_can_frames(canData, i);
   }
+  pm.send("can", msg);
 }
 
-void can_recv_thread(std::vector<Panda *> pandas) {
-  util::set_thread_name("boardd_can_recv");
+// reads every panda on its own thread, so the usb reads run concurrently
+// and a slow panda doesn't hold up the buses of the others
+class CanReaders {
+public:
+  CanReaders(const std::vector<Panda *> &pandas, bool async_recv) : done_rounds(pandas.size(), 0) {
+    for (int i = 0; i < pandas.size(); i++) {
+      if (async_recv) {
+        threads.emplace_back(&CanReaders::async_reader, this, pandas[i]);
+      } else {
+        threads.emplace_back(&CanReaders::poll_reader, this, pandas[i], i);
+      }
+    }
+  }
 
-  // can = 8006
-  PubMaster pm({"can"});
+  ~CanReaders() {
+    {
+      std::lock_guard lk(lock);
+      running = false;
+    }
+    cv.notify_all();
+    for (auto &t : threads) t.join();
+  }
 
+  // every panda reads once. waits until all reads are done, or until the deadline
+  void read_all(uint64_t deadline) {
+    std::unique_lock lk(lock);
+    const uint64_t target = ++round;
+    cv.notify_all();
+    while (std::any_of(done_rounds.begin(), done_rounds.end(), [=](uint64_t r) { return r < target; })) {
+      const uint64_t cur_time = nanos_since_boot();
+      if (cur_time >= deadline) break;
+      cv.wait_for(lk, std::chrono::nanoseconds(deadline - cur_time));
+    }
+  }
+
+  // waits until coalesce_ns after the first frames since the last call arrived, or until the deadline
+  void wait_frames(uint64_t deadline, uint64_t coalesce_ns) {
+    std::unique_lock lk(lock);
+    while (true) {
+      const uint64_t publish_time = first_frame_time ? std::min(deadline, first_frame_time + coalesce_ns) : deadline;
+      const uint64_t cur_time = nanos_since_boot();
+      if (cur_time >= publish_time) break;
+      cv.wait_for(lk, std::chrono::nanoseconds(publish_time - cur_time));
+    }
+    first_frame_time = 0;
+  }
+
+  // whether the reads since the last call were all healthy
+  bool take_comms_healthy() {
+    std::lock_guard lk(lock);
+    const bool ret = comms_healthy;
+    comms_healthy = true;
+    return ret;
+  }
+
+private:
+  void poll_reader(Panda *panda, int i) {
+    util::set_thread_name("boardd_can_read");
+    std::unique_lock lk(lock);
+    while (true) {
+      cv.wait(lk, [&]() { return !running || round > done_rounds[i]; });
+      if (!running) break;
+
+      const uint64_t target = round;
+      lk.unlock();
+      const bool healthy = panda->can_receive();
+      lk.lock();
+      comms_healthy &= healthy;
+      done_rounds[i] = target;
+      cv.notify_all();
+    }
+  }
+
+  void async_reader(Panda *panda) {
+    util::set_thread_name("boardd_can_read");
+    while (true) {
+      {
+        std::lock_guard lk(lock);
+        if (!running) break;
+      }
+      // wake up now and then to check running
+      const bool healthy = panda->can_receive_async(10000);
+
+      std::lock_guard lk(lock);
+      comms_healthy &= healthy;
+      if (first_frame_time == 0 && panda->has_can_frames()) {
+        first_frame_time = nanos_since_boot();
+        cv.notify_all();
+      }
+    }
+  }
+
+  std::mutex lock;
+  std::condition_variable cv;
+  bool running = true;
+  bool comms_healthy = true;
+  uint64_t round = 0;
+  std::vector<uint64_t> done_rounds;
+  uint64_t first_frame_time = 0; // 0 while no frames are waiting
+  std::vector<std::thread> threads;
+};
+
+static void can_recv_poll(PubMaster &pm, const std::vector<Panda *> &pandas) {
   // run at 100hz
   const uint64_t dt = 10000000ULL;
   uint64_t next_frame_time = nanos_since_boot() + dt;
-  std::vector<can_frame> raw_can_data;
+  CanReaders readers(pandas, false);
 
   while (!do_exit && check_all_connected(pandas)) {
-    bool comms_healthy = true;
-    raw_can_data.clear();
-    for (const auto& panda : pandas) {
-      comms_healthy &= panda->can_receive(raw_can_data);
-    }
-
-    MessageBuilder msg;
-    auto evt = msg.initEvent();
-    evt.setValid(comms_healthy);
-    auto canData = evt.initCan(raw_can_data.size());
-    for (uint i = 0; i<raw_can_data.size(); i++) {
-      canData[i].setAddress(raw_can_data[i].address);
-      canData[i].setBusTime(raw_can_data[i].busTime);
-      canData[i].setDat(kj::arrayPtr((uint8_t*)raw_can_data[i].dat.data(), raw_can_data[i].dat.size()));
-      canData[i].setSrc(raw_can_data[i].src);
-    }
-    pm.send("can", msg);
+    // a panda that takes longer than half a cycle to read is published with the next one
+    readers.read_all(nanos_since_boot() + dt / 2);
+    publish_can(pm, pandas, readers.take_comms_healthy());
 
     uint64_t cur_time = nanos_since_boot();
     int64_t remaining = next_frame_time - cur_time;
@@ -280,6 +548,33 @@ void can_recv_thread(std::vector<Panda *> pandas) {
   }
 }
 
+static void can_recv_async(PubMaster &pm, const std::vector<Panda *> &pandas, uint64_t coalesce_us) {
+  // publish as soon as frames arrive, frames within coalesce_us of the first unpublished
+  // one go out together. without traffic, still publish at 100hz
+  const uint64_t dt = 10000000ULL;
+  uint64_t last_publish_time = nanos_since_boot();
+  CanReaders readers(pandas, true);
+
+  while (!do_exit && check_all_connected(pandas)) {
+    readers.wait_frames(last_publish_time + dt, coalesce_us * 1000);
+    last_publish_time = nanos_since_boot();
+    publish_can(pm, pandas, readers.take_comms_healthy());
+  }
+}
+
+void can_recv_thread(std::vector<Panda *> pandas, bool async_recv, uint64_t coalesce_us) {
+  util::set_thread_name("boardd_can_recv");
+
+  // can = 8006
+  PubMaster pm({"can"});
+
+  if (async_recv) {
+    can_recv_async(pm, pandas, coalesce_us);
+  } else {
+    can_recv_poll(pm, pandas);
+  }
+}
+
 void send_empty_peripheral_state(PubMaster *pm) {
   MessageBuilder msg;
   auto peripheralState  = msg.initEvent().initPeripheralState();
@@ -604,8 +899,8 @@ void pigeon_thread(Panda *panda) {
 
     ignition_last = ignition_local;
 
-    // 10ms - 100 Hz
-    util::sleep_for(10);
+    // wake up as soon as the next message starts coming in
+    pigeon->wait_for_data(100);
   }
 }
 
@@ -643,7 +938,11 @@ void boardd_main_thread(std::vector<std::string> serials) {
     threads.emplace_back(pigeon_thread, peripheral_panda);
 
     threads.emplace_back(can_send_thread, pandas, getenv("FAKESEND") != nullptr);
-    threads.emplace_back(can_recv_thread, pandas);
+    // BOARDD_ASYNC_RECV publishes CAN as it arrives instead of at a fixed 100hz, coalesced over
+    // BOARDD_RECV_COALESCE_US (default 10ms) so can-driven consumers like controlsd keep their rate
+    const char *coalesce_us = getenv("BOARDD_RECV_COALESCE_US");
+    threads.emplace_back(can_recv_thread, pandas, getenv("BOARDD_ASYNC_RECV") != nullptr,
+                         coalesce_us ? std::strtoull(coalesce_us, nullptr, 10) : 10000ULL);
 
     for (auto &t : threads) t.join();
   }
@@ -4,3 +4,5 @@
 
 bool safety_setter_thread(std::vector<Panda *> pandas);
 void boardd_main_thread(std::vector<std::string> serials);
+void can_send_thread(std::vector<Panda *> pandas, bool fake_send);
+void can_recv_thread(std::vector<Panda *> pandas, bool async_recv, uint64_t coalesce_us);
@@ -4,23 +4,31 @@ from libcpp.vector cimport vector
 from libcpp.string cimport string
 from libcpp cimport bool
 
-cdef struct can_frame:
+cdef struct can_frame_ref:
   long address
-  string dat
+  const char *dat
+  size_t dat_len
   long busTime
   long src
 
-cdef extern void can_list_to_can_capnp_cpp(const vector[can_frame] &can_list, string &out, bool sendCan, bool valid)
+cdef extern void can_list_to_can_capnp_cpp(const vector[can_frame_ref] &can_list, string &out, bool sendCan, bool valid)
 
 def can_list_to_can_capnp(can_msgs, msgtype='can', valid=True):
-  cdef vector[can_frame] can_list
+  cdef vector[can_frame_ref] can_list
   can_list.reserve(len(can_msgs))
 
-  cdef can_frame f
+  # the payloads are read in place, can_msgs keeps them alive until the message is built
+  cdef can_frame_ref f
+  converted = []
   for can_msg in can_msgs:
+    dat = can_msg[2]
+    if not isinstance(dat, bytes):
+      dat = bytes(dat)
+      converted.append(dat)
     f.address = can_msg[0]
     f.busTime = can_msg[1]
-    f.dat = can_msg[2]
+    f.dat = dat
+    f.dat_len = len(dat)
     f.src = can_msg[3]
     can_list.push_back(f)
   cdef string out
@@ -1,9 +1,17 @@
 #include "cereal/messaging/messaging.h"
-#include "panda.h"
+
+// a frame of a python can list, dat points into its bytes object
+struct can_frame_ref {
+  long address;
+  const char *dat;
+  size_t dat_len;
+  long busTime;
+  long src;
+};
 
 extern "C" {
 
-void can_list_to_can_capnp_cpp(const std::vector<can_frame> &can_list, std::string &out, bool sendCan, bool valid) {
+void can_list_to_can_capnp_cpp(const std::vector<can_frame_ref> &can_list, std::string &out, bool sendCan, bool valid) {
   MessageBuilder msg;
   auto event = msg.initEvent(valid);
 
@@ -13,7 +21,7 @@ void can_list_to_can_capnp_cpp(const std::vector<can_frame> &can_list, std::stri
     auto c = canData[j];
     c.setAddress(it->address);
     c.setBusTime(it->busTime);
-    c.setDat(kj::arrayPtr((uint8_t*)it->dat.data(), it->dat.size()));
+    c.setDat(kj::arrayPtr((uint8_t*)it->dat, it->dat_len));
     c.setSrc(it->src);
   }
   const uint64_t msg_size = capnp::computeSerializedSizeInWords(msg) * sizeof(capnp::word);
@@ -10,143 +10,27 @@
 #include "panda/board/dlc_to_len.h"
 #include "selfdrive/common/gpio.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 
-static int init_usb_ctx(libusb_context **context) {
-  assert(context != nullptr);
-
-  int err = libusb_init(context);
-  if (err != 0) {
-    LOGE("libusb initialization error");
-    return err;
-  }
-
-#if LIBUSB_API_VERSION >= 0x01000106
-  libusb_set_option(*context, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_INFO);
-#else
-  libusb_set_debug(*context, 3);
-#endif
-
-  return err;
-}
-
-
-Panda::Panda(std::string serial, uint32_t bus_offset) : bus_offset(bus_offset) {
-  // init libusb
-  ssize_t num_devices;
-  libusb_device **dev_list = NULL;
-  int err = init_usb_ctx(&ctx);
-  if (err != 0) { goto fail; }
-
-  // connect by serial
-  num_devices = libusb_get_device_list(ctx, &dev_list);
-  if (num_devices < 0) { goto fail; }
-  for (size_t i = 0; i < num_devices; ++i) {
-    libusb_device_descriptor desc;
-    libusb_get_device_descriptor(dev_list[i], &desc);
-    if (desc.idVendor == 0xbbaa && desc.idProduct == 0xddcc) {
-      int ret = libusb_open(dev_list[i], &dev_handle);
-      if (dev_handle == NULL || ret < 0) { goto fail; }
-
-      unsigned char desc_serial[26] = { 0 };
-      ret = libusb_get_string_descriptor_ascii(dev_handle, desc.iSerialNumber, desc_serial, std::size(desc_serial));
-      if (ret < 0) { goto fail; }
-
-      usb_serial = std::string((char *)desc_serial, ret).c_str();
-      if (serial.empty() || serial == usb_serial) {
-        break;
-      }
-      libusb_close(dev_handle);
-      dev_handle = NULL;
-    }
-  }
-  if (dev_handle == NULL) goto fail;
-  libusb_free_device_list(dev_list, 1);
-  dev_list = nullptr;
-
-  if (libusb_kernel_driver_active(dev_handle, 0) == 1) {
-    libusb_detach_kernel_driver(dev_handle, 0);
-  }
-
-  err = libusb_set_configuration(dev_handle, 1);
-  if (err != 0) { goto fail; }
-
-  err = libusb_claim_interface(dev_handle, 0);
-  if (err != 0) { goto fail; }
+Panda::Panda(std::string serial, uint32_t bus_offset) : Panda(std::make_unique<UsbTransport>(serial), bus_offset) {}
 
+Panda::Panda(std::unique_ptr<PandaTransport> transport, uint32_t bus_offset) : transport(std::move(transport)), bus_offset(bus_offset) {
+  usb_serial = this->transport->serial();
   hw_type = get_hw_type();
 
   has_rtc = (hw_type == cereal::PandaState::PandaType::UNO) ||
             (hw_type == cereal::PandaState::PandaType::DOS);
-
-  return;
-
-fail:
-  if (dev_list != NULL) {
-    libusb_free_device_list(dev_list, 1);
-  }
-  cleanup();
-  throw std::runtime_error("Error connecting to panda");
 }
 
 Panda::~Panda() {
   std::lock_guard lk(usb_lock);
-  cleanup();
+  transport.reset();
   connected = false;
 }
 
-void Panda::cleanup() {
-  if (dev_handle) {
-    libusb_release_interface(dev_handle, 0);
-    libusb_close(dev_handle);
-  }
-
-  if (ctx) {
-    libusb_exit(ctx);
-  }
-}
-
 std::vector<std::string> Panda::list() {
-  // init libusb
-  ssize_t num_devices;
-  libusb_context *context = NULL;
-  libusb_device **dev_list = NULL;
-  std::vector<std::string> serials;
-
-  int err = init_usb_ctx(&context);
-  if (err != 0) { return serials; }
-
-  num_devices = libusb_get_device_list(context, &dev_list);
-  if (num_devices < 0) {
-    LOGE("libusb can't get device list");
-    goto finish;
-  }
-  for (size_t i = 0; i < num_devices; ++i) {
-    libusb_device *device = dev_list[i];
-    libusb_device_descriptor desc;
-    libusb_get_device_descriptor(device, &desc);
-    if (desc.idVendor == 0xbbaa && desc.idProduct == 0xddcc) {
-      libusb_device_handle *handle = NULL;
-      int ret = libusb_open(device, &handle);
-      if (ret < 0) { goto finish; }
-
-      unsigned char desc_serial[26] = { 0 };
-      ret = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, desc_serial, std::size(desc_serial));
-      libusb_close(handle);
-      if (ret < 0) { goto finish; }
-
-      serials.push_back(std::string((char *)desc_serial, ret).c_str());
-    }
-  }
-
-finish:
-  if (dev_list != NULL) {
-    libusb_free_device_list(dev_list, 1);
-  }
-  if (context) {
-    libusb_exit(context);
-  }
-  return serials;
+  return UsbTransport::list();
 }
 
 void Panda::handle_usb_issue(int err, const char func[]) {
@@ -168,7 +52,7 @@ int Panda::usb_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigne
 
   std::lock_guard lk(usb_lock);
   do {
-    err = libusb_control_transfer(dev_handle, bmRequestType, bRequest, wValue, wIndex, NULL, 0, timeout);
+    err = transport->control_transfer(bmRequestType, bRequest, wValue, wIndex, NULL, 0, timeout);
     if (err < 0) handle_usb_issue(err, __func__);
   } while (err < 0 && connected);
 
@@ -185,7 +69,7 @@ int Panda::usb_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned
 
   std::lock_guard lk(usb_lock);
   do {
-    err = libusb_control_transfer(dev_handle, bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
+    err = transport->control_transfer(bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
     if (err < 0) handle_usb_issue(err, __func__);
   } while (err < 0 && connected);
 
@@ -204,7 +88,7 @@ int Panda::usb_bulk_write(unsigned char endpoint, unsigned char* data, int lengt
   do {
     // Try sending can messages. If the receive buffer on the panda is full it will NAK
     // and libusb will try again. After 5ms, it will time out. We will drop the messages.
-    err = libusb_bulk_transfer(dev_handle, endpoint, data, length, &transferred, timeout);
+    err = transport->bulk_transfer(endpoint, data, length, &transferred, timeout);
 
     if (err == LIBUSB_ERROR_TIMEOUT) {
       LOGW("Transmit buffer full");
@@ -228,7 +112,7 @@ int Panda::usb_bulk_read(unsigned char endpoint, unsigned char* data, int length
   std::lock_guard lk(usb_lock);
 
   do {
-    err = libusb_bulk_transfer(dev_handle, endpoint, data, length, &transferred, timeout);
+    err = transport->bulk_transfer(endpoint, data, length, &transferred, timeout);
 
     if (err == LIBUSB_ERROR_TIMEOUT) {
       break; // timeout is okay to exit, recv still happened
@@ -373,7 +257,8 @@ static void write_packet(uint8_t *dest, int *write_pos, const uint8_t *src, size
   }
 }
 
-void Panda::pack_can_buffer(const capnp::List<cereal::CanData>::Reader &can_data_list,
+template <class CanDataList>
+void Panda::pack_can_buffer(const CanDataList &can_data_list,
                             std::function<void(uint8_t *, size_t)> write_func) {
   int32_t pos = 0;
   uint8_t send_buf[2 * USB_TX_SOFT_LIMIT];
@@ -407,13 +292,22 @@ void Panda::pack_can_buffer(const capnp::List<cereal::CanData>::Reader &can_data
   if (pos > 0) write_func(send_buf, pos);
 }
 
+template void Panda::pack_can_buffer(const capnp::List<cereal::CanData>::Reader &, std::function<void(uint8_t *, size_t)>);
+template void Panda::pack_can_buffer(const std::vector<cereal::CanData::Reader> &, std::function<void(uint8_t *, size_t)>);
+
 void Panda::can_send(capnp::List<cereal::CanData>::Reader can_data_list) {
   pack_can_buffer(can_data_list, [=](uint8_t* data, size_t size) {
     usb_bulk_write(3, data, size, 5);
   });
 }
 
-bool Panda::can_receive(std::vector<can_frame>& out_vec) {
+void Panda::can_send(const std::vector<cereal::CanData::Reader> &can_data) {
+  pack_can_buffer(can_data, [=](uint8_t* data, size_t size) {
+    usb_bulk_write(3, data, size, 5);
+  });
+}
+
+bool Panda::can_receive() {
   uint8_t data[RECV_SIZE];
   int recv = usb_bulk_read(0x81, (uint8_t*)data, RECV_SIZE);
   if (!comms_healthy) {
@@ -423,23 +317,115 @@ bool Panda::can_receive(std::vector<can_frame>& out_vec) {
     LOGW("Panda receive buffer full");
   }
 
-  return (recv <= 0) ? true : unpack_can_buffer(data, recv, out_vec);
+  return (recv <= 0) ? true : append_can_buffer(data, recv);
 }
 
-bool Panda::unpack_can_buffer(uint8_t *data, int size, std::vector<can_frame> &out_vec) {
-  recv_buf.clear();
+bool Panda::can_receive_async(uint64_t timeout_us) {
+  if (!connected) {
+    return false;
+  }
+
+  int err = transport->bulk_read_async(0x81, timeout_us, [this](const uint8_t *data, int size) {
+    if (size == RECV_SIZE) {
+      LOGW("Panda receive buffer full");
+    }
+    append_can_buffer(data, size);
+  });
+  if (err == LIBUSB_ERROR_OVERFLOW) {
+    comms_healthy = false;
+  } else if (err != 0) {
+    handle_usb_issue(err, __func__);
+  }
+  return comms_healthy;
+}
+
+bool Panda::append_can_buffer(const uint8_t *data, int size) {
+  std::lock_guard lk(recv_buf_lock);
+  const size_t prev_size = recv_buf.size();
   for (int i = 0; i < size; i += USBPACKET_MAX_SIZE) {
     if (data[i] != i / USBPACKET_MAX_SIZE) {
       LOGE("CAN: MALFORMED USB RECV PACKET");
       comms_healthy = false;
+      recv_buf.resize(prev_size);
       return false;
     }
     int chunk_len = std::min(USBPACKET_MAX_SIZE, (size - i));
     recv_buf.insert(recv_buf.end(), &data[i + 1], &data[i + chunk_len]);
   }
+  recv_reads.push_back({nanos_since_boot(), recv_buf.size()});
+  return true;
+}
+
+// size of the frame at pos, 0 if its tail is still to come in the next read
+static inline size_t can_frame_size(const std::vector<uint8_t> &buf, size_t pos) {
+  if (pos + CANPACKET_HEAD_SIZE > buf.size()) return 0;
+
+  can_header header;
+  memcpy(&header, &buf[pos], CANPACKET_HEAD_SIZE);
+  const size_t size = CANPACKET_HEAD_SIZE + dlc_to_len[header.data_len_code];
+  return (pos + size <= buf.size()) ? size : 0;
+}
+
+bool Panda::has_can_frames() const {
+  std::lock_guard lk(recv_buf_lock);
+  return can_frame_size(recv_buf, 0) > 0;
+}
+
+size_t Panda::count_can_frames() {
+  std::lock_guard lk(recv_buf_lock);
+  size_t count = 0, pos = 0;
+  for (size_t size; (size = can_frame_size(recv_buf, pos)) > 0; pos += size) {
+    ++count;
+  }
+  recv_counted_end = pos;
+  return count;
+}
+
+uint64_t Panda::next_can_frames_time() const {
+  std::lock_guard lk(recv_buf_lock);
+  return (recv_counted_end > 0 && !recv_reads.empty()) ? recv_reads.front().first : UINT64_MAX;
+}
 
-  int pos = 0;
-  while (pos < recv_buf.size()) {
+size_t Panda::fill_can_frames(capnp::List<cereal::CanData>::Builder list, size_t i) {
+  std::lock_guard lk(recv_buf_lock);
+  if (recv_counted_end == 0 || recv_reads.empty()) return i;
+
+  // the counted frames that were completed by the oldest read
+  const size_t end = std::min(recv_reads.front().second, recv_counted_end);
+  size_t pos = 0;
+  for (size_t size; (size = can_frame_size(recv_buf, pos)) > 0 && pos + size <= end; pos += size) {
+    can_header header;
+    memcpy(&header, &recv_buf[pos], CANPACKET_HEAD_SIZE);
+
+    long src = header.bus + bus_offset;
+    if (header.rejected) { src += CANPACKET_REJECTED; }
+    if (header.returned) { src += CANPACKET_RETURNED; }
+
+    auto canData = list[i++];
+    canData.setAddress(header.addr);
+    canData.setBusTime(0);
+    canData.setDat(kj::arrayPtr(&recv_buf[pos + CANPACKET_HEAD_SIZE], size - CANPACKET_HEAD_SIZE));
+    canData.setSrc(src);
+  }
+
+  // a frame that continues past the read is written out with the next one
+  recv_reads.erase(recv_reads.begin());
+  recv_buf.erase(recv_buf.begin(), recv_buf.begin() + pos);
+  for (auto &read : recv_reads) {
+    read.second -= pos;
+  }
+  recv_counted_end -= pos;
+  return i;
+}
+
+bool Panda::unpack_can_buffer(uint8_t *data, int size, std::vector<can_frame> &out_vec) {
+  recv_buf.clear();
+  recv_reads.clear();
+  if (!append_can_buffer(data, size)) {
+    return false;
+  }
+
+  for (size_t pos = 0, frame_size; (frame_size = can_frame_size(recv_buf, pos)) > 0; pos += frame_size) {
     can_header header;
     memcpy(&header, &recv_buf[pos], CANPACKET_HEAD_SIZE);
 
@@ -449,11 +435,9 @@ bool Panda::unpack_can_buffer(uint8_t *data, int size, std::vector<can_frame> &o
     canData.src = header.bus + bus_offset;
     if (header.rejected) { canData.src += CANPACKET_REJECTED; }
     if (header.returned) { canData.src += CANPACKET_RETURNED; }
-
-    const uint8_t data_len = dlc_to_len[header.data_len_code];
-    canData.dat.assign((char *)&recv_buf[pos + CANPACKET_HEAD_SIZE], data_len);
-
-    pos += CANPACKET_HEAD_SIZE + data_len;
+    canData.dat.assign((char *)&recv_buf[pos + CANPACKET_HEAD_SIZE], frame_size - CANPACKET_HEAD_SIZE);
   }
+  recv_buf.clear();
+  recv_reads.clear();
   return true;
 }
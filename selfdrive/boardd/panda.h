@@ -5,19 +5,18 @@
 #include <ctime>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <vector>
 
-#include <libusb-1.0/libusb.h>
-
 #include "cereal/gen/cpp/car.capnp.h"
 #include "cereal/gen/cpp/log.capnp.h"
 #include "panda/board/health.h"
+#include "selfdrive/boardd/panda_transport.h"
 
 #define TIMEOUT 0
 #define PANDA_BUS_CNT 4
-#define RECV_SIZE (0x4000U)
 #define USB_TX_SOFT_LIMIT   (0x100U)
 #define USBPACKET_MAX_SIZE  (0x40)
 #define CANPACKET_HEAD_SIZE 5U
@@ -44,15 +43,19 @@ struct can_frame {
 
 class Panda {
  private:
-  libusb_context *ctx = NULL;
-  libusb_device_handle *dev_handle = NULL;
+  std::unique_ptr<PandaTransport> transport;
   std::mutex usb_lock;
+  // received frames without the usb packet counters, and the receive time and end of each read.
+  // the reads may come from another thread than the one writing them out
+  mutable std::mutex recv_buf_lock;
   std::vector<uint8_t> recv_buf;
+  std::vector<std::pair<uint64_t, size_t>> recv_reads;
+  size_t recv_counted_end = 0;
   void handle_usb_issue(int err, const char func[]);
-  void cleanup();
 
  public:
   Panda(std::string serial="", uint32_t bus_offset=0);
+  Panda(std::unique_ptr<PandaTransport> transport, uint32_t bus_offset=0);
   ~Panda();
 
   std::string usb_serial;
@@ -90,12 +93,27 @@ class Panda {
   void set_can_speed_kbps(uint16_t bus, uint16_t speed);
   void set_data_speed_kbps(uint16_t bus, uint16_t speed);
   void can_send(capnp::List<cereal::CanData>::Reader can_data_list);
-  bool can_receive(std::vector<can_frame>& out_vec);
+  // frames already split by panda
+  void can_send(const std::vector<cereal::CanData::Reader> &can_data);
+  bool can_receive();
+  // event driven receive, keeps ASYNC_RECV_TRANSFERS bulk reads in flight and returns as soon as
+  // one of them brings frames, or after timeout_us. don't mix with can_receive on the same panda
+  bool can_receive_async(uint64_t timeout_us);
+  bool has_can_frames() const;
+  // the frames received are kept packed until they're written out, in two passes: count, then fill.
+  // count takes a snapshot of the frames received so far, fill writes those of the oldest read
+  // to list starting at index i, and returns the index after the last one.
+  // reads come out in order, next_can_frames_time is the receive time of the next one, UINT64_MAX if none
+  size_t count_can_frames();
+  uint64_t next_can_frames_time() const;
+  size_t fill_can_frames(capnp::List<cereal::CanData>::Builder list, size_t i);
 
 protected:
   // for unit tests
   Panda(uint32_t bus_offset) : bus_offset(bus_offset) {}
-  void pack_can_buffer(const capnp::List<cereal::CanData>::Reader &can_data_list,
+  template <class CanDataList>
+  void pack_can_buffer(const CanDataList &can_data_list,
                          std::function<void(uint8_t *, size_t)> write_func);
+  bool append_can_buffer(const uint8_t *data, int size);
   bool unpack_can_buffer(uint8_t *data, int size, std::vector<can_frame> &out_vec);
 };
@@ -0,0 +1,294 @@
+#include "selfdrive/boardd/panda_transport.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+
+static int init_usb_ctx(libusb_context **context) {
+  assert(context != nullptr);
+
+  int err = libusb_init(context);
+  if (err != 0) {
+    LOGE("libusb initialization error");
+    return err;
+  }
+
+#if LIBUSB_API_VERSION >= 0x01000106
+  libusb_set_option(*context, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_INFO);
+#else
+  libusb_set_debug(*context, 3);
+#endif
+
+  return err;
+}
+
+
+UsbTransport::UsbTransport(std::string serial) {
+  // init libusb
+  ssize_t num_devices;
+  libusb_device **dev_list = NULL;
+  int err = init_usb_ctx(&ctx);
+  if (err != 0) { goto fail; }
+
+  // connect by serial
+  num_devices = libusb_get_device_list(ctx, &dev_list);
+  if (num_devices < 0) { goto fail; }
+  for (size_t i = 0; i < num_devices; ++i) {
+    libusb_device_descriptor desc;
+    libusb_get_device_descriptor(dev_list[i], &desc);
+    if (desc.idVendor == 0xbbaa && desc.idProduct == 0xddcc) {
+      int ret = libusb_open(dev_list[i], &dev_handle);
+      if (dev_handle == NULL || ret < 0) { goto fail; }
+
+      unsigned char desc_serial[26] = { 0 };
+      ret = libusb_get_string_descriptor_ascii(dev_handle, desc.iSerialNumber, desc_serial, std::size(desc_serial));
+      if (ret < 0) { goto fail; }
+
+      usb_serial = std::string((char *)desc_serial, ret).c_str();
+      if (serial.empty() || serial == usb_serial) {
+        break;
+      }
+      libusb_close(dev_handle);
+      dev_handle = NULL;
+    }
+  }
+  if (dev_handle == NULL) goto fail;
+  libusb_free_device_list(dev_list, 1);
+  dev_list = nullptr;
+
+  if (libusb_kernel_driver_active(dev_handle, 0) == 1) {
+    libusb_detach_kernel_driver(dev_handle, 0);
+  }
+
+  err = libusb_set_configuration(dev_handle, 1);
+  if (err != 0) { goto fail; }
+
+  err = libusb_claim_interface(dev_handle, 0);
+  if (err != 0) { goto fail; }
+
+  return;
+
+fail:
+  if (dev_list != NULL) {
+    libusb_free_device_list(dev_list, 1);
+  }
+  cleanup();
+  throw std::runtime_error("Error connecting to panda");
+}
+
+UsbTransport::~UsbTransport() {
+  cleanup();
+}
+
+void UsbTransport::cleanup() {
+  stop_async_recv();
+
+  if (dev_handle) {
+    libusb_release_interface(dev_handle, 0);
+    libusb_close(dev_handle);
+  }
+
+  if (ctx) {
+    libusb_exit(ctx);
+  }
+}
+
+std::vector<std::string> UsbTransport::list() {
+  // init libusb
+  ssize_t num_devices;
+  libusb_context *context = NULL;
+  libusb_device **dev_list = NULL;
+  std::vector<std::string> serials;
+
+  int err = init_usb_ctx(&context);
+  if (err != 0) { return serials; }
+
+  num_devices = libusb_get_device_list(context, &dev_list);
+  if (num_devices < 0) {
+    LOGE("libusb can't get device list");
+    goto finish;
+  }
+  for (size_t i = 0; i < num_devices; ++i) {
+    libusb_device *device = dev_list[i];
+    libusb_device_descriptor desc;
+    libusb_get_device_descriptor(device, &desc);
+    if (desc.idVendor == 0xbbaa && desc.idProduct == 0xddcc) {
+      libusb_device_handle *handle = NULL;
+      int ret = libusb_open(device, &handle);
+      if (ret < 0) { goto finish; }
+
+      unsigned char desc_serial[26] = { 0 };
+      ret = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, desc_serial, std::size(desc_serial));
+      libusb_close(handle);
+      if (ret < 0) { goto finish; }
+
+      serials.push_back(std::string((char *)desc_serial, ret).c_str());
+    }
+  }
+
+finish:
+  if (dev_list != NULL) {
+    libusb_free_device_list(dev_list, 1);
+  }
+  if (context) {
+    libusb_exit(context);
+  }
+  return serials;
+}
+
+int UsbTransport::control_transfer(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                                   unsigned char *data, uint16_t wLength, unsigned int timeout) {
+  return libusb_control_transfer(dev_handle, bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
+}
+
+int UsbTransport::bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) {
+  return libusb_bulk_transfer(dev_handle, endpoint, data, length, transferred, timeout);
+}
+
+void LIBUSB_CALL UsbTransport::recv_transfer_callback(libusb_transfer *transfer) {
+  UsbTransport *usb = (UsbTransport *)transfer->user_data;
+  std::lock_guard lk(usb->recv_transfers_lock);
+  usb->recv_transfers_in_flight--;
+  usb->completed_recv_transfers.push_back(transfer);
+}
+
+int UsbTransport::submit_recv_transfer(libusb_transfer *transfer) {
+  {
+    std::lock_guard lk(recv_transfers_lock);
+    recv_transfers_in_flight++;
+  }
+  int err = libusb_submit_transfer(transfer);
+  if (err != 0) {
+    {
+      std::lock_guard lk(recv_transfers_lock);
+      recv_transfers_in_flight--;
+    }
+    // try again after the idle interval
+    idle_recv_transfers.push_back({transfer, nanos_since_boot() + ASYNC_RECV_IDLE_POLL_US * 1000});
+  }
+  return err;
+}
+
+bool UsbTransport::start_async_recv(unsigned char endpoint) {
+  recv_transfer_bufs.resize(ASYNC_RECV_TRANSFERS * RECV_SIZE);
+  completed_recv_transfers.reserve(ASYNC_RECV_TRANSFERS);
+  completed_recv_scratch.reserve(ASYNC_RECV_TRANSFERS);
+  idle_recv_transfers.reserve(ASYNC_RECV_TRANSFERS);
+  for (int i = 0; i < ASYNC_RECV_TRANSFERS; i++) {
+    libusb_transfer *transfer = libusb_alloc_transfer(0);
+    if (transfer == NULL) {
+      LOGE("libusb can't allocate transfer");
+      return false;
+    }
+    libusb_fill_bulk_transfer(transfer, dev_handle, endpoint, &recv_transfer_bufs[i * RECV_SIZE], RECV_SIZE,
+                              recv_transfer_callback, this, 0);
+    recv_transfers.push_back(transfer);
+    // a failed submit is retried with the idle ones
+    submit_recv_transfer(transfer);
+  }
+  return true;
+}
+
+void UsbTransport::stop_async_recv() {
+  if (recv_transfers.empty()) return;
+
+  for (libusb_transfer *transfer : recv_transfers) {
+    libusb_cancel_transfer(transfer);
+  }
+  // wait for the callbacks of all cancelled transfers before freeing them, a late callback would touch freed memory.
+  // libusb completes every cancelled transfer, also when the device is gone.
+  for (int i = 0; ; i++) {
+    int in_flight = 0;
+    {
+      std::lock_guard lk(recv_transfers_lock);
+      in_flight = recv_transfers_in_flight;
+    }
+    if (in_flight <= 0) break;
+    if (i > 0 && i % 10 == 0) {
+      LOGW("still waiting for %d cancelled usb transfers", in_flight);
+    }
+    struct timeval tv = {0, 100000};
+    libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+  }
+  for (libusb_transfer *transfer : recv_transfers) {
+    libusb_free_transfer(transfer);
+  }
+  recv_transfers.clear();
+  completed_recv_transfers.clear();
+  idle_recv_transfers.clear();
+}
+
+int UsbTransport::bulk_read_async(unsigned char endpoint, uint64_t timeout_us, const std::function<void(const uint8_t *, int)> &on_read) {
+  if (recv_transfers.empty() && !start_async_recv(endpoint)) {
+    stop_async_recv();
+    return LIBUSB_ERROR_NO_MEM;
+  }
+
+  const uint64_t deadline = nanos_since_boot() + timeout_us * 1000;
+  bool received = false;
+  int ret = 0;
+  while (ret != LIBUSB_ERROR_NO_DEVICE) {
+    uint64_t cur_time = nanos_since_boot();
+
+    // the panda answers a read with an empty packet when it has nothing queued,
+    // so empty transfers wait for the idle interval instead of spinning
+    uint64_t next_resubmit = UINT64_MAX;
+    for (int i = 0; i < idle_recv_transfers.size(); /**/) {
+      auto [transfer, resubmit_time] = idle_recv_transfers[i];
+      if (resubmit_time <= cur_time) {
+        idle_recv_transfers.erase(idle_recv_transfers.begin() + i);
+        if (int err = submit_recv_transfer(transfer); err != 0) ret = err;
+      } else {
+        next_resubmit = std::min(next_resubmit, resubmit_time);
+        ++i;
+      }
+    }
+
+    completed_recv_scratch.clear();
+    {
+      std::lock_guard lk(recv_transfers_lock);
+      std::swap(completed_recv_transfers, completed_recv_scratch);
+    }
+    for (libusb_transfer *transfer : completed_recv_scratch) {
+      switch (transfer->status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+          if (transfer->actual_length > 0) {
+            on_read(transfer->buffer, transfer->actual_length);
+            received = true;
+            if (int err = submit_recv_transfer(transfer); err != 0) ret = err;
+          } else {
+            idle_recv_transfers.push_back({transfer, cur_time + ASYNC_RECV_IDLE_POLL_US * 1000});
+          }
+          break;
+        case LIBUSB_TRANSFER_OVERFLOW:
+          LOGE_100("overflow got 0x%x", transfer->actual_length);
+          ret = LIBUSB_ERROR_OVERFLOW;
+          submit_recv_transfer(transfer);
+          break;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+          ret = LIBUSB_ERROR_NO_DEVICE;
+          break;
+        case LIBUSB_TRANSFER_CANCELLED:
+          break;
+        default:
+          LOGE_100("usb transfer status %d in %s", transfer->status, __func__);
+          ret = LIBUSB_ERROR_IO;
+          idle_recv_transfers.push_back({transfer, cur_time + ASYNC_RECV_IDLE_POLL_US * 1000});
+          break;
+      }
+    }
+
+    if (received || cur_time >= deadline) {
+      break;
+    }
+
+    const uint64_t wait = std::min(deadline, next_resubmit) - cur_time;
+    struct timeval tv = {(time_t)(wait / 1000000000ULL), (suseconds_t)((wait % 1000000000ULL) / 1000)};
+    libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+  }
+
+  return ret;
+}
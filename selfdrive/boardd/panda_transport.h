@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <libusb-1.0/libusb.h>
+
+#define RECV_SIZE (0x4000U)
+#define ASYNC_RECV_TRANSFERS 4
+#define ASYNC_RECV_IDLE_POLL_US 1000
+
+// The link to a panda. Transfers return like their libusb counterparts, errors are LIBUSB_ERROR codes
+class PandaTransport {
+ public:
+  virtual ~PandaTransport(){};
+
+  virtual std::string serial() const = 0;
+  virtual int control_transfer(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                               unsigned char *data, uint16_t wLength, unsigned int timeout) = 0;
+  virtual int bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) = 0;
+  // keeps reads of endpoint in flight, and waits up to timeout_us for some of them to bring data.
+  // on_read gets the data of each, returns 0 or the error of a failed read
+  virtual int bulk_read_async(unsigned char endpoint, uint64_t timeout_us, const std::function<void(const uint8_t *, int)> &on_read) = 0;
+};
+
+class UsbTransport : public PandaTransport {
+ public:
+  UsbTransport(std::string serial="");
+  ~UsbTransport();
+  static std::vector<std::string> list();
+
+  std::string serial() const { return usb_serial; }
+  int control_transfer(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                       unsigned char *data, uint16_t wLength, unsigned int timeout);
+  int bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout);
+  // keeps ASYNC_RECV_TRANSFERS bulk reads in flight, don't mix with bulk_transfer reads of the same endpoint
+  int bulk_read_async(unsigned char endpoint, uint64_t timeout_us, const std::function<void(const uint8_t *, int)> &on_read);
+
+ private:
+  libusb_context *ctx = NULL;
+  libusb_device_handle *dev_handle = NULL;
+  std::string usb_serial;
+  void cleanup();
+
+  // the callbacks can run on any thread handling libusb events
+  std::mutex recv_transfers_lock;
+  std::vector<uint8_t> recv_transfer_bufs;
+  std::vector<libusb_transfer *> recv_transfers;
+  std::vector<libusb_transfer *> completed_recv_transfers, completed_recv_scratch;
+  std::vector<std::pair<libusb_transfer *, uint64_t>> idle_recv_transfers;
+  int recv_transfers_in_flight = 0;
+  bool start_async_recv(unsigned char endpoint);
+  void stop_async_recv();
+  int submit_recv_transfer(libusb_transfer *transfer);
+  static void LIBUSB_CALL recv_transfer_callback(libusb_transfer *transfer);
+};
@@ -1,6 +1,8 @@
 #include "selfdrive/boardd/pigeon.h"
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
 
@@ -217,6 +219,11 @@ std::string PandaPigeon::receive() {
   return r;
 }
 
+void PandaPigeon::wait_for_data(int timeout_ms) {
+  // the panda has no way to signal data, poll it at 100 Hz
+  util::sleep_for(std::min(timeout_ms, 10));
+}
+
 void PandaPigeon::set_power(bool power) {
   panda->usb_write(0xd9, power, 0);
 }
@@ -314,6 +321,30 @@ std::string TTYPigeon::receive() {
   return r;
 }
 
+// poll wakes on the first byte of a burst. the rest of it is waited for until the tty is quiet
+// for a gap, so ubloxRaw carries whole bursts instead of a few bytes each
+const int TTY_COALESCE_GAP_MS = 1;
+const int TTY_COALESCE_MAX_MS = 10;
+
+void TTYPigeon::wait_for_data(int timeout_ms) {
+  struct pollfd fds[] = {{.fd = pigeon_tty_fd, .events = POLLIN}};
+  int err = HANDLE_EINTR(poll(fds, std::size(fds), timeout_ms));
+  if (err < 0) {
+    handle_tty_issue(errno, __func__);
+  } else if (err > 0 && (fds[0].revents & (POLLERR | POLLHUP))) {
+    // don't spin on a broken tty
+    util::sleep_for(timeout_ms);
+  } else if (err > 0) {
+    int prev = -1, available = 0;
+    for (int waited = 0; waited < TTY_COALESCE_MAX_MS; waited += TTY_COALESCE_GAP_MS) {
+      // receive() reads up to 0x1000 bytes at once
+      if (ioctl(pigeon_tty_fd, FIONREAD, &available) < 0 || available == prev || available >= 0x1000) break;
+      prev = available;
+      util::sleep_for(TTY_COALESCE_GAP_MS);
+    }
+  }
+}
+
 void TTYPigeon::set_power(bool power) {
 #ifdef QCOM2
   int err = 0;
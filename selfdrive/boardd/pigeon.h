@@ -30,6 +30,8 @@ class Pigeon {
   virtual void set_baud(int baud) = 0;
   virtual void send(const std::string &s) = 0;
   virtual std::string receive() = 0;
+  // waits up to timeout_ms for data to receive
+  virtual void wait_for_data(int timeout_ms) = 0;
   virtual void set_power(bool power) = 0;
 };
 
@@ -41,6 +43,7 @@ public:
   void set_baud(int baud);
   void send(const std::string &s);
   std::string receive();
+  void wait_for_data(int timeout_ms);
   void set_power(bool power);
 };
 
@@ -54,5 +57,6 @@ public:
   void set_baud(int baud);
   void send(const std::string &s);
   std::string receive();
+  void wait_for_data(int timeout_ms);
   void set_power(bool power);
 };
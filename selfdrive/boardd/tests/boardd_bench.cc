@@ -0,0 +1,149 @@
+// Benchmarks the boardd CAN threads end to end on a PC, with simulated pandas in place of USB hardware:
+// frames/s, publish latency and jitter of "can", sendcan to panda latency, and boardd's cpu per frame.
+//   ./boardd_bench [seconds per mode] [frames per second per panda] [usb latency us] [pandas] [sendcan frames per message]
+#include <pthread.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/boardd/boardd.h"
+#include "selfdrive/boardd/tests/sim_panda.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+extern ExitHandler do_exit;
+
+static uint64_t cpu_ns(clockid_t clock) {
+  struct timespec t = {};
+  clock_gettime(clock, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static double percentile(std::vector<double> &v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p / 100. * v.size()))];
+}
+
+static void run(const char *name, bool async_recv, uint64_t coalesce_us, double seconds, SimPandaConfig config, int num_pandas, int sends_per_msg) {
+  std::unique_ptr<Context> context(Context::create());
+  std::unique_ptr<SubSocket> sock(SubSocket::create(context.get(), "can"));
+  assert(sock != NULL);
+  sock->setTimeout(100);
+
+  // each sent frame carries the time it was published
+  std::mutex send_latency_lock;
+  std::vector<double> send_latency_ms;
+  config.on_send = [&](const can_header &header, const uint8_t *dat, int len) {
+    uint64_t sent_time;
+    memcpy(&sent_time, dat, sizeof(sent_time));
+    std::lock_guard lk(send_latency_lock);
+    send_latency_ms.push_back((nanos_since_boot() - sent_time) / 1e6);
+  };
+
+  do_exit = false;
+  const uint64_t start_process_cpu = cpu_ns(CLOCK_PROCESS_CPUTIME_ID);
+  const uint64_t start_thread_cpu = cpu_ns(CLOCK_THREAD_CPUTIME_ID);
+  std::vector<SimPandaTransport *> sims;
+  std::vector<Panda *> pandas;
+  for (int i = 0; i < num_pandas; i++) {
+    auto sim = std::make_unique<SimPandaTransport>("sim" + std::to_string(i), config);
+    sims.push_back(sim.get());
+    pandas.push_back(new Panda(std::move(sim), i * PANDA_BUS_CNT));
+  }
+  std::thread recv_thread(can_recv_thread, pandas, async_recv, coalesce_us);
+  std::thread send_thread(can_send_thread, pandas, false);
+
+  // sendcan at 100hz, like controlsd
+  uint64_t sender_cpu = 0;
+  std::thread sender([&]() {
+    PubMaster pm({"sendcan"});
+    while (!do_exit) {
+      MessageBuilder msg;
+      auto can_data = msg.initEvent().initSendcan(sends_per_msg);
+      for (int i = 0; i < sends_per_msg; i++) {
+        const uint64_t t = nanos_since_boot();
+        can_data[i].setAddress(0x200 + i);
+        can_data[i].setDat(kj::arrayPtr((const uint8_t *)&t, sizeof(t)));
+        can_data[i].setSrc((i % num_pandas) * PANDA_BUS_CNT);
+      }
+      pm.send("sendcan", msg);
+      util::sleep_for(10);
+    }
+    sender_cpu = cpu_ns(CLOCK_THREAD_CPUTIME_ID);
+  });
+
+  AlignedBuffer aligned_buf;
+  std::vector<double> latency_ms, interval_ms;
+  size_t frames = 0;
+  uint64_t last_msg_time = 0;
+  const uint64_t end_time = nanos_since_boot() + seconds * 1e9;
+  while (nanos_since_boot() < end_time) {
+    std::unique_ptr<Message> msg(sock->receive());
+    if (!msg) continue;
+
+    const uint64_t t = nanos_since_boot();
+    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg.get()));
+    cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+    for (auto c : event.getCan()) {
+      // the echoes of sendcan carry the time they were published instead
+      if (c.getSrc() < CANPACKET_RETURNED) {
+        uint64_t bus_time;
+        memcpy(&bus_time, c.getDat().begin(), sizeof(bus_time));
+        latency_ms.push_back((t - bus_time) / 1e6);
+      }
+      ++frames;
+    }
+    if (last_msg_time != 0) {
+      interval_ms.push_back((t - last_msg_time) / 1e6);
+    }
+    last_msg_time = t;
+  }
+  do_exit = true;
+  sender.join();
+  send_thread.join();
+  recv_thread.join();
+
+  // everything but this thread, the sender and the simulated buses is boardd, or the usb transfers it makes
+  uint64_t other_cpu = cpu_ns(CLOCK_THREAD_CPUTIME_ID) - start_thread_cpu + sender_cpu;
+  for (auto sim : sims) {
+    other_cpu += sim->producer_cpu_ns();
+  }
+  const uint64_t boardd_cpu = cpu_ns(CLOCK_PROCESS_CPUTIME_ID) - start_process_cpu - other_cpu;
+  const size_t sent_frames = send_latency_ms.size();
+  for (Panda *panda : pandas) {
+    delete panda;
+  }
+
+  double mean = 0, var = 0;
+  for (double v : interval_ms) mean += v / interval_ms.size();
+  for (double v : interval_ms) var += (v - mean) * (v - mean) / interval_ms.size();
+  printf("%-22s %9.0f %8.1f %8.2f %8.2f %8.2f %9.2f %8.2f %8.2f %9.2f\n", name, frames / seconds, interval_ms.size() / seconds,
+         percentile(latency_ms, 50), percentile(latency_ms, 99), percentile(latency_ms, 100), std::sqrt(var),
+         percentile(send_latency_ms, 50), percentile(send_latency_ms, 99), boardd_cpu / 1e3 / std::max<size_t>(1, frames + sent_frames));
+}
+
+int main(int argc, char *argv[]) {
+  const double seconds = argc > 1 ? atof(argv[1]) : 5;
+  SimPandaConfig config;
+  config.frames_per_sec = argc > 2 ? atof(argv[2]) : 2000;
+  config.usb_latency_us = argc > 3 ? atoi(argv[3]) : 300;
+  const int num_pandas = argc > 4 ? atoi(argv[4]) : 1;
+  const int sends_per_msg = argc > 5 ? atoi(argv[5]) : 10;
+
+  printf("%d pandas, %.0f frames/s each, %lu us usb transfers, %d frames per sendcan, %.0f s per mode\n",
+         num_pandas, config.frames_per_sec, config.usb_latency_us, sends_per_msg, seconds);
+  printf("%-22s %9s %8s %8s %8s %8s %9s %8s %8s %9s\n", "mode", "frames/s", "msgs/s", "p50 ms", "p99 ms", "max ms",
+         "jitter ms", "send p50", "send p99", "cpu us/fr");
+  run("poll 100hz", false, 0, seconds, config, num_pandas, sends_per_msg);
+  for (uint64_t coalesce_us : {0, 1000, 5000, 10000}) {
+    const std::string name = "async coalesce " + std::to_string(coalesce_us) + "us";
+    run(name.c_str(), true, coalesce_us, seconds, config, num_pandas, sends_per_msg);
+  }
+  return 0;
+}
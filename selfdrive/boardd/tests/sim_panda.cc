@@ -0,0 +1,143 @@
+#include "selfdrive/boardd/tests/sim_panda.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+#include "selfdrive/common/timing.h"
+
+// from panda/board/dlc_to_len.h, defined with panda.cc
+extern unsigned char dlc_to_len[];
+
+SimPandaTransport::SimPandaTransport(std::string serial, SimPandaConfig config) : sim_serial(serial), config(config) {
+  producer = std::thread(&SimPandaTransport::produce, this);
+}
+
+SimPandaTransport::~SimPandaTransport() {
+  running = false;
+  producer.join();
+}
+
+uint64_t SimPandaTransport::producer_cpu_ns() {
+  clockid_t clock;
+  struct timespec t = {};
+  if (pthread_getcpuclockid(producer.native_handle(), &clock) == 0) {
+    clock_gettime(clock, &t);
+  }
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+void SimPandaTransport::produce() {
+  std::mt19937 rng(std::hash<std::string>{}(sim_serial));
+  std::exponential_distribution<double> interval(config.frames_per_sec);
+  std::uniform_int_distribution<int> address(0x100, 0x7FF);
+  std::uniform_int_distribution<int> bus(0, 2);
+  while (running) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(interval(rng)));
+    can_header header = {};
+    header.addr = address(rng);
+    header.bus = bus(rng);
+    header.data_len_code = 8;
+    const uint64_t t = nanos_since_boot();
+    queue_frame(header, (const uint8_t *)&t, sizeof(t));
+  }
+}
+
+void SimPandaTransport::queue_frame(const can_header &header, const uint8_t *dat, int len) {
+  {
+    std::lock_guard lk(queue_lock);
+    queue.insert(queue.end(), (const uint8_t *)&header, (const uint8_t *)&header + CANPACKET_HEAD_SIZE);
+    queue.insert(queue.end(), dat, dat + len);
+  }
+  queue_cv.notify_one();
+}
+
+// hands the queued frames over in usb packets, each starting with its counter.
+// a frame can be split over two reads, like on the panda
+int SimPandaTransport::read_queue(unsigned char *data, int length) {
+  std::lock_guard lk(queue_lock);
+  int size = 0;
+  size_t consumed = 0;
+  while (consumed < queue.size() && size + USBPACKET_MAX_SIZE <= length) {
+    const size_t chunk_len = std::min<size_t>(USBPACKET_MAX_SIZE - 1, queue.size() - consumed);
+    data[size] = size / USBPACKET_MAX_SIZE;
+    memcpy(&data[size + 1], &queue[consumed], chunk_len);
+    size += chunk_len + 1;
+    consumed += chunk_len;
+  }
+  queue.erase(queue.begin(), queue.begin() + consumed);
+  return size;
+}
+
+void SimPandaTransport::receive_sends(const unsigned char *data, int length) {
+  send_buf.clear();
+  for (int i = 0; i < length; i += USBPACKET_MAX_SIZE) {
+    const int chunk_len = std::min(USBPACKET_MAX_SIZE, length - i);
+    send_buf.insert(send_buf.end(), &data[i + 1], &data[i + chunk_len]);
+  }
+
+  for (size_t pos = 0; pos + CANPACKET_HEAD_SIZE <= send_buf.size(); /**/) {
+    can_header header;
+    memcpy(&header, &send_buf[pos], CANPACKET_HEAD_SIZE);
+    const int len = dlc_to_len[header.data_len_code];
+    if (pos + CANPACKET_HEAD_SIZE + len > send_buf.size()) break;
+
+    const uint8_t *dat = &send_buf[pos + CANPACKET_HEAD_SIZE];
+    if (config.on_send) {
+      config.on_send(header, dat, len);
+    }
+    if (config.echo_sends) {
+      header.returned = 1;
+      queue_frame(header, dat, len);
+    }
+    pos += CANPACKET_HEAD_SIZE + len;
+  }
+}
+
+int SimPandaTransport::control_transfer(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                                        unsigned char *data, uint16_t wLength, unsigned int timeout) {
+  if ((bmRequestType & LIBUSB_ENDPOINT_IN) == 0) {
+    return 0;
+  }
+
+  // a dos, and zeros for everything else
+  memset(data, 0, wLength);
+  if (bRequest == 0xc1 && wLength > 0) {
+    data[0] = (uint8_t)cereal::PandaState::PandaType::DOS;
+  }
+  return wLength;
+}
+
+int SimPandaTransport::bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) {
+  std::this_thread::sleep_for(std::chrono::microseconds(config.usb_latency_us));
+  if (endpoint & LIBUSB_ENDPOINT_IN) {
+    // an empty packet when nothing is queued
+    *transferred = read_queue(data, length);
+  } else {
+    if (endpoint == 3) {
+      receive_sends(data, length);
+    }
+    *transferred = length;
+  }
+  return 0;
+}
+
+// one read in flight, that completes a usb round trip after frames are queued
+int SimPandaTransport::bulk_read_async(unsigned char endpoint, uint64_t timeout_us, const std::function<void(const uint8_t *, int)> &on_read) {
+  {
+    std::unique_lock lk(queue_lock);
+    if (!queue_cv.wait_for(lk, std::chrono::microseconds(timeout_us), [&]() { return !queue.empty(); })) {
+      return 0;
+    }
+  }
+  std::this_thread::sleep_for(std::chrono::microseconds(config.usb_latency_us));
+
+  async_buf.resize(RECV_SIZE);
+  const int size = read_queue(async_buf.data(), async_buf.size());
+  if (size > 0) {
+    on_read(async_buf.data(), size);
+  }
+  return 0;
+}
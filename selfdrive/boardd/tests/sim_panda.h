@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "selfdrive/boardd/panda.h"
+
+struct SimPandaConfig {
+  // frames from the car, at random times on random buses. each carries
+  // the time it was put on the bus (nanos_since_boot) as its 8 bytes of data
+  double frames_per_sec = 2000;
+  // round trip of a bulk transfer
+  uint64_t usb_latency_us = 300;
+  // sent frames come back as returned, like the panda does once they're on the bus
+  bool echo_sends = true;
+  // called with every frame sent to the panda, once its transfer completed
+  std::function<void(const can_header &header, const uint8_t *dat, int len)> on_send;
+};
+
+// A panda in the same process, to run boardd without hardware
+class SimPandaTransport : public PandaTransport {
+ public:
+  SimPandaTransport(std::string serial, SimPandaConfig config);
+  ~SimPandaTransport();
+
+  std::string serial() const { return sim_serial; }
+  int control_transfer(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                       unsigned char *data, uint16_t wLength, unsigned int timeout);
+  int bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout);
+  int bulk_read_async(unsigned char endpoint, uint64_t timeout_us, const std::function<void(const uint8_t *, int)> &on_read);
+
+  // cpu time of the thread putting frames on the buses, which isn't boardd's
+  uint64_t producer_cpu_ns();
+
+ private:
+  void produce();
+  void queue_frame(const can_header &header, const uint8_t *dat, int len);
+  int read_queue(unsigned char *data, int length);
+  void receive_sends(const unsigned char *data, int length);
+
+  const std::string sim_serial;
+  const SimPandaConfig config;
+  std::atomic<bool> running = true;
+  std::thread producer;
+
+  // frames waiting to be read, packed like in the panda's usb buffer
+  std::mutex queue_lock;
+  std::condition_variable queue_cv;
+  std::vector<uint8_t> queue;
+  std::vector<uint8_t> send_buf;
+  std::vector<uint8_t> async_buf;
+};
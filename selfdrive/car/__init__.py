@@ -130,3 +130,14 @@ def get_safety_config(safety_model, safety_param = None):
   if safety_param is not None:
     ret.safetyParam = safety_param
   return ret
+
+
+def get_can_send_priorities(high=(), low=()):
+  ret = []
+  for addrs, priority in ((high, car.CarParams.CanSendPriority.Priority.high), (low, car.CarParams.CanSendPriority.Priority.low)):
+    for addr in addrs:
+      p = car.CarParams.CanSendPriority.new_message()
+      p.address = addr
+      p.priority = priority
+      ret.append(p)
+  return ret
@@ -42,30 +42,28 @@ LiveKalman::LiveKalman() {
   }
 
   // init filter
-  this->filter = std::make_shared<EKFSym>(this->name, get_mapmat(this->Q), get_mapvec(this->initial_x),
-    get_mapmat(initial_P),  this->dim_state, this->dim_state_err, 0, 0, 0, std::vector<int>(),
-    std::vector<int>{3}, std::vector<std::string>(), 0.2);
+  assert(this->dim_state == LIVE_DIM && this->dim_state_err == LIVE_EDIM);
+  this->filter = std::make_unique<Filter>(this->name, this->Q, this->initial_x, this->initial_P, std::vector<int>{3}, 0.2);
 }
 
 void LiveKalman::init_state(VectorXd& state, VectorXd& covs_diag, double filter_time) {
-  MatrixXdr covs = covs_diag.asDiagonal();
-  this->filter->init_state(get_mapvec(state), get_mapmat(covs), filter_time);
+  Filter::Covs covs = covs_diag.asDiagonal();
+  this->filter->init_state(state, covs, filter_time);
 }
 
 void LiveKalman::init_state(VectorXd& state, MatrixXdr& covs, double filter_time) {
-  this->filter->init_state(get_mapvec(state), get_mapmat(covs), filter_time);
+  this->filter->init_state(state, covs, filter_time);
 }
 
 void LiveKalman::init_state(VectorXd& state, double filter_time) {
-  MatrixXdr covs = this->filter->covs();
-  this->filter->init_state(get_mapvec(state), get_mapmat(covs), filter_time);
+  this->filter->init_state(state, this->filter->covs(), filter_time);
 }
 
-VectorXd LiveKalman::get_x() {
+const LiveKalman::Filter::State &LiveKalman::get_x() {
   return this->filter->state();
 }
 
-MatrixXdr LiveKalman::get_P() {
+const LiveKalman::Filter::Covs &LiveKalman::get_P() {
   return this->filter->covs();
 }
 
@@ -73,44 +71,35 @@ double LiveKalman::get_filter_time() {
   return this->filter->get_filter_time();
 }
 
-std::vector<MatrixXdr> LiveKalman::get_R(int kind, int n) {
-  std::vector<MatrixXdr> R;
-  for (int i = 0; i < n; i++) {
-    R.push_back(this->obs_noise[kind]);
-  }
-  return R;
+bool LiveKalman::predict_and_observe(double t, int kind, const Ref<const VectorXd> &meas, Estimate *estimate) {
+  return this->predict_and_observe(t, kind, meas, this->obs_noise.at(kind), estimate);
 }
 
-std::optional<Estimate> LiveKalman::predict_and_observe(double t, int kind, std::vector<VectorXd> meas, std::vector<MatrixXdr> R) {
-  std::optional<Estimate> r;
-  if (R.size() == 0) {
-    R = this->get_R(kind, meas.size());
-  }
-  r = this->filter->predict_and_update_batch(t, kind, get_vec_mapvec(meas), get_vec_mapmat(R));
-  return r;
+bool LiveKalman::predict_and_observe(double t, int kind, const Ref<const VectorXd> &meas, const Ref<const MatrixXdr> &R, Estimate *estimate) {
+  return this->filter->predict_and_update(t, kind, meas, R, estimate);
 }
 
 void LiveKalman::predict(double t) {
   this->filter->predict(t);
 }
 
-Eigen::VectorXd LiveKalman::get_initial_x() {
+const Eigen::VectorXd &LiveKalman::get_initial_x() {
   return this->initial_x;
 }
 
-MatrixXdr LiveKalman::get_initial_P() {
+const MatrixXdr &LiveKalman::get_initial_P() {
   return this->initial_P;
 }
 
-MatrixXdr LiveKalman::get_fake_gps_pos_cov() {
+const MatrixXdr &LiveKalman::get_fake_gps_pos_cov() {
   return this->fake_gps_pos_cov;
 }
 
-MatrixXdr LiveKalman::get_fake_gps_vel_cov() {
+const MatrixXdr &LiveKalman::get_fake_gps_vel_cov() {
   return this->fake_gps_vel_cov;
 }
 
-MatrixXdr LiveKalman::get_reset_orientation_P() {
+const MatrixXdr &LiveKalman::get_reset_orientation_P() {
   return this->reset_orientation_P;
 }
 
@@ -8,7 +8,7 @@
 #include <eigen3/Eigen/Dense>
 
 #include "generated/live_kf_constants.h"
-#include "rednose/helpers/ekf_sym.h"
+#include "rednose/helpers/ekf_sym_fixed.h"
 
 #define EARTH_GM 3.986005e14  // m^3/s^2 (gravitational constant * mass of earth)
 
@@ -21,35 +21,41 @@ std::vector<Eigen::Map<MatrixXdr>> get_vec_mapmat(std::vector<MatrixXdr>& mat_ve
 
 class LiveKalman {
 public:
+  // locationd only updates with single observations
+  static constexpr int MAX_BATCH = 1;
+  typedef EKFSymFixed<LIVE_DIM, LIVE_EDIM, MAX_BATCH, LIVE_MAX_ZDIM, LIVE_MAX_EXTRA_ARGS> Filter;
+
   LiveKalman();
 
   void init_state(Eigen::VectorXd& state, Eigen::VectorXd& covs_diag, double filter_time);
   void init_state(Eigen::VectorXd& state, MatrixXdr& covs, double filter_time);
   void init_state(Eigen::VectorXd& state, double filter_time);
 
-  Eigen::VectorXd get_x();
-  MatrixXdr get_P();
+  const Filter::State &get_x();
+  const Filter::Covs &get_P();
   double get_filter_time();
-  std::vector<MatrixXdr> get_R(int kind, int n);
 
-  std::optional<Estimate> predict_and_observe(double t, int kind, std::vector<Eigen::VectorXd> meas, std::vector<MatrixXdr> R = {});
+  // estimate is only filled when given. returns false if the observation is too old
+  bool predict_and_observe(double t, int kind, const Eigen::Ref<const Eigen::VectorXd> &meas, Estimate *estimate = nullptr);
+  bool predict_and_observe(double t, int kind, const Eigen::Ref<const Eigen::VectorXd> &meas, const Eigen::Ref<const MatrixXdr> &R,
+                           Estimate *estimate = nullptr);
   std::optional<Estimate> predict_and_update_odo_speed(std::vector<Eigen::VectorXd> speed, double t, int kind);
   std::optional<Estimate> predict_and_update_odo_trans(std::vector<Eigen::VectorXd> trans, double t, int kind);
   std::optional<Estimate> predict_and_update_odo_rot(std::vector<Eigen::VectorXd> rot, double t, int kind);
   void predict(double t);
 
-  Eigen::VectorXd get_initial_x();
-  MatrixXdr get_initial_P();
-  MatrixXdr get_fake_gps_pos_cov();
-  MatrixXdr get_fake_gps_vel_cov();
-  MatrixXdr get_reset_orientation_P();
+  const Eigen::VectorXd &get_initial_x();
+  const MatrixXdr &get_initial_P();
+  const MatrixXdr &get_fake_gps_pos_cov();
+  const MatrixXdr &get_fake_gps_vel_cov();
+  const MatrixXdr &get_reset_orientation_P();
 
   MatrixXdr H(Eigen::VectorXd in);
 
 private:
   std::string name = "live";
 
-  std::shared_ptr<EKFSym> filter;
+  std::unique_ptr<Filter> filter;
 
   int dim_state;
   int dim_state_err;
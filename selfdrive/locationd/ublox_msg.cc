@@ -8,6 +8,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <istream>
+#include <streambuf>
 #include <unordered_map>
 
 #include "selfdrive/common/swaglog.h"
@@ -93,9 +95,92 @@ bool UbloxMsgParser::add_data(const uint8_t *incoming_data, uint32_t incoming_da
 }
 
 
+void UbloxMsgParser::add_stream(const uint8_t *data, size_t len, const std::function<void(const uint8_t *, size_t)> &on_frame) {
+  size_t pos = 0;
+
+  // finish the message carried over from the last call
+  while(bytes_in_parse_buf > 0 && pos < len) {
+    size_t bytes_consumed = 0;
+    if(add_data(data + pos, (uint32_t)(len - pos), bytes_consumed)) {
+      on_frame(msg_parse_buf, bytes_in_parse_buf);
+      reset();
+    }
+    pos += bytes_consumed;
+  }
+
+  while(pos < len) {
+    // skip to the next preamble
+    const uint8_t *preamble = (const uint8_t *)memchr(data + pos, ublox::PREAMBLE1, len - pos);
+    if(preamble == nullptr) {
+      pos = len;
+      break;
+    }
+    pos = preamble - data;
+
+    const size_t available = len - pos;
+    if(available > 1 && data[pos + 1] != ublox::PREAMBLE2) {
+      pos += 1;
+      continue;
+    }
+    if(available < ublox::UBLOX_HEADER_SIZE) break;
+
+    const size_t msg_len = UBLOX_MSG_SIZE((data + pos)) + ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_CHECKSUM_SIZE;
+    if(available < msg_len) break;
+
+    uint8_t ck_a = 0, ck_b = 0;
+    for(size_t i = pos + 2; i < pos + msg_len - ublox::UBLOX_CHECKSUM_SIZE; i++) {
+      ck_a = (ck_a + data[i]) & 0xFF;
+      ck_b = (ck_b + ck_a) & 0xFF;
+    }
+    if(ck_a != data[pos + msg_len - 2] || ck_b != data[pos + msg_len - 1]) {
+      // Corrupted msg, resync after the preamble
+      LOGD("Checksum mismatch: %02X %02X, %02X %02X", ck_a, ck_b, data[pos + msg_len - 2], data[pos + msg_len - 1]);
+      pos += 1;
+      continue;
+    }
+
+    on_frame(data + pos, msg_len);
+    pos += msg_len;
+  }
+
+  // carry over the start of a message
+  if(pos < len) {
+    memcpy(msg_parse_buf, data + pos, len - pos);
+    bytes_in_parse_buf = len - pos;
+  }
+}
+
+// reads a message in place
+class FrameStreamBuf : public std::streambuf {
+public:
+  FrameStreamBuf(const uint8_t *frame, size_t len) {
+    char *begin = (char *)frame;
+    setg(begin, begin, begin + len);
+  }
+
+protected:
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+    char *base = (dir == std::ios_base::beg) ? eback() : (dir == std::ios_base::cur) ? gptr() : egptr();
+    if(off < eback() - base || off > egptr() - base) {
+      return pos_type(off_type(-1));
+    }
+    setg(eback(), base + off, egptr());
+    return pos_type(gptr() - eback());
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+};
+
 std::pair<std::string, kj::Array<capnp::word>> UbloxMsgParser::gen_msg() {
-  std::string dat = data();
-  kaitai::kstream stream(dat);
+  return gen_msg(msg_parse_buf, bytes_in_parse_buf);
+}
+
+std::pair<std::string, kj::Array<capnp::word>> UbloxMsgParser::gen_msg(const uint8_t *frame, size_t len) {
+  FrameStreamBuf buf(frame, len);
+  std::istream is(&buf);
+  kaitai::kstream stream(&is);
 
   ubx_t ubx_message(&stream);
   auto body = ubx_message.body();
@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -89,8 +90,12 @@ class UbloxMsgParser {
     inline void reset() {bytes_in_parse_buf = 0;}
     inline int needed_bytes();
     inline std::string data() {return std::string((const char*)msg_parse_buf, bytes_in_parse_buf);}
+    // frames a stream of ubx data and calls on_frame with every valid message in it. complete messages
+    // are passed in place, only a message split over two calls is carried over in the parse buffer
+    void add_stream(const uint8_t *data, size_t len, const std::function<void(const uint8_t *, size_t)> &on_frame);
 
     std::pair<std::string, kj::Array<capnp::word>> gen_msg();
+    std::pair<std::string, kj::Array<capnp::word>> gen_msg(const uint8_t *frame, size_t len);
     kj::Array<capnp::word> gen_nav_pvt(ubx_t::nav_pvt_t *msg);
     kj::Array<capnp::word> gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg);
     kj::Array<capnp::word> gen_rxm_rawx(ubx_t::rxm_rawx_t *msg);
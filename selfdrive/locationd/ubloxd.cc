@@ -1,4 +1,5 @@
 #include <cassert>
+#include <vector>
 
 #include <kaitai/kaitaistream.h>
 
@@ -14,6 +15,7 @@ int main() {
   LOGW("starting ubloxd");
   AlignedBuffer aligned_buf;
   UbloxMsgParser parser;
+  std::vector<std::pair<std::string, kj::Array<capnp::word>>> ublox_msgs;
 
   PubMaster pm({"ubloxGnss", "gpsLocationExternal"});
 
@@ -36,28 +38,23 @@ int main() {
     cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
     auto ubloxRaw = event.getUbloxRaw();
 
-    const uint8_t *data = ubloxRaw.begin();
-    size_t len = ubloxRaw.size();
-    size_t bytes_consumed = 0;
-
-    while(bytes_consumed < len && !do_exit) {
-      size_t bytes_consumed_this_time = 0U;
-      if(parser.add_data(data + bytes_consumed, (uint32_t)(len - bytes_consumed), bytes_consumed_this_time)) {
-
-        try {
-          auto ublox_msg = parser.gen_msg();
-          if (ublox_msg.second.size() > 0) {
-            auto bytes = ublox_msg.second.asBytes();
-            pm.send(ublox_msg.first.c_str(), bytes.begin(), bytes.size());
-          }
-        } catch (const std::exception& e) {
-          LOGE("Error parsing ublox message %s", e.what());
+    parser.add_stream(ubloxRaw.begin(), ubloxRaw.size(), [&](const uint8_t *frame, size_t len) {
+      try {
+        auto ublox_msg = parser.gen_msg(frame, len);
+        if (ublox_msg.second.size() > 0) {
+          ublox_msgs.push_back(std::move(ublox_msg));
         }
-
-        parser.reset();
+      } catch (const std::exception& e) {
+        LOGE("Error parsing ublox message %s", e.what());
       }
-      bytes_consumed += bytes_consumed_this_time;
+    });
+
+    // the messages of a read go out together
+    for (auto &[service, words] : ublox_msgs) {
+      auto bytes = words.asBytes();
+      pm.send(service.c_str(), bytes.begin(), bytes.size());
     }
+    ublox_msgs.clear();
   }
 
   return 0;
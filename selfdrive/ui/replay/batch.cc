@@ -0,0 +1,209 @@
+#include "selfdrive/ui/replay/batch.h"
+
+#include <QDebug>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <thread>
+
+#include "selfdrive/common/timing.h"
+
+BatchReplay::BatchReplay(const QStringList &routes, const QString &data_dir, bool local_cache)
+    : local_cache_(local_cache) {
+  for (const auto &r : routes) {
+    auto &state = routes_.emplace_back(std::make_unique<RouteState>());
+    state->route = std::make_unique<Route>(r, data_dir);
+  }
+}
+
+bool BatchReplay::load() {
+  QtConcurrent::blockingMap(routes_, [](std::unique_ptr<RouteState> &r) {
+    if (!r->route->load()) {
+      qWarning() << "failed to load route" << r->route->name();
+    }
+  });
+  return std::any_of(routes_.begin(), routes_.end(), [](auto &r) { return !r->route->segments().empty(); });
+}
+
+int BatchReplay::run(ConsumerFactory factory, const Config &config) {
+  // the segments of a group of routes are interleaved, so the segments in flight are spread over
+  // enough routes to keep the consumer workers busy, while only the consumers of the group are alive.
+  jobs_.clear();
+  const int group_size = std::max(1, config.consume_workers * 2);
+  for (int group = 0; group < routes_.size(); group += group_size) {
+    const int group_end = std::min<int>(group + group_size, routes_.size());
+    size_t max_segments = 0;
+    for (int i = group; i < group_end; ++i) {
+      RouteState &r = *routes_[i];
+      r.segments.clear();
+      r.ready.clear();
+      r.next = 0;
+      for (const auto &[n, files] : r.route->segments()) {
+        if (n >= config.begin_segment && n <= config.end_segment && !(files.rlog.isEmpty() && files.qlog.isEmpty())) {
+          r.segments.push_back(n);
+        }
+      }
+      max_segments = std::max(max_segments, r.segments.size());
+    }
+    for (int idx = 0; idx < max_segments; ++idx) {
+      for (int i = group; i < group_end; ++i) {
+        if (idx < routes_[i]->segments.size()) {
+          jobs_.push_back({.route = i, .index = idx});
+        }
+      }
+    }
+  }
+
+  const int workers[STAGE_COUNT] = {config.download_workers, config.parse_workers, config.consume_workers};
+  for (int i = 0; i < STAGE_COUNT; ++i) {
+    stages_[i].workers = std::max(1, workers[i]);
+    stages_[i].items = 0;
+    stages_[i].busy_ns = 0;
+  }
+  window_ = config.window > 0 ? config.window : 2 * (stages_[DOWNLOAD].workers + stages_[PARSE].workers + stages_[CONSUME].workers);
+  in_flight_ = 0;
+  next_job_ = 0;
+  replayed_ = failed_ = 0;
+  log_bytes_ = 0;
+
+  const double start_ms = millis_since_boot();
+  std::vector<std::thread> threads[STAGE_COUNT];
+  for (int i = 0; i < stages_[DOWNLOAD].workers; ++i) threads[DOWNLOAD].emplace_back(&BatchReplay::downloadThread, this);
+  for (int i = 0; i < stages_[PARSE].workers; ++i) threads[PARSE].emplace_back(&BatchReplay::parseThread, this);
+  for (int i = 0; i < stages_[CONSUME].workers; ++i) threads[CONSUME].emplace_back(&BatchReplay::consumeThread, this, std::cref(factory));
+
+  // shut the stages down in order, -1 stops a worker once the queue before it is drained
+  for (auto &t : threads[DOWNLOAD]) t.join();
+  for (int i = 0; i < stages_[PARSE].workers; ++i) parse_queue_.push(-1);
+  for (auto &t : threads[PARSE]) t.join();
+  for (int i = 0; i < stages_[CONSUME].workers; ++i) consume_queue_.push(-1);
+  for (auto &t : threads[CONSUME]) t.join();
+  wall_time_ms_ = millis_since_boot() - start_ms;
+  return replayed_;
+}
+
+void BatchReplay::downloadThread() {
+  FileReader reader(local_cache_, 0, 3);
+  while (true) {
+    int i = -1;
+    {
+      // jobs enter the window in order, so the oldest job in flight can always be consumed
+      std::unique_lock lk(window_lock_);
+      window_cv_.wait(lk, [this] { return in_flight_ < window_ || next_job_ >= jobs_.size(); });
+      if (next_job_ >= jobs_.size()) break;
+
+      ++in_flight_;
+      i = next_job_++;
+    }
+
+    const uint64_t start_ns = nanos_since_boot();
+    Job &job = jobs_[i];
+    const SegmentFile &files = routes_[job.route]->route->at(routes_[job.route]->segments[job.index]);
+    job.data = reader.read((files.rlog.isEmpty() ? files.qlog : files.rlog).toStdString(), &abort_);
+    stages_[DOWNLOAD].busy_ns += nanos_since_boot() - start_ns;
+    ++stages_[DOWNLOAD].items;
+    log_bytes_ += job.data.size();
+    parse_queue_.push(i);
+  }
+}
+
+void BatchReplay::parseThread() {
+  for (int i = parse_queue_.pop(); i >= 0; i = parse_queue_.pop()) {
+    const uint64_t start_ns = nanos_since_boot();
+    Job &job = jobs_[i];
+    if (!job.data.empty()) {
+      job.log = std::make_unique<LogReader>();
+      if (!job.log->load((const std::byte *)job.data.data(), job.data.size(), &abort_)) {
+        job.log.reset();
+      }
+    }
+    std::string().swap(job.data);
+    stages_[PARSE].busy_ns += nanos_since_boot() - start_ns;
+    ++stages_[PARSE].items;
+    consume_queue_.push(i);
+  }
+}
+
+void BatchReplay::consumeThread(const ConsumerFactory &factory) {
+  for (int i = consume_queue_.pop(); i >= 0; i = consume_queue_.pop()) {
+    const uint64_t start_ns = nanos_since_boot();
+    consume(jobs_[i], factory);
+    stages_[CONSUME].busy_ns += nanos_since_boot() - start_ns;
+  }
+}
+
+void BatchReplay::consume(Job &job, const ConsumerFactory &factory) {
+  RouteState &r = *routes_[job.route];
+  std::unique_lock lk(r.lock);
+  r.ready[job.index] = std::move(job.log);
+  // the worker replaying this route picks the segment up when it is next
+  if (r.busy) return;
+
+  r.busy = true;
+  for (auto it = r.ready.find(r.next); it != r.ready.end(); it = r.ready.find(r.next)) {
+    std::unique_ptr<LogReader> log = std::move(it->second);
+    r.ready.erase(it);
+    lk.unlock();
+
+    if (!r.replay) {
+      r.replay = std::make_unique<LockstepReplay>();
+      for (const auto &consumer : factory(r.route->name())) {
+        r.replay->addConsumer(consumer);
+      }
+    }
+    if (log) {
+      r.replay->replayLog(*log);
+      ++replayed_;
+    } else {
+      qWarning() << "failed to load log of segment" << r.segments[r.next] << "of" << r.route->name() << ", skipping it";
+      ++failed_;
+    }
+    log.reset();
+    ++stages_[CONSUME].items;
+    finishJob();
+
+    lk.lock();
+    ++r.next;
+  }
+  r.busy = false;
+  const bool done = r.next == r.segments.size();
+  lk.unlock();
+
+  // no more jobs of this route are coming
+  if (done && r.replay) {
+    r.replay->finish();
+    if (route_done) {
+      route_done(r.route->name(), *r.replay);
+    }
+    r.replay.reset();
+  }
+}
+
+void BatchReplay::finishJob() {
+  {
+    std::unique_lock lk(window_lock_);
+    --in_flight_;
+  }
+  window_cv_.notify_all();
+}
+
+void BatchReplay::printStats() const {
+  const double seconds = wall_time_ms_ / 1000.;
+  qInfo().noquote() << QString("replayed %1 segments (%2 failed) of %3 routes in %4 s: %5 segments/s, %6 MB/s of logs")
+                           .arg(replayed_)
+                           .arg(failed_)
+                           .arg(routes_.size())
+                           .arg(seconds, 0, 'f', 1)
+                           .arg(seconds > 0 ? replayed_ / seconds : 0, 0, 'f', 2)
+                           .arg(seconds > 0 ? log_bytes_ / 1e6 / seconds : 0, 0, 'f', 1);
+  for (const auto &s : stages_) {
+    // the share of the stage's worker time spent working, the rest is waiting on the other stages
+    const double utilization = wall_time_ms_ > 0 ? s.busy_ns / 1e6 / (wall_time_ms_ * s.workers) : 0;
+    qInfo().noquote() << QString("%1: %2 workers, %3 segments, %4 ms/segment, %5% utilization")
+                             .arg(s.name, -8)
+                             .arg(s.workers)
+                             .arg(s.items)
+                             .arg(s.items > 0 ? s.busy_ns / 1e6 / s.items : 0, 0, 'f', 1)
+                             .arg(utilization * 100, 0, 'f', 0);
+  }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+
+#include "selfdrive/common/queue.h"
+#include "selfdrive/ui/replay/lockstep.h"
+
+// Replays many routes through lockstep consumers using all cores.
+// Segments of all routes are sharded across three pipelined stages, each with its own workers:
+//   download -> decompress/parse -> consume
+// Routes are replayed in parallel, the segments of one route in order by one consumer worker at a time.
+// Each route gets its own consumers from the factory, so routes share no state (and no msgq).
+// At most `window` segments are in flight, which bounds the memory of the queues between the stages.
+class BatchReplay {
+public:
+  typedef std::function<std::vector<LockstepReplay::Consumer>(const QString &route)> ConsumerFactory;
+
+  struct Config {
+    int download_workers = 4;
+    int parse_workers = 2;
+    int consume_workers = 2;
+    // max segments in flight, 2 per worker if 0
+    int window = 0;
+    int begin_segment = 0;
+    int end_segment = INT_MAX;
+  };
+
+  struct StageStats {
+    const char *name;
+    int workers = 0;
+    std::atomic<uint64_t> items = 0;
+    std::atomic<uint64_t> busy_ns = 0;
+  };
+
+  BatchReplay(const QStringList &routes, const QString &data_dir = {}, bool local_cache = true);
+  // loads the file lists of the routes, returns false if there is nothing to replay
+  bool load();
+  // returns the number of segments replayed
+  int run(ConsumerFactory factory, const Config &config);
+  void printStats() const;
+
+  inline int routeCount() const { return routes_.size(); }
+  inline const StageStats &stage(int i) const { return stages_[i]; }
+
+  // called on a consumer worker when all segments of a route are replayed, before its consumers are destroyed.
+  // routes finish concurrently.
+  std::function<void(const QString &route, const LockstepReplay &replay)> route_done;
+
+private:
+  enum Stage { DOWNLOAD, PARSE, CONSUME, STAGE_COUNT };
+
+  struct RouteState {
+    std::unique_ptr<Route> route;
+    std::vector<int> segments;
+    std::unique_ptr<LockstepReplay> replay;
+    std::mutex lock;
+    // parsed logs waiting for the previous segments, by index into segments
+    std::map<int, std::unique_ptr<LogReader>> ready;
+    int next = 0;
+    bool busy = false;
+  };
+
+  struct Job {
+    int route;
+    int index;  // into RouteState::segments
+    std::string data;
+    std::unique_ptr<LogReader> log;
+  };
+
+  void downloadThread();
+  void parseThread();
+  void consumeThread(const ConsumerFactory &factory);
+  void consume(Job &job, const ConsumerFactory &factory);
+  void finishJob();
+
+  std::vector<std::unique_ptr<RouteState>> routes_;
+  bool local_cache_;
+
+  std::vector<Job> jobs_;
+  SafeQueue<int> parse_queue_, consume_queue_;
+  std::mutex window_lock_;
+  std::condition_variable window_cv_;
+  int window_ = 0;
+  int in_flight_ = 0;
+  size_t next_job_ = 0;
+  std::atomic<bool> abort_ = false;
+
+  StageStats stages_[STAGE_COUNT] = {{"download"}, {"parse"}, {"consume"}};
+  std::atomic<int> replayed_ = 0;
+  std::atomic<int> failed_ = 0;
+  std::atomic<size_t> log_bytes_ = 0;
+  double wall_time_ms_ = 0;
+};
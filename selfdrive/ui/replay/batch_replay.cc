@@ -0,0 +1,119 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+
+#include <mutex>
+#include <thread>
+
+#include "opendbc/can/common.h"
+#include "selfdrive/ui/replay/batch.h"
+
+// Replays many routes through consumers on all cores and reports the throughput of each stage, e.g.
+//   ./batch_replay --routes routes.txt --dbc gm_global_a_powertrain_generated
+int main(int argc, char *argv[]) {
+  QCoreApplication app(argc, argv);
+
+  const int cores = std::max(1u, std::thread::hardware_concurrency());
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Replay the logs of many routes through components in lockstep, using all cores.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("routes", "the drives to replay");
+  parser.addOption({"routes", "file with one route per line", "file"});
+  parser.addOption({"data_dir", "local directory with routes", "data_dir"});
+  parser.addOption({"segments", "segments of each route to replay, <n> or <begin>-<end>", "segments"});
+  parser.addOption({"dbc", "run CANParser with this dbc", "dbc"});
+  parser.addOption({"bus", "CAN bus to parse", "bus", "0"});
+  parser.addOption({"download-workers", "number of download workers", "n", "8"});
+  parser.addOption({"parse-workers", "number of decompress/parse workers", "n", QString::number(std::max(1, cores / 2))});
+  parser.addOption({"consume-workers", "number of consumer workers", "n", QString::number(std::max(1, cores / 2))});
+  parser.addOption({"window", "max segments in flight", "n", "0"});
+  parser.addOption({"no-cache", "turn off local cache"});
+  parser.process(app);
+
+  QStringList routes = parser.positionalArguments();
+  if (parser.isSet("routes")) {
+    QFile f(parser.value("routes"));
+    if (!f.open(QIODevice::ReadOnly)) {
+      qCritical() << "failed to open" << f.fileName();
+      return 1;
+    }
+    for (const auto &line : QString(f.readAll()).split("\n")) {
+      if (!line.trimmed().isEmpty()) routes.push_back(line.trimmed());
+    }
+  }
+  if (routes.empty()) {
+    parser.showHelp();
+  }
+
+  BatchReplay::Config config = {
+      .download_workers = parser.value("download-workers").toInt(),
+      .parse_workers = parser.value("parse-workers").toInt(),
+      .consume_workers = parser.value("consume-workers").toInt(),
+      .window = parser.value("window").toInt(),
+  };
+  if (parser.isSet("segments")) {
+    const QStringList range = parser.value("segments").split("-");
+    config.begin_segment = range[0].toInt();
+    config.end_segment = range.size() > 1 ? range[1].toInt() : config.begin_segment;
+  }
+
+  BatchReplay batch(routes, parser.value("data_dir"), !parser.isSet("no-cache"));
+  if (!batch.load()) {
+    qCritical() << "no segments to replay";
+    return 1;
+  }
+
+  const std::string dbc = parser.value("dbc").toStdString();
+  const int bus = parser.value("bus").toInt();
+  auto factory = [&](const QString &route) {
+    // baseline: the cost of delivering every message
+    std::vector<LockstepReplay::Consumer> consumers = {{
+        .name = "decode",
+        .period_ns = 10 * 1000000ULL,
+        .handle = [](const cereal::Event::Reader &event) { (void)event.which(); },
+    }};
+    if (!dbc.empty()) {
+      auto can_parser = std::make_shared<CANParser>(bus, dbc, true, true);
+      auto updated = std::make_shared<std::vector<const MessageState *>>();
+      consumers.push_back({
+          .name = "CANParser",
+          .inputs = {cereal::Event::Which::CAN},
+          .trigger = cereal::Event::Which::CAN,
+          .handle = [=](const cereal::Event::Reader &event) {
+            can_parser->UpdateCans(event.getLogMonoTime(), event.getCan());
+          },
+          .step = [=](uint64_t mono_time, std::vector<std::string> &outputs) {
+            can_parser->UpdateValid(mono_time);
+            can_parser->query_updated(*updated);
+          },
+      });
+    }
+    return consumers;
+  };
+
+  // per consumer totals over all routes
+  std::mutex lock;
+  std::map<std::string, std::pair<uint64_t, uint64_t>> totals;  // steps, compute_ns
+  batch.route_done = [&](const QString &route, const LockstepReplay &replay) {
+    std::unique_lock lk(lock);
+    for (int i = 0; i < replay.consumerCount(); ++i) {
+      auto &[steps, compute_ns] = totals[replay.consumerName(i)];
+      for (const auto &s : replay.steps(i)) {
+        compute_ns += s.compute_ns;
+      }
+      steps += replay.steps(i).size();
+    }
+  };
+
+  const int segments = batch.run(factory, config);
+  batch.printStats();
+  for (const auto &[name, total] : totals) {
+    qInfo().noquote() << QString("%1: %2 steps, total %3 ms, mean %4 us/step")
+                             .arg(name.c_str())
+                             .arg(total.first)
+                             .arg(total.second / 1e6, 0, 'f', 1)
+                             .arg(total.first > 0 ? total.second / 1e3 / total.first : 0, 0, 'f', 1);
+  }
+  return segments > 0 ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/ui/replay/filereader.h"
+#include "selfdrive/ui/replay/parallel_bz2.h"
+#include "selfdrive/ui/replay/util.h"
+
+const std::string DEMO_RLOG_URL = "https://commadataci.blob.core.windows.net/openpilotci/0c94aa1e1296d7c6/2021-05-05--19-48-37/0/rlog.bz2";
+const int PASSES = 3;
+
+// best of PASSES, in ms. negative if the output is empty or differs
+template <typename F>
+double bench(const std::string &expected, F decompress) {
+  double best = -1;
+  for (int i = 0; i < PASSES; ++i) {
+    const double t = millis_since_boot();
+    const std::string out = decompress();
+    const double ms = millis_since_boot() - t;
+    if (out != expected) return -1;
+    best = best < 0 ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+// Compares the parallel bzip2 decompression of LogReader against single-threaded libbz2 on real logs, e.g.
+//   ./bz2_bench --threads 2,4,8 <rlog.bz2 file or url>...
+int main(int argc, char *argv[]) {
+  std::vector<int> thread_counts;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      for (char *s = strtok(argv[++i], ","); s; s = strtok(nullptr, ",")) {
+        thread_counts.push_back(atoi(s));
+      }
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  if (thread_counts.empty()) {
+    thread_counts = {2, 4, (int)std::thread::hardware_concurrency()};
+  }
+  if (files.empty()) {
+    files.push_back(DEMO_RLOG_URL);
+  }
+
+  FileReader reader(true);
+  for (const auto &file : files) {
+    const std::string content = reader.read(file);
+    if (content.empty()) {
+      fprintf(stderr, "failed to read %s\n", file.c_str());
+      return 1;
+    }
+    const std::string expected = decompressBZ2Sequential((const std::byte *)content.data(), content.size());
+    if (expected.empty()) {
+      fprintf(stderr, "failed to decompress %s\n", file.c_str());
+      return 1;
+    }
+
+    printf("%s: %.1f MB -> %.1f MB\n", file.c_str(), content.size() / 1e6, expected.size() / 1e6);
+    auto report = [&](const char *name, int num_threads, double ms) {
+      if (ms < 0) {
+        printf("  %-8s %2d threads: not split or wrong output, LogReader falls back to libbz2\n", name, num_threads);
+      } else {
+        printf("  %-8s %2d threads: %8.1f ms, %7.1f MB/s in, %7.1f MB/s out\n", name, num_threads, ms,
+               content.size() / 1e3 / ms, expected.size() / 1e3 / ms);
+      }
+    };
+    report("libbz2", 1, bench(expected, [&] { return decompressBZ2Sequential((const std::byte *)content.data(), content.size()); }));
+    for (int num_threads : thread_counts) {
+      report("parallel", num_threads, bench(expected, [&] { return decompressBZ2Parallel(content, num_threads); }));
+    }
+  }
+  return 0;
+}
@@ -40,36 +40,20 @@ void CameraServer::startVipcServer() {
 }
 
 void CameraServer::cameraThread(Camera &cam) {
-  auto read_frame = [&](FrameReader *fr, int frame_id) {
-    VisionBuf *rgb_buf = vipc_server_->get_buffer(cam.rgb_type);
-    VisionBuf *yuv_buf = send_yuv ? vipc_server_->get_buffer(cam.yuv_type) : nullptr;
-    bool ret = fr->get(frame_id, (uint8_t *)rgb_buf->addr, yuv_buf ? (uint8_t *)yuv_buf->addr : nullptr);
-    return ret ? std::pair{rgb_buf, yuv_buf} : std::pair{nullptr, nullptr};
-  };
-
   while (true) {
-    const auto [fr, eidx] = cam.queue.pop();
+    auto [fr, frame] = cam.queue.pop();
     if (!fr) break;
 
-    const int id = eidx.getSegmentId();
-    bool prefetched = (id == cam.cached_id && eidx.getSegmentNum() == cam.cached_seg);
-    auto [rgb, yuv] = prefetched ? cam.cached_buf : read_frame(fr, id);
-    if (rgb || yuv) {
-      VisionIpcBufExtra extra = {
-          .frame_id = eidx.getFrameId(),
-          .timestamp_sof = eidx.getTimestampSof(),
-          .timestamp_eof = eidx.getTimestampEof(),
-      };
-      if (rgb) vipc_server_->send(rgb, &extra, false);
-      if (yuv) vipc_server_->send(yuv, &extra, false);
+    // frames are decoded ahead by the FrameReader's prefetch thread and converted straight into the vipc buffers.
+    VisionBuf *rgb_buf = vipc_server_->get_buffer(cam.rgb_type);
+    VisionBuf *yuv_buf = send_yuv ? vipc_server_->get_buffer(cam.yuv_type) : nullptr;
+    if (fr->get(frame.segment_id, (uint8_t *)rgb_buf->addr, yuv_buf ? (uint8_t *)yuv_buf->addr : nullptr)) {
+      vipc_server_->send(rgb_buf, &frame.extra, false);
+      if (yuv_buf) vipc_server_->send(yuv_buf, &frame.extra, false);
     } else {
-      std::cout << "camera[" << cam.type << "] failed to get frame:" << eidx.getSegmentId() << std::endl;
+      std::cout << "camera[" << cam.type << "] failed to get frame:" << frame.segment_id << std::endl;
     }
 
-    cam.cached_id = id + 1;
-    cam.cached_seg = eidx.getSegmentNum();
-    cam.cached_buf = read_frame(fr, cam.cached_id);
-
     --publishing_;
   }
 }
@@ -84,5 +68,13 @@ void CameraServer::pushFrame(CameraType type, FrameReader *fr, const cereal::Enc
   }
 
   ++publishing_;
-  cam.queue.push({fr, eidx});
+  Frame frame = {
+      .segment_id = eidx.getSegmentId(),
+      .extra = {
+          .frame_id = eidx.getFrameId(),
+          .timestamp_sof = eidx.getTimestampSof(),
+          .timestamp_eof = eidx.getTimestampEof(),
+      },
+  };
+  cam.queue.push({fr, frame});
 }
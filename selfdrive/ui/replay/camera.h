@@ -16,6 +16,11 @@ public:
   }
 
 protected:
+  // copied from the EncodeIndex, its reader only lives while the event is published
+  struct Frame {
+    uint32_t segment_id;
+    VisionIpcBufExtra extra;
+  };
   struct Camera {
     CameraType type;
     VisionStreamType rgb_type; 
@@ -23,10 +28,7 @@ protected:
     int width;
     int height;
     std::thread thread;
-    SafeQueue<std::pair<FrameReader*, const cereal::EncodeIndex::Reader>> queue;
-    int cached_id = -1;
-    int cached_seg = -1;
-    std::pair<VisionBuf *, VisionBuf*> cached_buf;
+    SafeQueue<std::pair<FrameReader*, Frame>> queue;
   };
   void startVipcServer();
   void cameraThread(Camera &cam);
@@ -1,41 +1,320 @@
 #include "selfdrive/ui/replay/filereader.h"
 
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include "selfdrive/common/util.h"
 #include "selfdrive/ui/replay/util.h"
 
-std::string cacheFilePath(const std::string &url) {
+namespace {
+
+// file names of tools/lib/url_file.py, which formats the chunk index as a float
+const char *LENGTH_SUFFIX = "length";
+const char *CHUNK_SUFFIX = ".0";
+const size_t HASH_LEN = 64;
+
+std::string cacheRoot() {
   static std::string cache_path = [] {
     const std::string comma_cache = util::getenv("COMMA_CACHE", "/tmp/comma_download_cache/");
     util::create_directories(comma_cache, 0755);
     return comma_cache.back() == '/' ? comma_cache : comma_cache + "/";
   }();
+  return cache_path;
+}
+
+class FileLock {
+public:
+  FileLock(const std::string &fn) {
+    fd_ = HANDLE_EINTR(open(fn.c_str(), O_CREAT | O_RDONLY, 0664));
+    if (fd_ < 0 || HANDLE_EINTR(flock(fd_, LOCK_EX)) < 0) {
+      std::cout << "failed to lock " << fn << ", errno=" << errno << std::endl;
+    }
+  }
+  ~FileLock() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+private:
+  int fd_ = -1;
+};
+
+struct CacheFile {
+  std::string name;
+  struct timespec mtime;
+  size_t size;
+};
+
+// cached files are named after the sha256 of their url: chunks <sha256>_<n>.0, whole files <sha256>
+// and frame indexes <sha256>.vidx. skip everything else including files being written and the lock.
+bool isCacheFile(const char *name) {
+  return strlen(name) >= HASH_LEN && strspn(name, "0123456789abcdef") >= HASH_LEN && !strstr(name, ".tmp");
+}
+
+// the <sha256>_length of a chunked file, it is removed together with the last chunk of the file.
+bool isLengthFile(const std::string &name) {
+  return name.size() == HASH_LEN + 1 + strlen(LENGTH_SUFFIX) && name.compare(HASH_LEN + 1, std::string::npos, LENGTH_SUFFIX) == 0;
+}
+
+std::vector<CacheFile> scanFiles(const std::string &root) {
+  std::vector<CacheFile> files;
+  DIR *d = opendir(root.c_str());
+  if (!d) return files;
+
+  while (struct dirent *de = readdir(d)) {
+    if (!isCacheFile(de->d_name)) continue;
+
+    struct stat st = {};
+    if (stat((root + de->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      files.push_back({.name = de->d_name, .mtime = st.st_mtim, .size = (size_t)st.st_size});
+    }
+  }
+  closedir(d);
+  return files;
+}
+
+}  // namespace
+
+std::string cacheFilePath(const std::string &url) {
+  return cacheRoot() + sha256(getUrlWithoutQuery(url));
+}
+
+bool isRemoteFile(const std::string &file) {
+  return file.find("https://") == 0 || file.find("http://") == 0;
+}
+
+// class DownloadCache
+
+DownloadCache::DownloadCache(const std::string &root, size_t max_bytes)
+    : root_(root.back() == '/' ? root : root + "/"), max_bytes_(max_bytes) {
+  util::create_directories(root_, 0755);
+  evict(max_bytes_);
+}
+
+DownloadCache &DownloadCache::instance() {
+  static DownloadCache cache(cacheRoot(), (size_t)util::getenv("COMMA_CACHE_MAX_MB", (int)(DEFAULT_CACHE_MAX_BYTES >> 20)) << 20);
+  return cache;
+}
+
+std::string DownloadCache::filePrefix(const std::string &url) const {
+  return root_ + sha256(getUrlWithoutQuery(url)) + "_";
+}
+
+bool DownloadCache::getSize(const std::string &url, size_t &size) {
+  const std::string content = util::read_file(filePrefix(url) + LENGTH_SUFFIX);
+  size = strtoull(content.c_str(), nullptr, 10);
+  return size > 0;
+}
+
+bool DownloadCache::get(const std::string &url, size_t begin, size_t end, std::string &out) {
+  size_t file_size = 0;
+  if (!getSize(url, file_size)) return false;
+
+  end = std::min(end, file_size);
+  out.clear();
+  if (begin >= end) return true;
+
+  const std::string prefix = filePrefix(url);
+  out.reserve(end - begin);
+  std::string chunk;
+  for (size_t idx = begin / CACHE_CHUNK_SIZE; idx * CACHE_CHUNK_SIZE < end; ++idx) {
+    const size_t chunk_begin = idx * CACHE_CHUNK_SIZE;
+    const size_t chunk_size = std::min(CACHE_CHUNK_SIZE, file_size - chunk_begin);
+    if (!readChunk(prefix, idx, chunk_size, chunk)) return false;
+
+    const size_t from = std::max(begin, chunk_begin) - chunk_begin;
+    const size_t to = std::min(end, chunk_begin + chunk_size) - chunk_begin;
+    out.append(chunk, from, to - from);
+  }
+  return true;
+}
+
+bool DownloadCache::readChunk(const std::string &prefix, size_t idx, size_t chunk_size, std::string &out) {
+  const std::string path = prefix + std::to_string(idx) + CHUNK_SUFFIX;
+  out = util::read_file(path);
+  if (out.size() != chunk_size) return false;
+
+  // refresh the LRU position. the chunk may have been evicted in the meantime, that's fine.
+  utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+  return true;
+}
+
+void DownloadCache::put(const std::string &url, size_t file_size, size_t begin, const std::string &data) {
+  assert(begin % CACHE_CHUNK_SIZE == 0);
+  const std::string prefix = filePrefix(url);
+  size_t cached_size = 0;
+  if (!getSize(url, cached_size) || cached_size != file_size) {
+    const std::string size_str = std::to_string(file_size);
+    writeFile(prefix + LENGTH_SUFFIX, size_str.data(), size_str.size());
+  }
+
+  size_t written = 0;
+  for (size_t offset = 0; begin + offset < file_size && offset < data.size(); offset += CACHE_CHUNK_SIZE) {
+    const size_t chunk_size = std::min(CACHE_CHUNK_SIZE, file_size - (begin + offset));
+    if (offset + chunk_size > data.size()) break;  // only store complete chunks
+
+    if (writeFile(prefix + std::to_string((begin + offset) / CACHE_CHUNK_SIZE) + CHUNK_SUFFIX, data.data() + offset, chunk_size)) {
+      written += chunk_size;
+    }
+  }
+
+  if ((written_since_scan_ += written) > max_bytes_ / 10) {
+    evict(max_bytes_ / 10 * 9);
+  }
+}
+
+bool DownloadCache::writeFile(const std::string &path, const char *data, size_t size) {
+  // write to a unique temp file and rename it into place, readers never see partial files.
+  const std::string tmp_path = util::string_format("%s.tmp.%d.%zu", path.c_str(), getpid(),
+                                                   std::hash<std::thread::id>{}(std::this_thread::get_id()));
+  if (util::write_file(tmp_path.c_str(), data, size, O_WRONLY | O_CREAT | O_TRUNC) != 0 ||
+      ::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    ::unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+size_t DownloadCache::usedBytes() {
+  size_t total = 0;
+  for (const auto &f : scanFiles(root_)) {
+    if (!isLengthFile(f.name)) total += f.size;
+  }
+  return total;
+}
+
+size_t DownloadCache::evict(size_t target_bytes) {
+  FileLock lock(root_ + ".cache.lock");
 
-  return cache_path + sha256(getUrlWithoutQuery(url));
+  std::vector<CacheFile> files = scanFiles(root_);
+  size_t total = 0;
+  for (const auto &f : files) {
+    if (!isLengthFile(f.name)) total += f.size;
+  }
+  if (total > target_bytes) {
+    std::sort(files.begin(), files.end(), [](const CacheFile &l, const CacheFile &r) {
+      return std::tie(l.mtime.tv_sec, l.mtime.tv_nsec) < std::tie(r.mtime.tv_sec, r.mtime.tv_nsec);
+    });
+    std::set<std::string> kept;  // hashes with files left
+    for (const auto &f : files) {
+      if (isLengthFile(f.name)) continue;
+
+      if (total > target_bytes && ::unlink((root_ + f.name).c_str()) == 0) {
+        total -= f.size;
+      } else {
+        kept.insert(f.name.substr(0, HASH_LEN));
+      }
+    }
+    for (const auto &f : files) {
+      if (isLengthFile(f.name) && kept.count(f.name.substr(0, HASH_LEN)) == 0) {
+        ::unlink((root_ + f.name).c_str());
+      }
+    }
+  }
+  written_since_scan_ = 0;
+  return total;
 }
 
+// class FileReader
+
 std::string FileReader::read(const std::string &file, std::atomic<bool> *abort) {
-  const bool is_remote = file.find("https://") == 0;
-  const std::string local_file = is_remote ? cacheFilePath(file) : file;
+  if (!isRemoteFile(file)) {
+    return util::read_file(file);
+  }
+
+  size_t size = 0;
+  return remoteSize(file, size) ? readRange(file, 0, size, abort) : "";
+}
+
+std::string FileReader::readRange(const std::string &file, size_t begin, size_t end, std::atomic<bool> *abort) {
+  if (end <= begin) return {};
+
+  if (!isRemoteFile(file)) {
+    std::ifstream f(file, std::ios::binary);
+    std::string result(end - begin, '\0');
+    f.seekg(begin);
+    f.read(result.data(), result.size());
+    result.resize(f.gcount());
+    return result;
+  }
+  if (!cache_) {
+    return download(file, begin, end, abort);
+  }
+
   std::string result;
+  if (cache_->get(file, begin, end, result)) {
+    return result;
+  }
+
+  size_t file_size = 0;
+  if (!remoteSize(file, file_size)) return {};
 
-  if ((!is_remote || cache_to_local_) && util::file_exists(local_file)) {
-    result = util::read_file(local_file);
-  } else if (is_remote) {
-    result = download(file, abort);
-    if (cache_to_local_ && !result.empty()) {
-      std::ofstream fs(local_file, std::ios::binary | std::ios::out);
-      fs.write(result.data(), result.size());
+  end = std::min(end, file_size);
+  if (begin >= end) return {};
+
+  // download the runs of missing chunks, one request per run
+  const size_t first_chunk = begin / CACHE_CHUNK_SIZE;
+  const size_t num_chunks = (end - 1) / CACHE_CHUNK_SIZE - first_chunk + 1;
+  std::vector<std::string> chunks(num_chunks);
+  std::vector<bool> cached(num_chunks);
+  for (size_t i = 0; i < num_chunks; ++i) {
+    const size_t chunk_begin = (first_chunk + i) * CACHE_CHUNK_SIZE;
+    cached[i] = cache_->get(file, chunk_begin, chunk_begin + CACHE_CHUNK_SIZE, chunks[i]);
+  }
+  for (size_t i = 0; i < num_chunks && !(abort && *abort);) {
+    if (cached[i]) {
+      ++i;
+      continue;
+    }
+    size_t run_end = i + 1;
+    while (run_end < num_chunks && !cached[run_end]) ++run_end;
+
+    const size_t run_begin_byte = (first_chunk + i) * CACHE_CHUNK_SIZE;
+    const std::string data = download(file, run_begin_byte, std::min((first_chunk + run_end) * CACHE_CHUNK_SIZE, file_size), abort);
+    if (data.empty()) return {};
+
+    cache_->put(file, file_size, run_begin_byte, data);
+    for (size_t offset = 0; i < run_end; ++i, offset += CACHE_CHUNK_SIZE) {
+      chunks[i] = data.substr(offset, CACHE_CHUNK_SIZE);
     }
   }
+  if (abort && *abort) return {};
+
+  result.clear();
+  result.reserve(end - begin);
+  for (size_t i = 0; i < num_chunks; ++i) {
+    const size_t chunk_begin = (first_chunk + i) * CACHE_CHUNK_SIZE;
+    const size_t from = std::max(begin, chunk_begin) - chunk_begin;
+    const size_t to = std::min(end - chunk_begin, chunks[i].size());
+    result.append(chunks[i], from, to - from);
+  }
   return result;
 }
 
-std::string FileReader::download(const std::string &url, std::atomic<bool> *abort) {
+bool FileReader::remoteSize(const std::string &url, size_t &size) {
+  if (cache_ && cache_->getSize(url, size)) return true;
+
+  size = 0;
+  for (int i = 0; i <= max_retries_ && size == 0; ++i) {
+    size = getRemoteFileSize(url);
+  }
+  return size > 0;
+}
+
+std::string FileReader::download(const std::string &url, size_t begin, size_t end, std::atomic<bool> *abort) {
   for (int i = 0; i <= max_retries_ && !(abort && *abort); ++i) {
-    std::string result = httpGet(url, chunk_size_, abort);
+    std::string result = httpGetRange(url, begin, end, chunk_size_, abort);
     if (!result.empty()) {
       return result;
     }
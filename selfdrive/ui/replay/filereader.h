@@ -3,18 +3,63 @@
 #include <atomic>
 #include <string>
 
+// same chunk size as tools/lib/url_file.py, so both share the cached chunks
+const size_t CACHE_CHUNK_SIZE = 1000 * 1000;
+const size_t DEFAULT_CACHE_MAX_BYTES = 10ULL * 1024 * 1024 * 1024;
+
+// Size-capped download cache shared by all replay processes and tools/lib/url_file.py.
+// Remote files are stored as fixed-size chunks <root>/<sha256(url)>_<n>.0 next to the file size in
+// <root>/<sha256(url)>_length, so partially read files (e.g. a few GOPs of a video) are reusable.
+// Chunks, whole files and the frame indexes (.vidx) of FrameReader are evicted least recently used first
+// (by mtime, which is refreshed on every hit) once the total size exceeds the budget. Files are written to
+// a temp file and renamed into place, and eviction holds an exclusive flock on <root>/.cache.lock, so
+// concurrent processes never see partial chunks.
+class DownloadCache {
+public:
+  DownloadCache(const std::string &root, size_t max_bytes = DEFAULT_CACHE_MAX_BYTES);
+  // the cache in COMMA_CACHE, limited to COMMA_CACHE_MAX_MB
+  static DownloadCache &instance();
+
+  // returns false if the size or any chunk of [begin, end) is not cached.
+  bool getSize(const std::string &url, size_t &size);
+  bool get(const std::string &url, size_t begin, size_t end, std::string &out);
+  // data is the chunk-aligned range of the file starting at begin.
+  void put(const std::string &url, size_t file_size, size_t begin, const std::string &data);
+
+  size_t usedBytes();
+  inline const std::string &root() const { return root_; }
+  inline size_t maxBytes() const { return max_bytes_; }
+
+private:
+  std::string filePrefix(const std::string &url) const;
+  bool readChunk(const std::string &prefix, size_t idx, size_t chunk_size, std::string &out);
+  bool writeFile(const std::string &path, const char *data, size_t size);
+  size_t evict(size_t target_bytes);
+
+  std::string root_;
+  size_t max_bytes_;
+  // bytes written by this process since the last scan. each process rescans after writing
+  // a tenth of the budget, so the cache can't grow much beyond it between scans.
+  std::atomic<size_t> written_since_scan_ = 0;
+};
+
 class FileReader {
 public:
-  FileReader(bool cache_to_local, size_t chunk_size = 0, int retries = 3)
-      : cache_to_local_(cache_to_local), chunk_size_(chunk_size), max_retries_(retries) {}
+  FileReader(bool cache_to_local, size_t chunk_size = 0, int retries = 3, DownloadCache *cache = nullptr)
+      : chunk_size_(chunk_size), max_retries_(retries),
+        cache_(cache ? cache : (cache_to_local ? &DownloadCache::instance() : nullptr)) {}
   virtual ~FileReader() {}
   std::string read(const std::string &file, std::atomic<bool> *abort = nullptr);
+  // read bytes [begin, end) of a file. only the chunks not in the cache are downloaded.
+  std::string readRange(const std::string &file, size_t begin, size_t end, std::atomic<bool> *abort = nullptr);
 
 private:
-  std::string download(const std::string &url, std::atomic<bool> *abort);
+  std::string download(const std::string &url, size_t begin, size_t end, std::atomic<bool> *abort);
+  bool remoteSize(const std::string &url, size_t &size);
   size_t chunk_size_;
   int max_retries_;
-  bool cache_to_local_;
+  DownloadCache *cache_;
 };
 
 std::string cacheFilePath(const std::string &url);
+bool isRemoteFile(const std::string &file);
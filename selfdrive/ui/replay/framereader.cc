@@ -1,28 +1,19 @@
 #include "selfdrive/ui/replay/framereader.h"
 
+#include <algorithm>
 #include <cassert>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
 #include "libyuv.h"
 
 #include "cereal/visionipc/visionbuf.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/ui/replay/util.h"
 
 namespace {
 
-struct buffer_data {
-  const uint8_t *data;
-  int64_t offset;
-  size_t size;
-};
-
-int readPacket(void *opaque, uint8_t *buf, int buf_size) {
-  struct buffer_data *bd = (struct buffer_data *)opaque;
-  buf_size = std::min((size_t)buf_size, bd->size - bd->offset);
-  if (!buf_size) return AVERROR_EOF;
-
-  memcpy(buf, bd->data + bd->offset, buf_size);
-  bd->offset += buf_size;
-  return buf_size;
-}
-
 enum AVPixelFormat get_hw_format(AVCodecContext *ctx, const enum AVPixelFormat *pix_fmts) {
   enum AVPixelFormat *hw_pix_fmt = reinterpret_cast<enum AVPixelFormat *>(ctx->opaque);
   for (const enum AVPixelFormat *p = pix_fmts; *p != -1; p++) {
@@ -34,11 +25,36 @@ enum AVPixelFormat get_hw_format(AVCodecContext *ctx, const enum AVPixelFormat *
   return AV_PIX_FMT_YUV420P;
 }
 
+bool isRawHevc(const std::string &url) {
+  const std::string path = getUrlWithoutQuery(url);
+  const std::string ext = ".hevc";
+  return path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
 }  // namespace
 
-FrameReader::FrameReader() {}
+int FrameReader::readPacket(void *opaque, uint8_t *buf, int buf_size) {
+  struct buffer_data *bd = (struct buffer_data *)opaque;
+  buf_size = std::min((size_t)buf_size, bd->size - bd->offset);
+  if (!buf_size) return AVERROR_EOF;
+
+  memcpy(buf, bd->data + bd->offset, buf_size);
+  bd->offset += buf_size;
+  return buf_size;
+}
+
+FrameReader::FrameReader(size_t cache_size, int prefetch_frames) : cache_size_(cache_size), prefetch_frames_(prefetch_frames) {}
 
 FrameReader::~FrameReader() {
+  abort_fetch_ = true;
+  {
+    std::lock_guard lk(cache_lock_);
+    exit_ = true;
+  }
+  prefetch_cv_.notify_one();
+  if (prefetch_thread_.joinable()) {
+    prefetch_thread_.join();
+  }
   for (AVPacket *pkt : packets) {
     av_packet_free(&pkt);
   }
@@ -54,25 +70,95 @@ FrameReader::~FrameReader() {
 }
 
 bool FrameReader::load(const std::string &url, bool no_cuda, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
+  const bool is_remote = isRemoteFile(url);
+  const bool is_hevc = isRawHevc(url);
+  const std::string index_file = is_remote ? cacheFilePath(url) + ".vidx" : "";
+  if (is_remote && is_hevc && index_.load(index_file)) {
+    // the frame index is cached, only read GOPs when they are decoded.
+    // refresh its position in the download cache LRU.
+    utimensat(AT_FDCWD, index_file.c_str(), nullptr, 0);
+    // with local_cache, GOPs downloaded before are read from the download cache.
+    url_ = url;
+    file_reader_ = std::make_unique<FileReader>(local_cache, chunk_size, retries);
+    return openIndexedStream(no_cuda);
+  }
+
   FileReader f(local_cache, chunk_size, retries);
   std::string data = f.read(url, abort);
   if (data.empty()) return false;
 
+  if (is_hevc && index_.build((const uint8_t *)data.data(), data.size())) {
+    if (is_remote) {
+      index_.save(index_file);
+    }
+    data_ = std::move(data);
+    return openIndexedStream(no_cuda);
+  }
   return load((std::byte *)data.data(), data.size(), no_cuda, abort);
 }
 
 bool FrameReader::load(const std::byte *data, size_t size, bool no_cuda, std::atomic<bool> *abort) {
+  if (index_.build((const uint8_t *)data, size)) {
+    data_.assign((const char *)data, size);
+    return openIndexedStream(no_cuda);
+  }
+
+  if (!openDecoder(data, size, no_cuda)) return false;
+
+  int ret = 0;
+  packets.reserve(60 * 20);  // 20fps, one minute
+  while (!(abort && *abort)) {
+    AVPacket *pkt = av_packet_alloc();
+    ret = av_read_frame(input_ctx, pkt);
+    if (ret < 0) {
+      av_packet_free(&pkt);
+      valid_ = (ret == AVERROR_EOF);
+      break;
+    }
+    packets.push_back(pkt);
+    // some stream seems to contian no keyframes
+    key_frames_count_ += pkt->flags & AV_PKT_FLAG_KEY;
+  }
+  // the packets own their data, the input isn't read again
+  bd_ = {};
+  frame_count_ = packets.size();
+  valid_ = valid_ && !packets.empty();
+  return valid_;
+}
+
+bool FrameReader::openIndexedStream(bool no_cuda) {
+  frame_count_ = index_.frameCount();
+  for (int i = 0; i < frame_count_; ++i) {
+    key_frames_count_ += index_.isKeyFrame(i);
+  }
+
+  // probe the stream from the first GOP if the file isn't loaded
+  std::string probe_data;
+  if (data_.empty()) {
+    GopPtr gop = fetchGOP(0);
+    if (!gop) return false;
+
+    probe_data = index_.prefix + *gop;
+  }
+  const std::string &probe = data_.empty() ? probe_data : data_;
+  valid_ = openDecoder((const std::byte *)probe.data(), probe.size(), no_cuda) && frame_count_ > 0;
+  // frames are sent to the decoder straight from the index, the demuxer doesn't read the probe data again
+  bd_ = {};
+  return valid_;
+}
+
+bool FrameReader::openDecoder(const std::byte *data, size_t size, bool no_cuda) {
   input_ctx = avformat_alloc_context();
   if (!input_ctx) return false;
 
-  struct buffer_data bd = {
+  bd_ = {
     .data = (const uint8_t*)data,
     .offset = 0,
     .size = size,
   };
   const int avio_ctx_buffer_size = 64 * 1024;
   unsigned char *avio_ctx_buffer = (unsigned char *)av_malloc(avio_ctx_buffer_size);
-  avio_ctx_ = avio_alloc_context(avio_ctx_buffer, avio_ctx_buffer_size, 0, &bd, readPacket, nullptr, nullptr);
+  avio_ctx_ = avio_alloc_context(avio_ctx_buffer, avio_ctx_buffer_size, 0, &bd_, readPacket, nullptr, nullptr);
   input_ctx->pb = avio_ctx_;
 
   input_ctx->probesize = 10 * 1024 * 1024;  // 10MB
@@ -98,6 +184,13 @@ bool FrameReader::load(const std::byte *data, size_t size, bool no_cuda, std::at
   ret = avcodec_parameters_to_context(decoder_ctx, video->codecpar);
   if (ret != 0) return false;
 
+  // parameter sets are only written at the start of the file, the decoder needs them to start from any keyframe.
+  if (frame_count_ > 0 && !index_.prefix.empty() && !decoder_ctx->extradata) {
+    decoder_ctx->extradata = (uint8_t *)av_mallocz(index_.prefix.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+    memcpy(decoder_ctx->extradata, index_.prefix.data(), index_.prefix.size());
+    decoder_ctx->extradata_size = index_.prefix.size();
+  }
+
   width = (decoder_ctx->width + 3) & ~3;
   height = decoder_ctx->height;
   visionbuf_compute_aligned_width_and_height(width, height, &aligned_width, &aligned_height);
@@ -105,29 +198,14 @@ bool FrameReader::load(const std::byte *data, size_t size, bool no_cuda, std::at
   if (has_cuda_device && !no_cuda) {
     if (!initHardwareDecoder(AV_HWDEVICE_TYPE_CUDA)) {
       printf("No CUDA capable device was found. fallback to CPU decoding.\n");
-    } else {
-      nv12toyuv_buffer.resize(getYUVSize());
     }
   }
 
-  ret = avcodec_open2(decoder_ctx, decoder, nullptr);
-  if (ret < 0) return false;
+  // keep room for the current frame and don't let prefetching evict frames it just decoded.
+  prefetch_frames_ = std::min(prefetch_frames_, (int)(cache_size_ / getYUVSize()) - 2);
 
-  packets.reserve(60 * 20);  // 20fps, one minute
-  while (!(abort && *abort)) {
-    AVPacket *pkt = av_packet_alloc();
-    ret = av_read_frame(input_ctx, pkt);
-    if (ret < 0) {
-      av_packet_free(&pkt);
-      valid_ = (ret == AVERROR_EOF);
-      break;
-    }
-    packets.push_back(pkt);
-    // some stream seems to contian no keyframes
-    key_frames_count_ += pkt->flags & AV_PKT_FLAG_KEY;
-  }
-  valid_ = valid_ && !packets.empty();
-  return valid_;
+  ret = avcodec_open2(decoder_ctx, decoder, nullptr);
+  return ret >= 0;
 }
 
 bool FrameReader::initHardwareDecoder(AVHWDeviceType hw_device_type) {
@@ -160,18 +238,93 @@ bool FrameReader::initHardwareDecoder(AVHWDeviceType hw_device_type) {
 
 bool FrameReader::get(int idx, uint8_t *rgb, uint8_t *yuv) {
   assert(rgb || yuv);
-  if (!valid_ || idx < 0 || idx >= packets.size()) {
+  if (!valid_ || idx < 0 || idx >= frame_count_) {
     return false;
   }
-  return decode(idx, rgb, yuv);
+
+  FramePtr frame = getFrame(idx);
+  if (!frame) return false;
+
+  // the decoder's output is written straight into the caller's buffers, e.g. the vipc buffers of CameraServer
+  const AVFrame *f = frame.get();
+  if (f->format == AV_PIX_FMT_NV12) {
+    if (!yuv && nv12toyuv_buffer_.empty()) {
+      nv12toyuv_buffer_.resize(getYUVSize());
+    }
+    uint8_t *y = yuv ? yuv : nv12toyuv_buffer_.data();
+    uint8_t *u = y + width * height;
+    uint8_t *v = u + (width / 2) * (height / 2);
+    libyuv::NV12ToI420(f->data[0], f->linesize[0], f->data[1], f->linesize[1],
+                       y, width, u, width / 2, v, width / 2, width, height);
+    if (rgb) {
+      libyuv::I420ToRGB24(y, width, u, width / 2, v, width / 2,
+                          rgb, aligned_width * 3, width, height);
+    }
+  } else {
+    if (yuv) {
+      uint8_t *u = yuv + width * height;
+      uint8_t *v = u + (width / 2) * (height / 2);
+      libyuv::I420Copy(f->data[0], f->linesize[0],
+                       f->data[1], f->linesize[1],
+                       f->data[2], f->linesize[2],
+                       yuv, width, u, width / 2, v, width / 2,
+                       width, height);
+    }
+    if (rgb) {
+      libyuv::I420ToRGB24(f->data[0], f->linesize[0],
+                          f->data[1], f->linesize[1],
+                          f->data[2], f->linesize[2],
+                          rgb, aligned_width * 3, width, height);
+    }
+  }
+  return true;
 }
 
-bool FrameReader::decode(int idx, uint8_t *rgb, uint8_t *yuv) {
+FrameCacheStats FrameReader::cacheStats() {
+  std::lock_guard lk(cache_lock_);
+  return stats_;
+}
+
+FrameReader::FramePtr FrameReader::getFrame(int idx) {
+  if (prefetch_frames_ > 0) {
+    std::call_once(prefetch_started_, [this]() { prefetch_thread_ = std::thread(&FrameReader::prefetchThread, this); });
+  }
+  {
+    std::lock_guard lk(cache_lock_);
+    playhead_ = idx;
+  }
+  prefetch_cv_.notify_one();
+
+  FramePtr frame = findCachedFrame(idx);
+  if (!frame) {
+    GopPtr gop = fetchGOPOf(idx);
+    std::lock_guard lk(decode_lock_);
+    // the prefetch thread may have decoded it while waiting for the decoder
+    if (!(frame = findCachedFrame(idx))) {
+      frame = decode(idx, gop.get());
+      std::lock_guard cache_lk(cache_lock_);
+      ++stats_.misses;
+    }
+  }
+  return frame;
+}
+
+FrameReader::FramePtr FrameReader::findCachedFrame(int idx) {
+  std::lock_guard lk(cache_lock_);
+  auto it = cache_.find(idx);
+  if (it == cache_.end()) return nullptr;
+
+  lru_.splice(lru_.begin(), lru_, it->second);
+  ++stats_.hits;
+  return it->second->frame;
+}
+
+FrameReader::FramePtr FrameReader::decode(int idx, const std::string *gop) {
   int from_idx = idx;
   if (idx != prev_idx + 1 && key_frames_count_ > 1) {
     // seeking to the nearest key frame
     for (int i = idx; i >= 0; --i) {
-      if (packets[i]->flags & AV_PKT_FLAG_KEY) {
+      if (isKeyFrame(i)) {
         from_idx = i;
         break;
       }
@@ -179,13 +332,83 @@ bool FrameReader::decode(int idx, uint8_t *rgb, uint8_t *yuv) {
   }
   prev_idx = idx;
 
+  // every frame decoded on the way is cached, so reordered requests within the GOP are cheap.
   for (int i = from_idx; i <= idx; ++i) {
-    AVFrame *f = decodeFrame(packets[i]);
-    if (f && i == idx) {
-      return copyBuffers(f, rgb, yuv);
+    AVFrame *f = decodeFrameAt(i, gop);
+    if (f) {
+      FramePtr frame = cacheFrame(i, f);
+      if (i == idx) return frame;
+    }
+  }
+  return nullptr;
+}
+
+bool FrameReader::isKeyFrame(int idx) const {
+  return packets.empty() ? index_.isKeyFrame(idx) : (packets[idx]->flags & AV_PKT_FLAG_KEY);
+}
+
+FrameReader::GopPtr FrameReader::fetchGOP(int key_frame) {
+  std::promise<GopPtr> download;
+  std::shared_future<GopPtr> gop;
+  bool downloading = false;
+  {
+    std::lock_guard lk(gop_lock_);
+    auto it = std::find_if(gops_.begin(), gops_.end(), [=](auto &g) { return g.first == key_frame; });
+    if (it != gops_.end()) {
+      gops_.splice(gops_.begin(), gops_, it);
+      gop = it->second;
+    } else {
+      gop = download.get_future().share();
+      downloading = true;
+      gops_.emplace_front(key_frame, gop);
+      if (gops_.size() > MAX_CACHED_GOPS) {
+        gops_.pop_back();
+      }
+    }
+  }
+
+  // the download holds no lock, get() and the prefetch thread only wait for the GOP they need
+  if (downloading) {
+    const size_t begin = index_.offset(key_frame);
+    const size_t end = index_.offset(index_.nextKeyFrame(key_frame));
+    std::string data = file_reader_->readRange(url_, begin, end, &abort_fetch_);
+    download.set_value(data.empty() ? nullptr : std::make_shared<const std::string>(std::move(data)));
+    if (!gop.get()) {
+      // forget the failed download, the next request retries it
+      std::lock_guard lk(gop_lock_);
+      gops_.remove_if([&](auto &g) {
+        return g.first == key_frame && g.second.wait_for(std::chrono::seconds(0)) == std::future_status::ready && !g.second.get();
+      });
     }
   }
-  return false;
+  return gop.get();
+}
+
+FrameReader::GopPtr FrameReader::fetchGOPOf(int idx) {
+  // only remote files with a cached index are read by GOP
+  return url_.empty() ? nullptr : fetchGOP(index_.keyFrameBefore(idx));
+}
+
+AVFrame *FrameReader::decodeFrameAt(int idx, const std::string *gop) {
+  if (!packets.empty()) {
+    return decodeFrame(packets[idx]);
+  }
+
+  const uint8_t *data = nullptr;
+  if (!data_.empty()) {
+    data = (const uint8_t *)data_.data() + index_.offset(idx);
+  } else if (gop) {
+    data = (const uint8_t *)gop->data() + index_.offset(idx) - index_.offset(index_.keyFrameBefore(idx));
+  }
+  if (!data) return nullptr;
+
+  // avcodec_send_packet copies non-refcounted packet data into a padded buffer
+  AVPacket *pkt = av_packet_alloc();
+  pkt->data = (uint8_t *)data;
+  pkt->size = index_.frameSize(idx);
+  AVFrame *f = decodeFrame(pkt);
+  av_packet_free(&pkt);
+  return f;
 }
 
 AVFrame *FrameReader::decodeFrame(AVPacket *pkt) {
@@ -213,29 +436,65 @@ AVFrame *FrameReader::decodeFrame(AVPacket *pkt) {
   }
 }
 
-bool FrameReader::copyBuffers(AVFrame *f, uint8_t *rgb, uint8_t *yuv) {
-  if (hw_pix_fmt == AV_PIX_FMT_CUDA) {
-    uint8_t *y = yuv ? yuv : nv12toyuv_buffer.data();
-    uint8_t *u = y + width * height;
-    uint8_t *v = u + (width / 2) * (height / 2);
-    libyuv::NV12ToI420(f->data[0], f->linesize[0], f->data[1], f->linesize[1],
-                       y, width, u, width / 2, v, width / 2, width, height);
-    libyuv::I420ToRGB24(y, width, u, width / 2, v, width / 2,
-                        rgb, aligned_width * 3, width, height);
-  } else {
-    if (yuv) {
-      uint8_t *u = yuv + width * height;
-      uint8_t *v = u + (width / 2) * (height / 2);
-      libyuv::I420Copy(f->data[0], f->linesize[0],
-                       f->data[1], f->linesize[1],
-                       f->data[2], f->linesize[2],
-                       yuv, width, u, width / 2, v, width / 2,
-                       width, height);
+FrameReader::FramePtr FrameReader::cacheFrame(int idx, AVFrame *f) {
+  // a new reference to the decoded buffers, the pixels aren't copied
+  FramePtr frame(av_frame_clone(f), AVFrameDeleter());
+  if (!frame) return nullptr;
+
+  size_t frame_size = 0;
+  for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; ++i) {
+    frame_size += frame->buf[i]->size;
+  }
+
+  std::lock_guard lk(cache_lock_);
+  if (auto it = cache_.find(idx); it != cache_.end()) {
+    return it->second->frame;
+  }
+
+  while (!lru_.empty() && stats_.bytes + frame_size > cache_size_) {
+    evict(std::prev(lru_.end()));
+  }
+  lru_.push_front({idx, frame, frame_size});
+  cache_[idx] = lru_.begin();
+  stats_.bytes += frame_size;
+  return frame;
+}
+
+void FrameReader::evict(std::list<CachedFrame>::iterator it) {
+  cache_.erase(it->idx);
+  stats_.bytes -= it->size;
+  ++stats_.evicted;
+  lru_.erase(it);
+}
+
+int FrameReader::nextPrefetchIndex() {
+  if (playhead_ < 0) return -1;
+
+  const int last = std::min(playhead_ + prefetch_frames_, frame_count_ - 1);
+  for (int i = playhead_ + 1; i <= last; ++i) {
+    if (cache_.find(i) == cache_.end()) return i;
+  }
+  return -1;
+}
+
+void FrameReader::prefetchThread() {
+  while (true) {
+    int idx = -1;
+    {
+      std::unique_lock lk(cache_lock_);
+      prefetch_cv_.wait(lk, [&]() { return exit_ || (idx = nextPrefetchIndex()) != -1; });
+      if (exit_) break;
+    }
+
+    GopPtr gop = fetchGOPOf(idx);
+    std::lock_guard lk(decode_lock_);
+    bool decoded = decode(idx, gop.get()) != nullptr;
+    std::lock_guard cache_lk(cache_lock_);
+    if (decoded) {
+      ++stats_.prefetched;
+    } else if (playhead_ < idx) {
+      // don't retry a broken frame until the playhead moves
+      playhead_ = -1;
     }
-    libyuv::I420ToRGB24(f->data[0], f->linesize[0],
-                        f->data[1], f->linesize[1],
-                        f->data[2], f->linesize[2],
-                        rgb, aligned_width * 3, width, height);
   }
-  return true;
 }
@@ -1,52 +1,131 @@
 #pragma once
 
+#include <condition_variable>
+#include <future>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "selfdrive/ui/replay/filereader.h"
+#include "selfdrive/ui/replay/vidindex.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 }
 
+constexpr size_t DEFAULT_FRAME_CACHE_SIZE = 64 * 1024 * 1024;
+constexpr int DEFAULT_PREFETCH_FRAMES = 10;
+// the GOP being decoded and the next one, which the prefetch thread reads ahead into
+constexpr size_t MAX_CACHED_GOPS = 2;
+
 struct AVFrameDeleter {
   void operator()(AVFrame* frame) const { av_frame_free(&frame); }
 };
 
+struct FrameCacheStats {
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t prefetched = 0;
+  size_t evicted = 0;
+  size_t bytes = 0;
+};
+
 class FrameReader {
 public:
-  FrameReader();
+  // decoded frames are kept in a LRU cache of at most cache_size bytes.
+  // a background thread decodes up to prefetch_frames ahead of the last requested frame.
+  FrameReader(size_t cache_size = DEFAULT_FRAME_CACHE_SIZE, int prefetch_frames = DEFAULT_PREFETCH_FRAMES);
   ~FrameReader();
   bool load(const std::string &url, bool no_cuda = false, std::atomic<bool> *abort = nullptr, bool local_cache = false, int chunk_size = -1, int retries = 0);
   bool load(const std::byte *data, size_t size, bool no_cuda = false, std::atomic<bool> *abort = nullptr);
   bool get(int idx, uint8_t *rgb, uint8_t *yuv);
   int getRGBSize() const { return aligned_width * aligned_height * 3; }
   int getYUVSize() const { return width * height * 3 / 2; }
-  size_t getFrameCount() const { return packets.size(); }
+  size_t getFrameCount() const { return frame_count_; }
   bool valid() const { return valid_; }
+  FrameCacheStats cacheStats();
 
   int width = 0, height = 0;
   int aligned_width = 0, aligned_height = 0;
 
 private:
+  // a cached frame references the decoder's output, its pixels are only written once, into the buffers passed to get()
+  typedef std::shared_ptr<AVFrame> FramePtr;
+  typedef std::shared_ptr<const std::string> GopPtr;
+  struct CachedFrame {
+    int idx;
+    FramePtr frame;
+    size_t size;
+  };
+  static int readPacket(void *opaque, uint8_t *buf, int buf_size);
+  bool openDecoder(const std::byte *data, size_t size, bool no_cuda);
+  bool openIndexedStream(bool no_cuda);
   bool initHardwareDecoder(AVHWDeviceType hw_device_type);
-  bool decode(int idx, uint8_t *rgb, uint8_t *yuv);
+  bool isKeyFrame(int idx) const;
+  GopPtr fetchGOP(int key_frame);
+  GopPtr fetchGOPOf(int idx);
+  FramePtr getFrame(int idx);
+  FramePtr decode(int idx, const std::string *gop);
+  AVFrame * decodeFrameAt(int idx, const std::string *gop);
   AVFrame * decodeFrame(AVPacket *pkt);
-  bool copyBuffers(AVFrame *f, uint8_t *rgb, uint8_t *yuv);
+  FramePtr cacheFrame(int idx, AVFrame *f);
+  FramePtr findCachedFrame(int idx);
+  void evict(std::list<CachedFrame>::iterator it);
+  int nextPrefetchIndex();
+  void prefetchThread();
 
+  // demuxed packets of container formats (qcamera.ts)
   std::vector<AVPacket*> packets;
+  // raw HEVC streams are decoded straight from the file bytes through a frame index.
+  // if the index of a remote file is cached, GOPs are read on demand and the last MAX_CACHED_GOPS are kept.
+  // they're downloaded without holding decode_lock_, concurrent requests of a GOP wait for the same download.
+  VideoIndex index_;
+  std::string data_;
+  std::mutex gop_lock_;
+  std::list<std::pair<int, std::shared_future<GopPtr>>> gops_;
+  std::string url_;
+  std::unique_ptr<FileReader> file_reader_;
+  std::atomic<bool> abort_fetch_ = false;
+  int frame_count_ = 0;
   std::unique_ptr<AVFrame, AVFrameDeleter>av_frame_, hw_frame;
   AVFormatContext *input_ctx = nullptr;
   AVCodecContext *decoder_ctx = nullptr;
   int key_frames_count_ = 0;
   bool valid_ = false;
+  // the data read by avio_ctx_, it's demuxed after openDecoder() returns
+  struct buffer_data {
+    const uint8_t *data = nullptr;
+    int64_t offset = 0;
+    size_t size = 0;
+  } bd_;
   AVIOContext *avio_ctx_ = nullptr;
 
   AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
   AVBufferRef *hw_device_ctx = nullptr;
-  std::vector<uint8_t> nv12toyuv_buffer;
   int prev_idx = -1;
   inline static std::atomic<bool> has_cuda_device = true;
+
+  // the decoder is shared by get() and the prefetch thread
+  std::mutex decode_lock_;
+
+  const size_t cache_size_;
+  // the following variables must be protected with cache_lock_
+  std::mutex cache_lock_;
+  std::list<CachedFrame> lru_;
+  std::unordered_map<int, std::list<CachedFrame>::iterator> cache_;
+  FrameCacheStats stats_;
+  int playhead_ = -1;
+  bool exit_ = false;
+
+  // hw decoded frames are NV12, they're converted to I420 here if get() isn't asked for yuv
+  std::vector<uint8_t> nv12toyuv_buffer_;
+  int prefetch_frames_;
+  std::once_flag prefetch_started_;
+  std::condition_variable prefetch_cv_;
+  std::thread prefetch_thread_;
 };
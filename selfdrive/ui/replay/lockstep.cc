@@ -0,0 +1,168 @@
+#include "selfdrive/ui/replay/lockstep.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <future>
+
+#include "selfdrive/common/timing.h"
+
+LockstepReplay::LockstepReplay(const QString &route, const QString &data_dir, bool local_cache) : local_cache_(local_cache) {
+  route_ = std::make_unique<Route>(route, data_dir);
+}
+
+bool LockstepReplay::load() {
+  if (!route_->load()) {
+    qCritical() << "failed to load route" << route_->name();
+    return false;
+  }
+  return true;
+}
+
+void LockstepReplay::addConsumer(const Consumer &consumer) {
+  const size_t num_services = capnp::Schema::from<cereal::Event>().asStruct().getUnionFields().size();
+  ConsumerState &c = consumers_.emplace_back();
+  c.consumer = consumer;
+  c.wants.resize(num_services, consumer.inputs.empty());
+  for (auto which : consumer.inputs) {
+    c.wants[which] = true;
+  }
+}
+
+std::unique_ptr<LogReader> LockstepReplay::loadLog(const SegmentFile &files, bool local_cache, std::atomic<bool> *abort) {
+  const QString &file = files.rlog.isEmpty() ? files.qlog : files.rlog;
+  if (file.isEmpty()) return nullptr;
+
+  auto log = std::make_unique<LogReader>();
+  return log->load(file.toStdString(), abort, local_cache, 0, 3) ? std::move(log) : nullptr;
+}
+
+int LockstepReplay::run(int begin_segment, int end_segment) {
+  std::vector<int> segments;
+  for (const auto &[n, files] : route_->segments()) {
+    if (n >= begin_segment && n <= end_segment) {
+      segments.push_back(n);
+    }
+  }
+
+  auto load_async = [this](int n) {
+    return std::async(std::launch::async, &LockstepReplay::loadLog, route_->at(n), local_cache_, nullptr);
+  };
+
+  int replayed = 0;
+  std::future<std::unique_ptr<LogReader>> next_log;
+  if (!segments.empty()) {
+    next_log = load_async(segments[0]);
+  }
+  for (int i = 0; i < segments.size(); ++i) {
+    std::unique_ptr<LogReader> log = next_log.get();
+    if (i + 1 < segments.size()) {
+      next_log = load_async(segments[i + 1]);
+    }
+    if (!log) {
+      qWarning() << "failed to load log of segment" << segments[i] << ", skipping it";
+      continue;
+    }
+
+    replayLog(*log);
+    ++replayed;
+  }
+  finish();
+  return replayed;
+}
+
+void LockstepReplay::finish() {
+  // flush the inputs delivered after the last step
+  for (auto &c : consumers_) {
+    if (c.pending.inputs > 0) {
+      runStep(c, c.pending.mono_time);
+    }
+  }
+}
+
+void LockstepReplay::replayLog(const LogReader &log) {
+  const double start_ms = millis_since_boot();
+  for (const Event &e : log.events) {
+    // the duplicated encodeIdx events are only used to publish frames
+    if (e.frame) continue;
+
+    ++num_events_;
+    std::optional<Event::Message> msg;
+    for (auto &c : consumers_) {
+      const Consumer &consumer = c.consumer;
+      if (consumer.period_ns > 0) {
+        if (c.next_step == 0) {
+          c.next_step = e.mono_time + consumer.period_ns;
+        }
+        // run the steps that are due before this event
+        while (e.mono_time >= c.next_step) {
+          runStep(c, c.next_step);
+          c.next_step += consumer.period_ns;
+        }
+      }
+
+      if (c.wants[e.which] && consumer.handle) {
+        if (!msg) msg.emplace(e);
+
+        const uint64_t start_ns = nanos_since_boot();
+        consumer.handle(msg->event);
+        c.pending.compute_ns += nanos_since_boot() - start_ns;
+        ++c.pending.inputs;
+      }
+      c.pending.mono_time = e.mono_time;
+
+      if (consumer.trigger && *consumer.trigger == e.which) {
+        runStep(c, e.mono_time);
+      }
+    }
+  }
+  wall_time_ms_ += millis_since_boot() - start_ms;
+}
+
+void LockstepReplay::runStep(ConsumerState &c, uint64_t mono_time) {
+  c.outputs.clear();
+  if (c.consumer.step) {
+    const uint64_t start_ns = nanos_since_boot();
+    c.consumer.step(mono_time, c.outputs);
+    c.pending.compute_ns += nanos_since_boot() - start_ns;
+  }
+  c.pending.mono_time = mono_time;
+  c.pending.outputs = c.outputs.size();
+  c.steps.push_back(c.pending);
+  c.pending = {};
+
+  if (output_callback) {
+    for (const auto &out : c.outputs) {
+      output_callback(c.consumer.name, mono_time, out);
+    }
+  }
+}
+
+void LockstepReplay::printStats() const {
+  qInfo().noquote() << QString("replayed %1 events in %2 ms (%3 events/s)")
+                           .arg(num_events_)
+                           .arg(wall_time_ms_, 0, 'f', 1)
+                           .arg(wall_time_ms_ > 0 ? num_events_ / (wall_time_ms_ / 1000.) : 0, 0, 'f', 0);
+  for (const auto &c : consumers_) {
+    if (c.steps.empty()) continue;
+
+    std::vector<uint64_t> compute_ns;
+    uint64_t total_ns = 0, inputs = 0;
+    for (const auto &s : c.steps) {
+      compute_ns.push_back(s.compute_ns);
+      total_ns += s.compute_ns;
+      inputs += s.inputs;
+    }
+    std::sort(compute_ns.begin(), compute_ns.end());
+    auto percentile_us = [&](double p) { return compute_ns[std::min<size_t>(compute_ns.size() - 1, p * compute_ns.size())] / 1e3; };
+    qInfo().noquote() << QString("%1: %2 steps, %3 inputs, total %4 ms, per step: mean %5 us, p50 %6 us, p99 %7 us, max %8 us")
+                             .arg(c.consumer.name.c_str())
+                             .arg(c.steps.size())
+                             .arg(inputs)
+                             .arg(total_ns / 1e6, 0, 'f', 1)
+                             .arg(total_ns / 1e3 / c.steps.size(), 0, 'f', 1)
+                             .arg(percentile_us(0.5), 0, 'f', 1)
+                             .arg(percentile_us(0.99), 0, 'f', 1)
+                             .arg(compute_ns.back() / 1e3, 0, 'f', 1);
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <climits>
+#include <functional>
+#include <optional>
+
+#include "selfdrive/ui/replay/route.h"
+
+// Runs consumers (e.g. CANParser::UpdateCans) in-process against the logs of a route,
+// deterministically and as fast as the CPU allows. Time is virtual: a step delivers every input logged up
+// to the step's time to the consumer, then runs it. No messaging, no real-time pacing.
+// The next segment is downloaded and parsed while the current one is stepped.
+class LockstepReplay {
+public:
+  struct Consumer {
+    std::string name;
+    // services delivered to handle(), all services if empty
+    std::vector<cereal::Event::Which> inputs;
+    // a step runs right after each event of the trigger service (e.g. cameraOdometry for locationd),
+    // or every period_ns of log time
+    std::optional<cereal::Event::Which> trigger;
+    uint64_t period_ns = 0;
+    std::function<void(const cereal::Event::Reader &event)> handle;
+    // serialized messages the step produced go into outputs
+    std::function<void(uint64_t mono_time, std::vector<std::string> &outputs)> step;
+  };
+
+  struct StepStats {
+    uint64_t mono_time;
+    uint32_t inputs;
+    uint32_t outputs;
+    uint64_t compute_ns;  // spent in handle() and step()
+  };
+
+  // without a route, logs are fed with replayLog() and finish(), see BatchReplay
+  LockstepReplay() = default;
+  LockstepReplay(const QString &route, const QString &data_dir = {}, bool local_cache = true);
+  bool load();
+  void addConsumer(const Consumer &consumer);
+  // replays segments [begin_segment, end_segment] in order, returns the number of segments replayed.
+  int run(int begin_segment = 0, int end_segment = INT_MAX);
+  // replays the events of one segment. segments must be fed in order.
+  void replayLog(const LogReader &log);
+  // runs the last step of the consumers that have inputs pending
+  void finish();
+  void printStats() const;
+
+  inline size_t consumerCount() const { return consumers_.size(); }
+  inline const std::string &consumerName(int consumer) const { return consumers_[consumer].consumer.name; }
+  inline const std::vector<StepStats> &steps(int consumer) const { return consumers_[consumer].steps; }
+  static std::unique_ptr<LogReader> loadLog(const SegmentFile &files, bool local_cache, std::atomic<bool> *abort = nullptr);
+
+  // called with every output message, in step order
+  std::function<void(const std::string &consumer, uint64_t mono_time, const std::string &msg)> output_callback;
+
+private:
+  struct ConsumerState {
+    Consumer consumer;
+    std::vector<bool> wants;
+    uint64_t next_step = 0;
+    StepStats pending = {};
+    std::vector<StepStats> steps;
+    std::vector<std::string> outputs;
+  };
+  void runStep(ConsumerState &c, uint64_t mono_time);
+
+  std::unique_ptr<Route> route_;
+  bool local_cache_ = true;
+  std::vector<ConsumerState> consumers_;
+  size_t num_events_ = 0;
+  double wall_time_ms_ = 0;
+};
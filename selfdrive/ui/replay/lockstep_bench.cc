@@ -0,0 +1,103 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+
+#include <cstdlib>
+#include <new>
+
+#include "opendbc/can/common.h"
+#include "selfdrive/ui/replay/lockstep.h"
+
+const QString DEMO_ROUTE = "4cf7a6ad03080c90|2021-09-29--13-46-36";
+
+// counts the heap allocations of this thread, to check that consumers don't allocate once warmed up
+static thread_local uint64_t allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = malloc(size)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t size) noexcept { free(p); }
+
+// Profiles consumers against a route without real-time pacing, e.g.
+//   ./lockstep_bench <route> --dbc gm_global_a_powertrain_generated --segments 0-2
+// Only CANParser is driven for now.
+int main(int argc, char *argv[]) {
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Run components in lockstep with the logs of a route and profile them.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("route", "the drive to replay. find your drives at connect.comma.ai");
+  parser.addOption({"demo", "use a demo route instead of providing your own"});
+  parser.addOption({"data_dir", "local directory with routes", "data_dir"});
+  parser.addOption({"segments", "segments to replay, <n> or <begin>-<end>", "segments"});
+  parser.addOption({"dbc", "profile CANParser with this dbc", "dbc"});
+  parser.addOption({"bus", "CAN bus to parse", "bus", "0"});
+  parser.addOption({"no-cache", "turn off local cache"});
+  parser.process(app);
+
+  const QStringList args = parser.positionalArguments();
+  if (args.empty() && !parser.isSet("demo")) {
+    parser.showHelp();
+  }
+
+  int begin_segment = 0, end_segment = INT_MAX;
+  if (parser.isSet("segments")) {
+    const QStringList range = parser.value("segments").split("-");
+    begin_segment = range[0].toInt();
+    end_segment = range.size() > 1 ? range[1].toInt() : begin_segment;
+  }
+
+  LockstepReplay replay(args.empty() ? DEMO_ROUTE : args.first(), parser.value("data_dir"), !parser.isSet("no-cache"));
+  if (!replay.load()) {
+    return 1;
+  }
+
+  // baseline: the cost of delivering every message
+  replay.addConsumer({
+      .name = "decode",
+      .period_ns = 10 * 1000000ULL,
+      .handle = [](const cereal::Event::Reader &event) { (void)event.which(); },
+  });
+
+  // the first steps warm up the parser, allocations after them are counted
+  const int warmup_steps = 100;
+  int can_steps = 0;
+  uint64_t update_allocations = 0, query_allocations = 0;
+  std::unique_ptr<CANParser> can_parser;
+  std::vector<const MessageState *> updated;
+  if (parser.isSet("dbc")) {
+    can_parser = std::make_unique<CANParser>(parser.value("bus").toInt(), parser.value("dbc").toStdString(), true, true);
+    replay.addConsumer({
+        .name = "CANParser",
+        .inputs = {cereal::Event::Which::CAN},
+        .trigger = cereal::Event::Which::CAN,
+        .handle = [&](const cereal::Event::Reader &event) {
+          const uint64_t before = allocations;
+          can_parser->UpdateCans(event.getLogMonoTime(), event.getCan());
+          if (can_steps >= warmup_steps) update_allocations += allocations - before;
+        },
+        .step = [&](uint64_t mono_time, std::vector<std::string> &outputs) {
+          const uint64_t before = allocations;
+          can_parser->UpdateValid(mono_time);
+          can_parser->query_updated(updated);
+          if (can_steps++ >= warmup_steps) query_allocations += allocations - before;
+        },
+    });
+  }
+
+  const int segments = replay.run(begin_segment, end_segment);
+  qInfo() << "replayed" << segments << "segments";
+  replay.printStats();
+  if (can_steps > warmup_steps) {
+    const int steps = can_steps - warmup_steps;
+    qInfo().noquote() << QString("CANParser allocations per step after %1 warmup steps: UpdateCans %2, query_updated %3")
+                             .arg(warmup_steps)
+                             .arg((double)update_allocations / steps, 0, 'f', 2)
+                             .arg((double)query_allocations / steps, 0, 'f', 2);
+  }
+  return segments > 0 ? 0 : 1;
+}
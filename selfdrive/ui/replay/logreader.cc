@@ -4,47 +4,10 @@
 #include <iostream>
 #include "selfdrive/ui/replay/util.h"
 
-Event::Event(const kj::ArrayPtr<const capnp::word> &amsg, bool frame) : reader(amsg), frame(frame) {
-  words = kj::ArrayPtr<const capnp::word>(amsg.begin(), reader.getEnd());
-  event = reader.getRoot<cereal::Event>();
-  which = event.which();
-  mono_time = event.getLogMonoTime();
-
-  // 1) Send video data at t=timestampEof/timestampSof
-  // 2) Send encodeIndex packet at t=logMonoTime
-  if (frame) {
-    auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-    // C2 only has eof set, and some older routes have neither
-    uint64_t sof = idx.getTimestampSof();
-    uint64_t eof = idx.getTimestampEof();
-    if (sof > 0) {
-      mono_time = sof;
-    } else if (eof > 0) {
-      mono_time = eof;
-    }
-  }
-}
-
 // class LogReader
 
-LogReader::LogReader(size_t memory_pool_block_size) {
-#ifdef HAS_MEMORY_RESOURCE
-  const size_t buf_size = sizeof(Event) * memory_pool_block_size;
-  pool_buffer_ = ::operator new(buf_size);
-  mbr_ = new std::pmr::monotonic_buffer_resource(pool_buffer_, buf_size);
-#endif
-  events.reserve(memory_pool_block_size);
-}
-
-LogReader::~LogReader() {
-  for (Event *e : events) {
-    delete e;
-  }
-
-#ifdef HAS_MEMORY_RESOURCE
-  delete mbr_;
-  ::operator delete(pool_buffer_);
-#endif
+LogReader::LogReader(size_t reserve_size) {
+  events.reserve(reserve_size);
 }
 
 bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
@@ -65,29 +28,31 @@ bool LogReader::load(const std::byte *data, size_t size, std::atomic<bool> *abor
   try {
     kj::ArrayPtr<const capnp::word> words((const capnp::word *)raw_.data(), raw_.size() / sizeof(capnp::word));
     while (words.size() > 0) {
-
-#ifdef HAS_MEMORY_RESOURCE
-      Event *evt = new (mbr_) Event(words);
-#else
-      Event *evt = new Event(words);
-#endif
+      // the reader only lives while the message is indexed
+      capnp::FlatArrayMessageReader reader(words);
+      auto event = reader.getRoot<cereal::Event>();
+      const kj::ArrayPtr<const capnp::word> msg_words(words.begin(), reader.getEnd());
+      const cereal::Event::Which which = event.which();
+      events.emplace_back(which, event.getLogMonoTime(), msg_words);
 
       // Add encodeIdx packet again as a frame packet for the video stream
-      if (evt->which == cereal::Event::ROAD_ENCODE_IDX ||
-          evt->which == cereal::Event::DRIVER_ENCODE_IDX ||
-          evt->which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
-
-#ifdef HAS_MEMORY_RESOURCE
-        Event *frame_evt = new (mbr_) Event(words, true);
-#else
-        Event *frame_evt = new Event(words, true);
-#endif
-
-        events.push_back(frame_evt);
+      if (which == cereal::Event::ROAD_ENCODE_IDX ||
+          which == cereal::Event::DRIVER_ENCODE_IDX ||
+          which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
+        // 1) Send video data at t=timestampEof/timestampSof
+        // 2) Send encodeIndex packet at t=logMonoTime
+        auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+        // C2 only has eof set, and some older routes have neither
+        uint64_t mono_time = event.getLogMonoTime();
+        if (uint64_t sof = idx.getTimestampSof(); sof > 0) {
+          mono_time = sof;
+        } else if (uint64_t eof = idx.getTimestampEof(); eof > 0) {
+          mono_time = eof;
+        }
+        events.emplace_back(which, mono_time, msg_words, true);
       }
 
-      words = kj::arrayPtr(evt->reader.getEnd(), words.end());
-      events.push_back(evt);
+      words = kj::arrayPtr(reader.getEnd(), words.end());
     }
   } catch (const kj::Exception &e) {
     std::cout << "failed to parse log : " << e.getDescription().cStr() << std::endl;
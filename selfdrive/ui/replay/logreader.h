@@ -1,64 +1,54 @@
 #pragma once
 
-#if __has_include(<memory_resource>)
-#define HAS_MEMORY_RESOURCE 1
-#include <memory_resource>
-#endif
-
 #include "cereal/gen/cpp/log.capnp.h"
 #include "selfdrive/camerad/cameras/camera_common.h"
 #include "selfdrive/ui/replay/filereader.h"
 
 const CameraType ALL_CAMERAS[] = {RoadCam, DriverCam, WideRoadCam};
 const int MAX_CAMERAS = std::size(ALL_CAMERAS);
-const int DEFAULT_EVENT_MEMORY_POOL_BLOCK_SIZE = 65000;
+const int DEFAULT_EVENTS_RESERVE_SIZE = 65000;
 
+// compact index record of a message in the decompressed log.
+// capnp readers are only built when the message is published, see Event::Message.
 class Event {
 public:
-  Event(cereal::Event::Which which, uint64_t mono_time) : reader(kj::ArrayPtr<capnp::word>{}) {
-    // construct a dummy Event for binary search, e.g std::upper_bound
-    this->which = which;
-    this->mono_time = mono_time;
-  }
-  Event(const kj::ArrayPtr<const capnp::word> &amsg, bool frame = false);
-  inline kj::ArrayPtr<const capnp::byte> bytes() const { return words.asBytes(); }
+  // construct a dummy Event for binary search, e.g std::upper_bound
+  Event(cereal::Event::Which which, uint64_t mono_time) : mono_time(mono_time), which(which) {}
+  Event(cereal::Event::Which which, uint64_t mono_time, const kj::ArrayPtr<const capnp::word> &msg_words, bool frame = false)
+      : mono_time(mono_time), data(msg_words.begin()), size(msg_words.size()), which(which), frame(frame) {}
+  inline kj::ArrayPtr<const capnp::word> words() const { return {data, size}; }
+  inline kj::ArrayPtr<const capnp::byte> bytes() const { return words().asBytes(); }
 
   struct lessThan {
-    inline bool operator()(const Event *l, const Event *r) {
-      return l->mono_time < r->mono_time || (l->mono_time == r->mono_time && l->which < r->which);
+    inline bool operator()(const Event &l, const Event &r) const {
+      return l.mono_time < r.mono_time || (l.mono_time == r.mono_time && l.which < r.which);
     }
+    inline bool operator()(const Event *l, const Event *r) const { return (*this)(*l, *r); }
   };
 
-#if HAS_MEMORY_RESOURCE
-  void *operator new(size_t size, std::pmr::monotonic_buffer_resource *mbr) {
-    return mbr->allocate(size);
-  }
-  void operator delete(void *ptr) {
-    // No-op. memory used by EventMemoryPool increases monotonically until the logReader is destroyed. 
-  }
-#endif
+  // the capnp message of an event, valid as long as its LogReader lives.
+  struct Message {
+    Message(const Event &e) : reader(e.words()), event(reader.getRoot<cereal::Event>()) {}
+    capnp::FlatArrayMessageReader reader;
+    cereal::Event::Reader event;
+  };
 
   uint64_t mono_time;
+  const capnp::word *data = nullptr;
+  uint32_t size = 0;  // in words
   cereal::Event::Which which;
-  cereal::Event::Reader event;
-  capnp::FlatArrayMessageReader reader;
-  kj::ArrayPtr<const capnp::word> words;
-  bool frame;
+  bool frame = false;
 };
 
 class LogReader {
 public:
-  LogReader(size_t memory_pool_block_size = DEFAULT_EVENT_MEMORY_POOL_BLOCK_SIZE);
-  ~LogReader();
+  LogReader(size_t reserve_size = DEFAULT_EVENTS_RESERVE_SIZE);
   bool load(const std::string &url, std::atomic<bool> *abort = nullptr, bool local_cache = false, int chunk_size = -1, int retries = 0);
   bool load(const std::byte *data, size_t size, std::atomic<bool> *abort = nullptr);
 
-  std::vector<Event*> events;
+  // sorted by Event::lessThan, pointing into raw_
+  std::vector<Event> events;
 
 private:
   std::string raw_;
-#ifdef HAS_MEMORY_RESOURCE
-  std::pmr::monotonic_buffer_resource *mbr_ = nullptr;
-  void *pool_buffer_ = nullptr;
-#endif
 };
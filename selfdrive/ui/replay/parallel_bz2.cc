@@ -0,0 +1,198 @@
+#include "selfdrive/ui/replay/parallel_bz2.h"
+
+#include <bzlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const uint64_t BLOCK_MAGIC = 0x314159265359;  // BCD(pi)
+const uint64_t EOS_MAGIC = 0x177245385090;    // BCD(sqrt(pi))
+const uint64_t MAGIC_MASK = (1ULL << 48) - 1;
+const int MAGIC_BITS = 48;
+const int STREAM_HEADER_BITS = 32;  // "BZh" + block size
+
+struct Marker {
+  size_t bit;
+  bool eos;
+};
+
+struct Block {
+  size_t begin_bit;
+  size_t end_bit;
+};
+
+struct BitWriter {
+  std::string buf;
+  uint32_t acc = 0;
+  int nbits = 0;
+
+  void put(uint32_t v, int n) {  // n <= 24
+    acc = (acc << n) | (v & ((1u << n) - 1));
+    nbits += n;
+    while (nbits >= 8) {
+      buf.push_back((char)(acc >> (nbits - 8)));
+      nbits -= 8;
+    }
+  }
+  void flush() {
+    if (nbits > 0) put(0, 8 - nbits);
+  }
+};
+
+inline uint32_t readBits(const uint8_t *p, size_t bit, int n) {
+  uint32_t v = 0;
+  for (int i = 0; i < n; ++i, ++bit) {
+    v = (v << 1) | ((p[bit / 8] >> (7 - bit % 8)) & 1);
+  }
+  return v;
+}
+
+bool isStreamHeader(const uint8_t *p, size_t size, size_t offset) {
+  return offset + 4 <= size && p[offset] == 'B' && p[offset + 1] == 'Z' && p[offset + 2] == 'h' &&
+         p[offset + 3] >= '1' && p[offset + 3] <= '9';
+}
+
+// find all block and end-of-stream magics. they are bit-aligned, so test every bit offset.
+std::vector<Marker> scanMarkers(const uint8_t *p, size_t size) {
+  std::vector<Marker> markers;
+  uint64_t window = 0;
+  for (size_t i = 0; i < size; ++i) {
+    window = (window << 8) | p[i];
+    if (i < 6) continue;
+
+    for (int k = 7; k >= 0; --k) {
+      const uint64_t v = (window >> k) & MAGIC_MASK;
+      if (v == BLOCK_MAGIC || v == EOS_MAGIC) {
+        markers.push_back({.bit = (i + 1) * 8 - k - MAGIC_BITS, .eos = v == EOS_MAGIC});
+      }
+    }
+  }
+  return markers;
+}
+
+// split the (possibly concatenated) streams into blocks. returns false if the layout is not
+// exactly header, blocks..., eos for every stream.
+bool findBlocks(const uint8_t *p, size_t size, std::vector<Block> &blocks) {
+  if (!isStreamHeader(p, size, 0)) return false;
+
+  const std::vector<Marker> markers = scanMarkers(p, size);
+  size_t expected = STREAM_HEADER_BITS;
+  for (size_t i = 0; i < markers.size(); ++i) {
+    const Marker &m = markers[i];
+    if (m.bit != expected) return false;
+
+    if (m.eos) {
+      // 32 bits stream crc, padding to a byte boundary, then either the end or another stream.
+      size_t next_stream = (m.bit + MAGIC_BITS + 32 + 7) / 8;
+      if (next_stream == size) return i == markers.size() - 1;
+      if (!isStreamHeader(p, size, next_stream)) return false;
+      expected = next_stream * 8 + STREAM_HEADER_BITS;
+    } else {
+      if (i + 1 == markers.size()) return false;  // truncated
+      blocks.push_back({.begin_bit = m.bit, .end_bit = markers[i + 1].bit});
+      expected = markers[i + 1].bit;
+    }
+  }
+  return false;
+}
+
+// wrap a single block in its own stream and decompress it.
+// the combined crc of a one-block stream equals the block crc.
+bool decompressBlock(const uint8_t *p, const Block &block, std::string &out) {
+  const size_t nbits = block.end_bit - block.begin_bit;
+  const size_t first_byte = block.begin_bit / 8;
+  const int shift = block.begin_bit % 8;
+  const size_t nbytes = nbits / 8;
+
+  BitWriter w;
+  w.buf.reserve(4 + nbytes + 16);
+  w.buf = "BZh9";
+  for (size_t i = 0; i < nbytes; ++i) {
+    const uint8_t *b = p + first_byte + i;
+    w.buf.push_back((char)(shift ? (b[0] << shift) | (b[1] >> (8 - shift)) : b[0]));
+  }
+  w.put(readBits(p, block.begin_bit + nbytes * 8, nbits % 8), nbits % 8);
+  const uint32_t block_crc = readBits(p, block.begin_bit + MAGIC_BITS, 32);
+  w.put(EOS_MAGIC >> 24, 24);
+  w.put(EOS_MAGIC & 0xffffff, 24);
+  w.put(block_crc >> 16, 16);
+  w.put(block_crc & 0xffff, 16);
+  w.flush();
+
+  bz_stream strm = {};
+  if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) return false;
+
+  strm.next_in = w.buf.data();
+  strm.avail_in = w.buf.size();
+  out.resize(std::max<size_t>(nbytes * 5, 1024 * 1024));
+  int bzerror = BZ_OK;
+  do {
+    if (strm.total_out_lo32 == out.size()) {
+      out.resize(out.size() * 2);
+    }
+    strm.next_out = &out[strm.total_out_lo32];
+    strm.avail_out = out.size() - strm.total_out_lo32;
+    const char *prev_write_pos = strm.next_out;
+    bzerror = BZ2_bzDecompress(&strm);
+    if (bzerror == BZ_OK && strm.avail_in == 0 && prev_write_pos == strm.next_out) {
+      break;  // ran out of input without reaching the end of stream
+    }
+  } while (bzerror == BZ_OK);
+
+  BZ2_bzDecompressEnd(&strm);
+  out.resize(bzerror == BZ_STREAM_END ? strm.total_out_lo32 : 0);
+  return bzerror == BZ_STREAM_END;
+}
+
+}  // namespace
+
+std::string decompressBZ2Parallel(const std::byte *in, size_t in_size, int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = std::thread::hardware_concurrency();
+  }
+  if (num_threads < 2) return {};
+
+  const uint8_t *p = (const uint8_t *)in;
+  std::vector<Block> blocks;
+  if (!findBlocks(p, in_size, blocks) || blocks.size() < 2) return {};
+
+  num_threads = std::min<int>(num_threads, blocks.size());
+
+  std::vector<std::string> outputs(blocks.size());
+  std::atomic<size_t> next_block = 0;
+  std::atomic<bool> failed = false;
+  auto worker = [&]() {
+    for (size_t i = next_block++; i < blocks.size() && !failed; i = next_block++) {
+      if (!decompressBlock(p, blocks[i], outputs[i])) {
+        failed = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &t : threads) {
+    t.join();
+  }
+  if (failed) return {};
+
+  size_t total_size = 0;
+  for (const auto &o : outputs) {
+    total_size += o.size();
+  }
+  std::string result;
+  result.reserve(total_size);
+  for (auto &o : outputs) {
+    result += o;
+    std::string().swap(o);
+  }
+  return result;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Decompress a bzip2 stream by decoding its independent blocks on a thread pool.
+// Block boundaries are found by scanning for the bit-aligned block/end-of-stream magics.
+// Returns an empty string if there is nothing to gain or the input can't be split safely
+// (single core, single block, truncated or corrupt stream, ...). The caller should then
+// fall back to sequential decompression.
+std::string decompressBZ2Parallel(const std::byte *in, size_t in_size, int num_threads = 0);
+
+inline std::string decompressBZ2Parallel(const std::string &in, int num_threads = 0) {
+  return decompressBZ2Parallel((const std::byte *)in.data(), in.size(), num_threads);
+}
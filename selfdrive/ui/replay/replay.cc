@@ -10,6 +10,39 @@
 #include "selfdrive/hardware/hw.h"
 #include "selfdrive/ui/replay/util.h"
 
+// class EventCursor
+
+EventCursor::EventCursor(const MergedSegments &segments, cereal::Event::Which which, uint64_t mono_time) {
+  Event cur_event(which, mono_time);
+  for (const auto &seg : segments) {
+    const auto &events = seg->log->events;
+    auto it = std::upper_bound(events.begin(), events.end(), cur_event, Event::lessThan());
+    if (it != events.end()) {
+      heads_.push_back({it, events.end()});
+    }
+  }
+  pickNext();
+}
+
+void EventCursor::next() {
+  if (++heads_[cur_].it == heads_[cur_].end) {
+    heads_.erase(heads_.begin() + cur_);
+  }
+  pickNext();
+}
+
+void EventCursor::pickNext() {
+  // at most 3 segments are merged, a linear scan beats a heap. ties go to the earlier segment.
+  cur_ = heads_.empty() ? -1 : 0;
+  for (int i = 1; i < heads_.size(); ++i) {
+    if (Event::lessThan()(*heads_[i].it, *heads_[cur_].it)) {
+      cur_ = i;
+    }
+  }
+}
+
+// class Replay
+
 Replay::Replay(QString route, QStringList allow, QStringList block, SubMaster *sm_, uint32_t flags, QString data_dir, QObject *parent)
     : sm(sm_), flags_(flags), QObject(parent) {
   std::vector<const char *> s;
@@ -23,13 +56,13 @@ Replay::Replay(QString route, QStringList allow, QStringList block, SubMaster *s
     }
   }
   qDebug() << "services " << s;
+  sm_msgs_ = std::make_unique<SmMessages[]>(sockets_.size());
 
   if (sm == nullptr) {
     pm = std::make_unique<PubMaster>(s);
   }
   route_ = std::make_unique<Route>(route, data_dir);
-  events_ = std::make_unique<std::vector<Event *>>();
-  new_events_ = std::make_unique<std::vector<Event *>>();
+  merged_segments_ = std::make_shared<MergedSegments>();
 
   connect(this, &Replay::seekTo, this, &Replay::doSeek);
   connect(this, &Replay::segmentChanged, this, &Replay::queueSegment);
@@ -51,6 +84,7 @@ void Replay::stop() {
     stream_thread_ = nullptr;
   }
   segments_.clear();
+  merged_segments_ = std::make_shared<MergedSegments>();
   camera_server_.reset(nullptr);
   qDebug() << "shutdown: done";
 }
@@ -150,7 +184,7 @@ void Replay::queueSegment() {
     if (!it->second) {
       if (it == cur || std::prev(it)->second->isLoaded()) {
         auto &[n, seg] = *it;
-        seg = std::make_unique<Segment>(n, route_->at(n), flags_);
+        seg = std::make_shared<Segment>(n, route_->at(n), flags_);
         QObject::connect(seg.get(), &Segment::loadFinished, this, &Replay::segmentLoadFinished);
         qDebug() << "loading segment" << n << "...";
       }
@@ -168,8 +202,8 @@ void Replay::queueSegment() {
   mergeSegments(begin, end);
 
   // free segments out of current semgnt window.
-  std::for_each(segments_.begin(), begin, [](auto &e) { e.second.reset(nullptr); });
-  std::for_each(end, segments_.end(), [](auto &e) { e.second.reset(nullptr); });
+  std::for_each(segments_.begin(), begin, [](auto &e) { e.second.reset(); });
+  std::for_each(end, segments_.end(), [](auto &e) { e.second.reset(); });
 
   // start stream thread
   if (stream_thread_ == nullptr && cur_segment->isLoaded()) {
@@ -180,42 +214,51 @@ void Replay::queueSegment() {
 void Replay::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end) {
   // merge 3 segments in sequence.
   std::vector<int> segments_need_merge;
-  size_t new_events_size = 0;
+  auto merged = std::make_shared<MergedSegments>();
   for (auto it = begin; it != end && it->second->isLoaded() && segments_need_merge.size() < 3; ++it) {
     segments_need_merge.push_back(it->first);
-    new_events_size += it->second->log->events.size();
+    merged->push_back(it->second);
   }
 
   if (segments_need_merge != segments_merged_) {
     qDebug() << "merge segments" << segments_need_merge;
-    new_events_->clear();
-    new_events_->reserve(new_events_size);
-    for (int n : segments_need_merge) {
-      const auto &e = segments_[n]->log->events;
-      auto middle = new_events_->insert(new_events_->end(), e.begin(), e.end());
-      std::inplace_merge(new_events_->begin(), middle, new_events_->end(), Event::lessThan());
+    segments_merged_ = segments_need_merge;
+    {
+      std::lock_guard lk(merged_lock_);
+      merged_segments_ = merged;
     }
-
-    updateEvents([&]() {
-      events_.swap(new_events_);
-      segments_merged_ = segments_need_merge;
-      return true;
-    });
+    merged_changed_ = true;
+    // a waiting stream thread must see the flag before it goes back to sleep.
+    if (stream_waiting_) {
+      std::lock_guard lk(stream_lock_);
+    }
+    stream_cv_.notify_one();
   }
 }
 
+std::shared_ptr<MergedSegments> Replay::mergedSegments() {
+  merged_changed_ = false;
+  std::lock_guard lk(merged_lock_);
+  return merged_segments_;
+}
+
+const Segment *Replay::findSegment(const MergedSegments &merged, int n) {
+  auto it = std::find_if(merged.begin(), merged.end(), [n](auto &seg) { return seg->seg_num == n; });
+  return it != merged.end() ? it->get() : nullptr;
+}
+
 void Replay::startStream(const Segment *cur_segment) {
   const auto &events = cur_segment->log->events;
 
   // get route start time from initData
-  auto it = std::find_if(events.begin(), events.end(), [](auto e) { return e->which == cereal::Event::Which::INIT_DATA; });
-  route_start_ts_ = it != events.end() ? (*it)->mono_time : events[0]->mono_time;
+  auto it = std::find_if(events.begin(), events.end(), [](auto &e) { return e.which == cereal::Event::Which::INIT_DATA; });
+  route_start_ts_ = it != events.end() ? it->mono_time : events[0].mono_time;
   cur_mono_time_ += route_start_ts_;
 
   // write CarParams
-  it = std::find_if(events.begin(), events.end(), [](auto e) { return e->which == cereal::Event::Which::CAR_PARAMS; });
+  it = std::find_if(events.begin(), events.end(), [](auto &e) { return e.which == cereal::Event::Which::CAR_PARAMS; });
   if (it != events.end()) {
-    auto bytes = (*it)->bytes();
+    auto bytes = it->bytes();
     Params().put("CarParams", (const char *)bytes.begin(), bytes.size());
   } else {
     qWarning() << "failed to read CarParams from current segment";
@@ -237,7 +280,7 @@ void Replay::startStream(const Segment *cur_segment) {
   stream_thread_->start();
 }
 
-void Replay::publishMessage(const Event *e) {
+void Replay::publishMessage(const Event *e, const MergedSegments &merged) {
   if (sm == nullptr) {
     auto bytes = e->bytes();
     int ret = pm->send(sockets_[e->which], (capnp::byte *)bytes.begin(), bytes.size());
@@ -246,11 +289,22 @@ void Replay::publishMessage(const Event *e) {
       sockets_[e->which] = nullptr;
     }
   } else {
-    sm->update_msgs(nanos_since_boot(), {{sockets_[e->which], e->event}});
+    auto seg = std::find_if(merged.begin(), merged.end(), [e](auto &s) {
+      const auto &events = s->log->events;
+      return !events.empty() && e >= &events.front() && e <= &events.back();
+    });
+    if (seg == merged.end()) return;
+
+    SmMessages &m = sm_msgs_[e->which];
+    const int next = m.cur ^ 1;
+    m.segments[next] = *seg;
+    m.msgs[next].emplace(*e);
+    sm->update_msgs(nanos_since_boot(), {{sockets_[e->which], m.msgs[next]->event}});
+    m.cur = next;
   }
 }
 
-void Replay::publishFrame(const Event *e) {
+void Replay::publishFrame(const Event *e, const MergedSegments &merged) {
   static const std::map<cereal::Event::Which, CameraType> cam_types{
       {cereal::Event::ROAD_ENCODE_IDX, RoadCam},
       {cereal::Event::DRIVER_ENCODE_IDX, DriverCam},
@@ -260,27 +314,33 @@ void Replay::publishFrame(const Event *e) {
       (e->which == cereal::Event::WIDE_ROAD_ENCODE_IDX && !(flags_ & REPLAY_FLAG_ECAM))) {
     return;
   }
-  auto eidx = capnp::AnyStruct::Reader(e->event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-  if (eidx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C && isSegmentMerged(eidx.getSegmentNum())) {
-    CameraType cam = cam_types.at(e->which);
-    camera_server_->pushFrame(cam, segments_[eidx.getSegmentNum()]->frames[cam].get(), eidx);
+  Event::Message msg(*e);
+  auto eidx = capnp::AnyStruct::Reader(msg.event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+  if (eidx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
+    if (const Segment *seg = findSegment(merged, eidx.getSegmentNum())) {
+      CameraType cam = cam_types.at(e->which);
+      camera_server_->pushFrame(cam, seg->frames[cam].get(), eidx);
+    }
   }
 }
 
 void Replay::stream() {
   float last_print = 0;
   cereal::Event::Which cur_which = cereal::Event::Which::INIT_DATA;
+  std::shared_ptr<MergedSegments> merged;
 
   std::unique_lock lk(stream_lock_);
 
   while (true) {
-    stream_cv_.wait(lk, [=]() { return exit_ || (events_updated_ && !paused_); });
+    stream_waiting_ = true;
+    stream_cv_.wait(lk, [=]() { return exit_ || ((events_updated_ || merged_changed_) && !paused_); });
+    stream_waiting_ = false;
     events_updated_ = false;
     if (exit_) break;
 
-    Event cur_event(cur_which, cur_mono_time_);
-    auto eit = std::upper_bound(events_->begin(), events_->end(), &cur_event, Event::lessThan());
-    if (eit == events_->end()) {
+    merged = mergedSegments();
+    EventCursor cursor(*merged, cur_which, cur_mono_time_);
+    if (cursor.end()) {
       qDebug() << "waiting for events...";
       continue;
     }
@@ -288,8 +348,8 @@ void Replay::stream() {
     uint64_t evt_start_ts = cur_mono_time_;
     uint64_t loop_start_ts = nanos_since_boot();
 
-    for (auto end = events_->end(); !updating_events_ && eit != end; ++eit) {
-      const Event *evt = (*eit);
+    while (!updating_events_ && !cursor.end()) {
+      const Event *evt = cursor.event();
       cur_which = evt->which;
       cur_mono_time_ = evt->mono_time;
       const int current_ts = currentSeconds();
@@ -323,18 +383,28 @@ void Replay::stream() {
         }
 
         if (evt->frame) {
-          publishFrame(evt);
+          publishFrame(evt, *merged);
         } else {
-          publishMessage(evt);
+          publishMessage(evt, *merged);
         }
       }
+
+      if (merged_changed_) {
+        // the segment window moved: continue from the current event in the new segment list.
+        // frames of the previous list must be sent before its segments may be released.
+        camera_server_->waitFinish();
+        merged = mergedSegments();
+        cursor = EventCursor(*merged, cur_which, cur_mono_time_);
+      } else {
+        cursor.next();
+      }
     }
     // wait for frame to be sent before unlock.(frameReader may be deleted after unlock)
     camera_server_->waitFinish();
 
-    if (eit == events_->end() && !(flags_ & REPLAY_FLAG_NO_LOOP)) {
+    if (cursor.end() && !(flags_ & REPLAY_FLAG_NO_LOOP)) {
       int last_segment = segments_.rbegin()->first;
-      if (current_segment_ >= last_segment && isSegmentMerged(last_segment)) {
+      if (current_segment_ >= last_segment && findSegment(*merged, last_segment)) {
         qInfo() << "reaches the end of route, restart from beginning";
         emit seekTo(0, false);
       }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <optional>
+
 #include <QThread>
 
 #include "selfdrive/ui/replay/camera.h"
@@ -8,6 +10,30 @@
 // one segment uses about 100M of memory
 constexpr int FORWARD_SEGS = 5;
 
+// segments merged into the stream, in segment order.
+// the stream thread holds a reference while it publishes their events and frames.
+typedef std::vector<std::shared_ptr<Segment>> MergedSegments;
+
+// k-way merge over the sorted events of the merged segments.
+// moving the segment window only swaps the segment list, events are never copied or re-sorted.
+class EventCursor {
+public:
+  // positioned at the first event after (mono_time, which)
+  EventCursor(const MergedSegments &segments, cereal::Event::Which which, uint64_t mono_time);
+  inline bool end() const { return cur_ == -1; }
+  inline const Event *event() const { return &*heads_[cur_].it; }
+  void next();
+
+private:
+  void pickNext();
+
+  struct Head {
+    std::vector<Event>::const_iterator it, end;
+  };
+  std::vector<Head> heads_;
+  int cur_ = -1;
+};
+
 enum REPLAY_FLAGS {
   REPLAY_FLAG_NONE = 0x0000,
   REPLAY_FLAG_DCAM = 0x0002,
@@ -42,18 +68,20 @@ protected slots:
   void segmentLoadFinished(bool sucess);
 
 protected:
-  typedef std::map<int, std::unique_ptr<Segment>> SegmentMap;
+  typedef std::map<int, std::shared_ptr<Segment>> SegmentMap;
   void startStream(const Segment *cur_segment);
   void stream();
   void setCurrentSegment(int n);
   void mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end);
   void updateEvents(const std::function<bool()>& lambda);
-  void publishMessage(const Event *e);
-  void publishFrame(const Event *e);
+  void publishMessage(const Event *e, const MergedSegments &merged);
+  void publishFrame(const Event *e, const MergedSegments &merged);
+  std::shared_ptr<MergedSegments> mergedSegments();
   inline int currentSeconds() const { return (cur_mono_time_ - route_start_ts_) / 1e9; }
   inline bool isSegmentMerged(int n) {
     return std::find(segments_merged_.begin(), segments_merged_.end(), n) != segments_merged_.end();
   }
+  static const Segment *findSegment(const MergedSegments &merged, int n);
 
   QThread *stream_thread_ = nullptr;
 
@@ -69,13 +97,26 @@ protected:
   bool events_updated_ = false;
   uint64_t route_start_ts_ = 0;
   uint64_t cur_mono_time_ = 0;
-  std::unique_ptr<std::vector<Event *>> events_;
-  std::unique_ptr<std::vector<Event *>> new_events_;
+
+  // a new segment list is handed over without stopping the stream thread,
+  // which picks it up before publishing its next event.
+  std::mutex merged_lock_;
+  std::shared_ptr<MergedSegments> merged_segments_;
+  std::atomic<bool> merged_changed_ = false;
+  std::atomic<bool> stream_waiting_ = false;
   std::vector<int> segments_merged_;
 
   // messaging
   SubMaster *sm = nullptr;
   std::unique_ptr<PubMaster> pm;
+  // sm keeps reading the last message of each service. its reader points into the log of its segment,
+  // which is kept alive here. the previous message stays valid until sm points to the new one.
+  struct SmMessages {
+    int cur = 0;
+    std::shared_ptr<Segment> segments[2];
+    std::optional<Event::Message> msgs[2];
+  };
+  std::unique_ptr<SmMessages[]> sm_msgs_;
   std::vector<const char*> sockets_;
   std::unique_ptr<Route> route_;
   std::unique_ptr<CameraServer> camera_server_;
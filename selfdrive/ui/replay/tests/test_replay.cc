@@ -1,8 +1,15 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
 #include <QDebug>
 #include <QEventLoop>
 
 #include "catch2/catch.hpp"
 #include "selfdrive/common/util.h"
+#include "selfdrive/ui/replay/batch.h"
+#include "selfdrive/ui/replay/parallel_bz2.h"
 #include "selfdrive/ui/replay/replay.h"
 #include "selfdrive/ui/replay/util.h"
 
@@ -37,16 +44,197 @@ int random_int(int min, int max) {
 
 TEST_CASE("FileReader") {
   auto enable_local_cache = GENERATE(true, false);
-  std::string cache_file = cacheFilePath(TEST_RLOG_URL);
-  system(("rm " + cache_file + " -f").c_str());
+  char cache_dir[] = "/tmp/test_file_reader_XXXXXX";
+  REQUIRE(mkdtemp(cache_dir));
+  DownloadCache cache(cache_dir);
 
-  FileReader reader(enable_local_cache);
+  FileReader reader(enable_local_cache, 0, 3, enable_local_cache ? &cache : nullptr);
   std::string content = reader.read(TEST_RLOG_URL);
   REQUIRE(sha256(content) == TEST_RLOG_CHECKSUM);
   if (enable_local_cache) {
-    REQUIRE(sha256(util::read_file(cache_file)) == TEST_RLOG_CHECKSUM);
+    std::string cached;
+    REQUIRE(cache.get(TEST_RLOG_URL, 0, content.size(), cached));
+    REQUIRE(sha256(cached) == TEST_RLOG_CHECKSUM);
   } else {
-    REQUIRE(util::file_exists(cache_file) == false);
+    REQUIRE(cache.usedBytes() == 0);
+  }
+  system(("rm -rf " + std::string(cache_dir)).c_str());
+}
+
+// serves files from memory over HTTP with HEAD and range requests, a local stand-in for the file storage.
+class LocalHttpServer {
+public:
+  LocalHttpServer(const std::map<std::string, std::string> &files) : files_(files) {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(fd_, (struct sockaddr *)&addr, len);
+    listen(fd_, 16);
+    getsockname(fd_, (struct sockaddr *)&addr, &len);
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread(&LocalHttpServer::serve, this);
+  }
+  ~LocalHttpServer() {
+    shutdown(fd_, SHUT_RDWR);
+    close(fd_);
+    thread_.join();
+  }
+  std::string url(const std::string &file) const { return "http://127.0.0.1:" + std::to_string(port_) + "/" + file; }
+
+  std::atomic<size_t> requests = 0;
+  std::atomic<size_t> bytes_sent = 0;
+
+private:
+  void serve() {
+    int conn = -1;
+    while ((conn = accept(fd_, nullptr, nullptr)) >= 0) {
+      std::string request;
+      char buf[4096];
+      while (request.find("\r\n\r\n") == std::string::npos) {
+        ssize_t n = recv(conn, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        request.append(buf, n);
+      }
+      ++requests;
+
+      char method[16] = {}, path[256] = {};
+      sscanf(request.c_str(), "%15s /%255s", method, path);
+      auto it = files_.find(path);
+      std::string response;
+      if (it == files_.end()) {
+        response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      } else if (strcmp(method, "HEAD") == 0) {
+        response = util::string_format("HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", it->second.size());
+      } else {
+        size_t begin = 0, end = it->second.size() - 1;
+        if (size_t pos = request.find("Range: bytes="); pos != std::string::npos) {
+          sscanf(request.c_str() + pos, "Range: bytes=%zu-%zu", &begin, &end);
+        }
+        end = std::min(end + 1, it->second.size());
+        response = util::string_format("HTTP/1.1 206 Partial Content\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", end - begin);
+        response.append(it->second, begin, end - begin);
+        bytes_sent += end - begin;
+      }
+      for (size_t sent = 0; sent < response.size();) {
+        ssize_t n = send(conn, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += n;
+      }
+      close(conn);
+    }
+  }
+
+  std::map<std::string, std::string> files_;
+  int fd_ = -1;
+  int port_ = 0;
+  std::thread thread_;
+};
+
+std::string random_bytes(size_t size) {
+  std::mt19937 rng(size);
+  std::string bytes(size, '\0');
+  for (auto &c : bytes) c = rng();
+  return bytes;
+}
+
+TEST_CASE("DownloadCache") {
+  char cache_dir[] = "/tmp/test_download_cache_XXXXXX";
+  REQUIRE(mkdtemp(cache_dir));
+  const std::string content = random_bytes(8 * CACHE_CHUNK_SIZE + 1234);
+  const std::string content_b = random_bytes(3 * CACHE_CHUNK_SIZE + 7);
+  LocalHttpServer server({{"a", content}, {"b", content_b}});
+  const std::string url = server.url("a");
+
+  SECTION("partial ranges are reused") {
+    DownloadCache cache(cache_dir);
+    FileReader reader(true, 0, 0, &cache);
+    const size_t begin = 3.5 * CACHE_CHUNK_SIZE, end = 5.2 * CACHE_CHUNK_SIZE;
+    REQUIRE(reader.readRange(url, begin, end) == content.substr(begin, end - begin));
+    REQUIRE(server.bytes_sent == 3 * CACHE_CHUNK_SIZE);
+
+    // only the missing chunks are downloaded
+    REQUIRE(reader.read(url) == content);
+    REQUIRE(server.bytes_sent == content.size());
+    REQUIRE(cache.usedBytes() == content.size());
+
+    // another process reads the whole file from the cache
+    const size_t requests = server.requests;
+    DownloadCache other_cache(cache_dir);
+    FileReader other_reader(true, 0, 0, &other_cache);
+    REQUIRE(other_reader.read(url) == content);
+    REQUIRE(server.requests == requests);
+  }
+
+  SECTION("least recently used chunks are evicted") {
+    const size_t max_bytes = 4 * CACHE_CHUNK_SIZE;
+    DownloadCache cache(cache_dir, max_bytes);
+    FileReader reader(true, 0, 0, &cache);
+    REQUIRE(reader.read(url) == content);
+    REQUIRE(cache.usedBytes() <= max_bytes);
+
+    std::string out;
+    REQUIRE(!cache.get(url, 0, 1, out));
+    REQUIRE(cache.get(url, content.size() - 1, content.size(), out));
+  }
+
+  SECTION("whole files and frame indexes are evicted") {
+    const std::string prefix = std::string(cache_dir) + "/" + sha256("https://example.com/old");
+    const std::string old_files[] = {prefix, prefix + ".vidx", prefix + "_length"};
+    for (const auto &path : old_files) {
+      const size_t size = path == old_files[2] ? 4 : CACHE_CHUNK_SIZE;
+      REQUIRE(util::write_file(path.c_str(), content.data(), size, O_WRONLY | O_CREAT) == 0);
+      const struct timespec old_time[2] = {{.tv_sec = 1}, {.tv_sec = 1}};
+      REQUIRE(utimensat(AT_FDCWD, path.c_str(), old_time, 0) == 0);
+    }
+
+    const size_t max_bytes = 4 * CACHE_CHUNK_SIZE;
+    DownloadCache cache(cache_dir, max_bytes);
+    REQUIRE(cache.usedBytes() == 2 * CACHE_CHUNK_SIZE);
+    FileReader reader(true, 0, 0, &cache);
+    REQUIRE(reader.read(url) == content);
+    REQUIRE(cache.usedBytes() <= max_bytes);
+    for (const auto &path : old_files) {
+      REQUIRE(!util::file_exists(path));
+    }
+  }
+
+  SECTION("concurrent readers share the cache") {
+    const size_t max_bytes = 5 * CACHE_CHUNK_SIZE;
+    std::atomic<int> success = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 6; ++i) {
+      threads.emplace_back([&, i]() {
+        // a cache instance per thread, like separate replay processes
+        DownloadCache cache(cache_dir, max_bytes);
+        FileReader reader(true, 0, 0, &cache);
+        for (int j = 0; j < 5; ++j) {
+          success += i % 2 ? reader.read(url) == content : reader.read(server.url("b")) == content_b;
+        }
+      });
+    }
+    for (auto &t : threads) t.join();
+    REQUIRE(success == 30);
+    REQUIRE(DownloadCache(cache_dir, max_bytes).usedBytes() <= max_bytes);
+  }
+  system(("rm -rf " + std::string(cache_dir)).c_str());
+}
+
+TEST_CASE("decompressBZ2Parallel") {
+  FileReader reader(true);
+  const std::string content = reader.read(TEST_RLOG_URL);
+  REQUIRE(!content.empty());
+
+  const std::string expected = decompressBZ2Sequential((std::byte *)content.data(), content.size());
+  REQUIRE(!expected.empty());
+
+  for (int num_threads : {2, 4, 8}) {
+    REQUIRE(decompressBZ2Parallel(content, num_threads) == expected);
+  }
+
+  SECTION("truncated stream is not split") {
+    REQUIRE(decompressBZ2Parallel(content.substr(0, content.size() / 2), 4).empty());
   }
 }
 
@@ -59,6 +247,21 @@ TEST_CASE("LogReader") {
     REQUIRE(log.load((std::byte *)corrupt_content.data(), corrupt_content.size()));
     REQUIRE(log.events.size() > 0);
   }
+  SECTION("events index the messages") {
+    FileReader reader(true);
+    std::string content = reader.read(TEST_RLOG_URL);
+    LogReader log;
+    REQUIRE(log.load((std::byte *)content.data(), content.size()));
+    REQUIRE(sizeof(Event) <= 24);
+    REQUIRE(std::is_sorted(log.events.begin(), log.events.end(), Event::lessThan()));
+
+    bool valid = true;
+    for (const Event &e : log.events) {
+      Event::Message msg(e);
+      valid = valid && msg.event.which() == e.which && (e.frame || msg.event.getLogMonoTime() == e.mono_time);
+    }
+    REQUIRE(valid);
+  }
 }
 
 TEST_CASE("Segment") {
@@ -97,6 +300,12 @@ TEST_CASE("Segment") {
       for (int i = 0; i < 50; ++i) {
         REQUIRE(fr->get(i, rgb_buf.get(), yuv_buf.get()));
       }
+      // requesting a recent frame again must not decode it again
+      const FrameCacheStats stats = fr->cacheStats();
+      REQUIRE(fr->get(48, rgb_buf.get(), yuv_buf.get()));
+      REQUIRE(fr->cacheStats().misses == stats.misses);
+      REQUIRE(fr->cacheStats().hits == stats.hits + 1);
+      REQUIRE(fr->cacheStats().bytes <= DEFAULT_FRAME_CACHE_SIZE);
     }
 
     loop.quit();
@@ -104,6 +313,119 @@ TEST_CASE("Segment") {
   loop.exec();
 }
 
+TEST_CASE("VideoIndex") {
+  Route demo_route(DEMO_ROUTE);
+  REQUIRE(demo_route.load());
+  const std::string url = demo_route.at(0).road_cam.toStdString();
+  FileReader reader(true);
+  const std::string content = reader.read(url);
+  REQUIRE(!content.empty());
+
+  VideoIndex index;
+  REQUIRE(index.build((const uint8_t *)content.data(), content.size()));
+  REQUIRE(index.frameCount() == 1200);
+  REQUIRE(index.fileSize() == content.size());
+  REQUIRE(index.isKeyFrame(0));
+  REQUIRE(!index.prefix.empty());
+
+  const std::string index_file = cacheFilePath(url) + ".vidx";
+  REQUIRE(index.save(index_file));
+  VideoIndex loaded;
+  REQUIRE(loaded.load(index_file));
+  REQUIRE(loaded.frameCount() == index.frameCount());
+  REQUIRE(loaded.prefix == index.prefix);
+
+  SECTION("seek with ranged downloads") {
+    // with the index cached and local cache disabled, only the needed GOPs are downloaded
+    FrameReader fr;
+    REQUIRE(fr.load(url, true, nullptr, false));
+    REQUIRE(fr.getFrameCount() == 1200);
+    std::unique_ptr<uint8_t[]> yuv_buf = std::make_unique<uint8_t[]>(fr.getYUVSize());
+    std::unique_ptr<uint8_t[]> rgb_buf = std::make_unique<uint8_t[]>(fr.getRGBSize());
+    for (int i : {600, 601, 10, 1199}) {
+      REQUIRE(fr.get(i, rgb_buf.get(), yuv_buf.get()));
+    }
+  }
+}
+
+TEST_CASE("LockstepReplay") {
+  LockstepReplay replay(DEMO_ROUTE);
+  REQUIRE(replay.load());
+
+  std::vector<uint64_t> handled;
+  replay.addConsumer({
+      .name = "carState",
+      .inputs = {cereal::Event::Which::CAR_STATE},
+      .trigger = cereal::Event::Which::CAR_STATE,
+      .handle = [&](const cereal::Event::Reader &event) { handled.push_back(event.getLogMonoTime()); },
+      .step = [&](uint64_t mono_time, std::vector<std::string> &outputs) { outputs.push_back(std::to_string(mono_time)); },
+  });
+  replay.addConsumer({.name = "1Hz", .period_ns = 1000000000ULL});
+  std::vector<std::string> outputs;
+  replay.output_callback = [&](const std::string &consumer, uint64_t mono_time, const std::string &msg) {
+    outputs.push_back(msg);
+  };
+  REQUIRE(replay.run(0, 0) == 1);
+
+  Route demo_route(DEMO_ROUTE);
+  REQUIRE(demo_route.load());
+  auto log = LockstepReplay::loadLog(demo_route.at(0), true);
+  REQUIRE(log);
+  const size_t car_states = std::count_if(log->events.begin(), log->events.end(), [](const Event &e) {
+    return e.which == cereal::Event::Which::CAR_STATE;
+  });
+
+  // every carState is delivered once, in log order, and triggers its own step
+  REQUIRE(car_states > 0);
+  REQUIRE(handled.size() == car_states);
+  REQUIRE(std::is_sorted(handled.begin(), handled.end()));
+  const auto &steps = replay.steps(0);
+  REQUIRE(steps.size() == car_states);
+  REQUIRE(outputs.size() == car_states);
+  REQUIRE(std::all_of(steps.begin(), steps.end(), [](auto &s) { return s.inputs == 1 && s.outputs == 1; }));
+
+  // the periodic consumer steps once per second of log time
+  REQUIRE(replay.steps(1).size() >= 59);
+  REQUIRE(replay.steps(1).size() <= 61);
+  replay.printStats();
+}
+
+TEST_CASE("BatchReplay") {
+  // the same route twice: both must replay the same events in the same order
+  BatchReplay batch({DEMO_ROUTE, DEMO_ROUTE});
+  REQUIRE(batch.load());
+
+  std::mutex lock;
+  std::vector<std::vector<uint32_t>> results;
+  auto factory = [](const QString &route) {
+    return std::vector<LockstepReplay::Consumer>{{
+        .name = "carState",
+        .inputs = {cereal::Event::Which::CAR_STATE},
+        .period_ns = 1000000000ULL,
+        .handle = [](const cereal::Event::Reader &event) {},
+    }};
+  };
+  batch.route_done = [&](const QString &route, const LockstepReplay &replay) {
+    std::unique_lock lk(lock);
+    auto &r = results.emplace_back();
+    for (const auto &s : replay.steps(0)) {
+      r.push_back(s.inputs);
+    }
+  };
+
+  // a small window, so segments of both routes are in flight out of order
+  BatchReplay::Config config = {.download_workers = 2, .parse_workers = 2, .consume_workers = 2, .window = 3, .end_segment = 1};
+  REQUIRE(batch.run(factory, config) == 4);
+  batch.printStats();
+
+  REQUIRE(results.size() == 2);
+  REQUIRE(!results[0].empty());
+  REQUIRE(results[0] == results[1]);
+  for (int i = 0; i < 3; ++i) {
+    REQUIRE(batch.stage(i).items == 4);
+  }
+}
+
 // helper class for unit tests
 class TestReplay : public Replay {
  public:
@@ -117,23 +439,31 @@ void TestReplay::testSeekTo(int seek_to) {
 
   while (true) {
     std::unique_lock lk(stream_lock_);
-    stream_cv_.wait(lk, [=]() { return events_updated_ == true; });
+    stream_waiting_ = true;
+    stream_cv_.wait(lk, [=]() { return events_updated_ || merged_changed_; });
+    stream_waiting_ = false;
     events_updated_ = false;
-    if (cur_mono_time_ != route_start_ts_ + seek_to * 1e9) {
+    auto merged = mergedSegments();
+    if (cur_mono_time_ != route_start_ts_ + seek_to * 1e9 || !findSegment(*merged, segments_.lower_bound(seek_to / 60)->first)) {
       // wake up by the previous merging, skip it.
       continue;
     }
 
-    Event cur_event(cereal::Event::Which::INIT_DATA, cur_mono_time_);
-    auto eit = std::upper_bound(events_->begin(), events_->end(), &cur_event, Event::lessThan());
-    if (eit == events_->end()) {
+    EventCursor cursor(*merged, cereal::Event::Which::INIT_DATA, cur_mono_time_);
+    if (cursor.end()) {
       qDebug() << "waiting for events...";
       continue;
     }
 
-    REQUIRE(std::is_sorted(events_->begin(), events_->end(), Event::lessThan()));
+    const Event *first_event = cursor.event();
+    bool sorted = true;
+    for (const Event *prev = first_event; !cursor.end(); cursor.next()) {
+      sorted = sorted && !Event::lessThan()(cursor.event(), prev);
+      prev = cursor.event();
+    }
+    REQUIRE(sorted);
     const int seek_to_segment = seek_to / 60;
-    const int event_seconds = ((*eit)->mono_time - route_start_ts_) / 1e9;
+    const int event_seconds = (first_event->mono_time - route_start_ts_) / 1e9;
     current_segment_ = event_seconds / 60;
     INFO("seek to [" << seek_to << "s segment " << seek_to_segment << "], events [" << event_seconds << "s segment" << current_segment_ << "]");
     REQUIRE(event_seconds >= seek_to);
@@ -14,6 +14,7 @@
 
 #include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
+#include "selfdrive/ui/replay/parallel_bz2.h"
 
 namespace {
 
@@ -97,7 +98,7 @@ void enableHttpLogging(bool enable) {
 }
 
 template <class T>
-bool httpDownload(const std::string &url, T &buf, size_t chunk_size, size_t content_length, std::atomic<bool> *abort) {
+bool httpDownload(const std::string &url, T &buf, size_t chunk_size, size_t content_length, std::atomic<bool> *abort, size_t range_start = 0) {
   static CURLGlobalInitializer curl_initializer;
 
   int parts = 1;
@@ -121,7 +122,7 @@ bool httpDownload(const std::string &url, T &buf, size_t chunk_size, size_t cont
     curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_cb<T>);
     curl_easy_setopt(eh, CURLOPT_WRITEDATA, (void *)(&writers[eh]));
     curl_easy_setopt(eh, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(eh, CURLOPT_RANGE, util::string_format("%d-%d", writers[eh].offset, writers[eh].end - 1).c_str());
+    curl_easy_setopt(eh, CURLOPT_RANGE, util::string_format("%zu-%zu", range_start + writers[eh].offset, range_start + writers[eh].end - 1).c_str());
     curl_easy_setopt(eh, CURLOPT_HTTPGET, 1);
     curl_easy_setopt(eh, CURLOPT_NOSIGNAL, 1);
     curl_easy_setopt(eh, CURLOPT_FOLLOWLOCATION, 1);
@@ -184,6 +185,13 @@ std::string httpGet(const std::string &url, size_t chunk_size, std::atomic<bool>
   return httpDownload(url, result, chunk_size, size, abort) ? result : "";
 }
 
+std::string httpGetRange(const std::string &url, size_t begin, size_t end, size_t chunk_size, std::atomic<bool> *abort) {
+  if (end <= begin) return {};
+
+  std::string result(end - begin, '\0');
+  return httpDownload(url, result, chunk_size, result.size(), abort, begin) ? result : "";
+}
+
 bool httpDownload(const std::string &url, const std::string &file, size_t chunk_size, std::atomic<bool> *abort) {
   size_t size = getRemoteFileSize(url);
   if (size == 0) return false;
@@ -200,6 +208,13 @@ std::string decompressBZ2(const std::string &in) {
 std::string decompressBZ2(const std::byte *in, size_t in_size) {
   if (in_size == 0) return {};
 
+  std::string out = decompressBZ2Parallel(in, in_size);
+  return !out.empty() ? out : decompressBZ2Sequential(in, in_size);
+}
+
+std::string decompressBZ2Sequential(const std::byte *in, size_t in_size) {
+  if (in_size == 0) return {};
+
   bz_stream strm = {};
   int bzerror = BZ2_bzDecompressInit(&strm, 0, 0);
   assert(bzerror == BZ_OK);
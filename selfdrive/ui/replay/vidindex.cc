@@ -0,0 +1,141 @@
+#include "selfdrive/ui/replay/vidindex.h"
+
+#include <cstdio>
+#include <fstream>
+
+extern "C" {
+#include "tools/lib/vidindex/bitstream.h"
+}
+
+namespace {
+
+const uint32_t START_CODE = 0x000001;
+const uint32_t INDEX_FILE_MAGIC = 0x58444956;  // "VIDX"
+const uint32_t INDEX_FILE_VERSION = 1;
+
+// Table 7-1
+enum HevcNalType {
+  HEVC_NAL_TYPE_BLA_W_LP = 16,
+  HEVC_NAL_TYPE_CRA_NUT = 21,
+  HEVC_NAL_TYPE_RSV_IRAP_VCL23 = 23,
+  HEVC_NAL_TYPE_VPS_NUT = 32,
+  HEVC_NAL_TYPE_SPS_NUT = 33,
+  HEVC_NAL_TYPE_PPS_NUT = 34,
+  HEVC_NAL_TYPE_AUD_NUT = 35,
+  HEVC_NAL_TYPE_PREFIX_SEI_NUT = 39,
+};
+
+inline uint32_t read24be(const uint8_t *ptr) {
+  return (ptr[0] << 16) | (ptr[1] << 8) | ptr[2];
+}
+
+}  // namespace
+
+bool VideoIndex::build(const uint8_t *data, size_t size) {
+  prefix.clear();
+  frames_.clear();
+  if (size < 8 || data[0] != 0 || read24be(data + 1) != START_CODE) return false;
+
+  // pps. ignore for now
+  const uint32_t num_extra_slice_header_bits = 0;
+  const uint32_t dependent_slice_segments_enabled_flag = 0;
+
+  const uint8_t *ptr = data + 1;
+  const uint8_t *ptr_end = data + size;
+  const uint8_t *au_start = data;
+  while (ptr < ptr_end) {
+    const uint8_t *next = ptr + 1;
+    for (; next < ptr_end - 4; next++) {
+      if (read24be(next) == START_CODE) break;
+    }
+    const size_t nal_size = next - ptr;
+    if (nal_size < 6) break;
+
+    struct bitstream bs = {};
+    bs_init(&bs, ptr, nal_size);
+    bs_get(&bs, 24);  // start code
+
+    // nal_unit_header
+    bs_get(&bs, 1);  // forbidden_zero_bit
+    const uint32_t nal_unit_type = bs_get(&bs, 6);
+    bs_get(&bs, 6);  // nuh_layer_id
+    bs_get(&bs, 3);  // nuh_temporal_id_plus1
+
+    if (nal_unit_type <= HEVC_NAL_TYPE_CRA_NUT) {
+      // slice_segment_header
+      const uint32_t first_slice_segment_in_pic_flag = bs_get(&bs, 1);
+      if (nal_unit_type >= HEVC_NAL_TYPE_BLA_W_LP && nal_unit_type <= HEVC_NAL_TYPE_RSV_IRAP_VCL23) {
+        bs_get(&bs, 1);  // no_output_of_prior_pics_flag
+      }
+      bs_get(&bs, 1);  // slice_pic_parameter_set_id
+      if (first_slice_segment_in_pic_flag && !dependent_slice_segments_enabled_flag) {
+        for (int i = 0; i < num_extra_slice_header_bits; i++) {
+          bs_get(&bs, 1);
+        }
+        const uint32_t slice_type = bs_ue(&bs);
+        frames_.push_back({.slice_type = slice_type, .offset = (uint32_t)((au_start ? au_start : ptr) - data)});
+        au_start = nullptr;
+      }
+    } else if ((nal_unit_type >= HEVC_NAL_TYPE_VPS_NUT && nal_unit_type <= HEVC_NAL_TYPE_AUD_NUT) ||
+               nal_unit_type == HEVC_NAL_TYPE_PREFIX_SEI_NUT) {
+      // these start a new access unit
+      if (!au_start) au_start = ptr;
+      if (frames_.empty() && nal_unit_type != HEVC_NAL_TYPE_AUD_NUT && nal_unit_type != HEVC_NAL_TYPE_PREFIX_SEI_NUT) {
+        prefix.append((const char *)ptr, nal_size);
+      }
+    }
+    ptr = next;
+  }
+
+  if (frames_.empty()) return false;
+
+  frames_.push_back({.slice_type = (uint32_t)-1, .offset = (uint32_t)size});
+  return true;
+}
+
+int VideoIndex::keyFrameBefore(int idx) const {
+  while (idx > 0 && !isKeyFrame(idx)) --idx;
+  return idx;
+}
+
+int VideoIndex::nextKeyFrame(int idx) const {
+  const int count = frameCount();
+  while (++idx < count && !isKeyFrame(idx)) {}
+  return idx;
+}
+
+bool VideoIndex::load(const std::string &file) {
+  std::ifstream f(file, std::ios::binary);
+  uint32_t header[3] = {};
+  if (!f.read((char *)header, sizeof(header)) || header[0] != INDEX_FILE_MAGIC || header[1] != INDEX_FILE_VERSION) {
+    return false;
+  }
+
+  prefix.resize(header[2]);
+  uint32_t count = 0;
+  if (!f.read(prefix.data(), prefix.size()) || !f.read((char *)&count, sizeof(count)) || count < 2) {
+    return false;
+  }
+  frames_.resize(count);
+  if (!f.read((char *)frames_.data(), count * sizeof(Frame))) {
+    frames_.clear();
+    return false;
+  }
+  return true;
+}
+
+bool VideoIndex::save(const std::string &file) const {
+  // write to a temp file first, other processes may read the index concurrently
+  const std::string tmp_file = file + ".tmp";
+  {
+    std::ofstream f(tmp_file, std::ios::binary | std::ios::out);
+    const uint32_t header[3] = {INDEX_FILE_MAGIC, INDEX_FILE_VERSION, (uint32_t)prefix.size()};
+    const uint32_t count = frames_.size();
+    f.write((const char *)header, sizeof(header));
+    f.write(prefix.data(), prefix.size());
+    f.write((const char *)&count, sizeof(count));
+    f.write((const char *)frames_.data(), count * sizeof(Frame));
+    if (!f) return false;
+  }
+  return ::rename(tmp_file.c_str(), file.c_str()) == 0;
+}
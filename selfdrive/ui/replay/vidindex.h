@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Table 7-7
+enum HevcSliceType {
+  HEVC_SLICE_B = 0,
+  HEVC_SLICE_P = 1,
+  HEVC_SLICE_I = 2,
+};
+
+// frame index of a raw HEVC (Annex B) stream, built with the logic of tools/lib/vidindex.
+// each frame spans [offset, next frame's offset), starting at the first NAL of its access unit,
+// so a frame can be decoded from a keyframe without demuxing the whole file.
+class VideoIndex {
+public:
+  struct Frame {
+    uint32_t slice_type;
+    uint32_t offset;
+  };
+
+  bool build(const uint8_t *data, size_t size);
+  bool load(const std::string &file);
+  bool save(const std::string &file) const;
+
+  inline size_t frameCount() const { return frames_.empty() ? 0 : frames_.size() - 1; }
+  inline size_t fileSize() const { return frames_.empty() ? 0 : frames_.back().offset; }
+  inline bool isKeyFrame(int idx) const { return frames_[idx].slice_type == HEVC_SLICE_I; }
+  inline uint32_t offset(int idx) const { return frames_[idx].offset; }
+  inline uint32_t frameSize(int idx) const { return frames_[idx + 1].offset - frames_[idx].offset; }
+  int keyFrameBefore(int idx) const;
+  int nextKeyFrame(int idx) const;
+
+  // VPS/SPS/PPS, usable as decoder extradata
+  std::string prefix;
+
+private:
+  // the last entry is a sentinel with the file size as offset
+  std::vector<Frame> frames_;
+};
@@ -5,6 +5,11 @@ import bz2
 import urllib.parse
 import capnp
 
+try:
+  from tools.lib.parallel_bz2_pyx import decompress as bz2_decompress
+except ImportError:
+  bz2_decompress = bz2.decompress
+
 try:
   from xx.chffr.lib.filereader import FileReader
 except ImportError:
@@ -85,7 +90,7 @@ class LogReader(object):
       # old rlogs weren't bz2 compressed
       ents = capnp_log.Event.read_multiple_bytes(dat)
     elif ext == ".bz2":
-      dat = bz2.decompress(dat)
+      dat = bz2_decompress(dat)
       ents = capnp_log.Event.read_multiple_bytes(dat)
     else:
       raise Exception(f"unknown extension {ext}")
@@ -0,0 +1,17 @@
+# distutils: language = c++
+# cython: language_level=3
+import bz2
+from libcpp.string cimport string
+
+cdef extern from "selfdrive/ui/replay/parallel_bz2.h":
+  string decompressBZ2Parallel(const string &in_, int num_threads) nogil
+
+def decompress(bytes dat, int num_threads=0):
+  cdef string in_ = dat
+  cdef string out
+  with nogil:
+    out = decompressBZ2Parallel(in_, num_threads)
+  if out.empty():
+    # single block, single core or not safely splittable
+    return bz2.decompress(dat)
+  return out